@@ -0,0 +1,114 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/allocator.h"
+
+namespace
+{
+    const CLchar* const c_churnScript =
+        "local t = {}\n"
+        "for i = 1, 200 do\n"
+        "    t[i] = { x = i, y = i * 0.5, name = 'item' .. i }\n"
+        "end\n"
+        "return #t\n";
+
+    // mimics Lua's allocation pattern: many small blocks of a handful of sizes, freed in mixed order
+    template <typename _Allocator>
+    void AllocFreePattern(_Allocator& allocator)
+    {
+        static const CLsize_t sizes[] = { 24, 32, 40, 56, 64, 72, 96, 128, 200, 320 };
+        constexpr CLsize_t count = 256;
+        void* blocks[count];
+
+        for (CLsize_t i = 0; i < count; ++i)
+        {
+            blocks[i] = allocator.GetFunction()(allocator.GetUserData(), nullptr, LUA_TTABLE, sizes[i % 10]);
+        }
+
+        // grow every fourth block like a string buffer or node array would
+        for (CLsize_t i = 0; i < count; i += 4)
+        {
+            const auto oldSize = sizes[i % 10];
+            blocks[i] = allocator.GetFunction()(allocator.GetUserData(), blocks[i], oldSize, oldSize * 2);
+        }
+
+        for (CLsize_t i = 0; i < count; ++i)
+        {
+            const auto index = (i * 7) % count;
+            const auto size = index % 4 == 0 ? sizes[index % 10] * 2 : sizes[index % 10];
+            allocator.GetFunction()(allocator.GetUserData(), blocks[index], size, 0);
+        }
+    }
+
+    template <typename _Allocator>
+    void RunScript(const CLchar* name)
+    {
+        _Allocator allocator;
+        auto state = Cloud::Lua::NewStateAndSetup(&allocator);
+        auto* s = state.get();
+
+        luaL_loadstring(s, c_churnScript);
+        lua_setglobal(s, "churn");
+
+        Cloud::Bench::Measure("allocator", name, 20000, [s]()
+        {
+            lua_getglobal(s, "churn");
+            lua_pcall(s, 0, 1, 0);
+            Cloud::Bench::DoNotOptimize(lua_tointeger(s, -1));
+            lua_pop(s, 1);
+        });
+    }
+
+    template <typename _Allocator>
+    void RunStateCreation(const CLchar* name)
+    {
+        Cloud::Bench::Measure("allocator", name, 2000, []()
+        {
+            _Allocator allocator;
+            auto state = Cloud::Lua::NewStateAndSetup(&allocator);
+            Cloud::Bench::DoNotOptimize(state);
+        });
+    }
+}
+
+LUACPP_BENCHMARK(AllocatorPattern)
+{
+    Cloud::LuaDefaultAllocator defaultAllocator;
+    Cloud::Bench::Measure("allocator", "pattern/l_alloc", 20000, [&defaultAllocator]()
+    {
+        AllocFreePattern(defaultAllocator);
+    });
+
+    Cloud::LuaPoolAllocator poolAllocator;
+    Cloud::Bench::Measure("allocator", "pattern/pool", 20000, [&poolAllocator]()
+    {
+        AllocFreePattern(poolAllocator);
+    });
+}
+
+LUACPP_BENCHMARK(AllocatorScript)
+{
+    RunScript<Cloud::LuaDefaultAllocator>("script/l_alloc");
+    RunScript<Cloud::LuaPoolAllocator>("script/pool");
+}
+
+LUACPP_BENCHMARK(AllocatorStateCreation)
+{
+    RunStateCreation<Cloud::LuaDefaultAllocator>("newstate/l_alloc");
+    RunStateCreation<Cloud::LuaPoolAllocator>("newstate/pool");
+}
@@ -0,0 +1,87 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/bytecode_cache.h"
+
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    // a generated script of a few hundred functions, roughly what a large game module looks like
+    void WriteScript(const std::filesystem::path& path)
+    {
+        std::ofstream file(path);
+        file << "local M = {}\n";
+        for (CLint i = 0; i < 400; ++i)
+        {
+            file << "function M.update" << i << "(entity, dt)\n"
+                 << "    local speed = entity.speed or " << i << "\n"
+                 << "    entity.x = entity.x + math.cos(entity.angle) * speed * dt\n"
+                 << "    entity.y = entity.y + math.sin(entity.angle) * speed * dt\n"
+                 << "    if entity.x > 100 then entity.x = -100 elseif entity.x < -100 then entity.x = 100 end\n"
+                 << "    return entity\n"
+                 << "end\n";
+        }
+        file << "return M\n";
+    }
+
+    void Load(Cloud::LuaState& state, const Cloud::Lua::String& path)
+    {
+        state.LoadFile(path.c_str());
+        state.Pop(1);
+    }
+}
+
+LUACPP_BENCHMARK(BytecodeCache)
+{
+    const auto root = std::filesystem::temp_directory_path() / "luacpp_bench_bytecode";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+
+    const auto script = (root / "module.lua").string();
+    WriteScript(script);
+
+    // plain luaL_loadfile, what LoadFile did before files were mapped
+    auto* rawState = luaL_newstate();
+    Cloud::Bench::Measure("bytecodecache", "loadfile/stdio", 500, [rawState, &script]()
+    {
+        luaL_loadfile(rawState, script.c_str());
+        lua_pop(rawState, 1);
+    });
+    lua_close(rawState);
+
+    Cloud::LuaState state;
+
+    Cloud::Bench::Measure("bytecodecache", "loadfile/source", 500, [&state, &script]()
+    {
+        Load(state, script);
+    });
+
+    Cloud::LuaBytecodeCache cache((root / "cache").string().c_str());
+    state.SetBytecodeCache(&cache);
+    Load(state, script);
+
+    Cloud::Bench::Measure("bytecodecache", "loadfile/cached", 500, [&state, &script]()
+    {
+        Load(state, script);
+    });
+
+    state.SetBytecodeCache(nullptr);
+    std::filesystem::remove_all(root);
+}
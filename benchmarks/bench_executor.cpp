@@ -0,0 +1,77 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/executor.h"
+
+namespace
+{
+    constexpr CLint c_jobsPerIteration = 2000;
+
+    // roughly a microsecond of VM work per job
+    const CLchar* const c_jobScript =
+        "function work(seed)\n"
+        "    local x = seed\n"
+        "    for i = 1, 200 do x = (x * 1103515245 + 12345) % 2147483648 end\n"
+        "    return x\n"
+        "end\n";
+
+    void MeasureWorkers(CLsize_t workerCount, const CLchar* name)
+    {
+        Cloud::LuaExecutor executor(workerCount, [](Cloud::LuaStateEx& state)
+        {
+            state.DoChunk(c_jobScript);
+        });
+
+        std::vector<std::future<CLint>> results(c_jobsPerIteration);
+        Cloud::Bench::Measure("executor", name, 20, [&executor, &results]()
+        {
+            for (CLint i = 0; i < c_jobsPerIteration; ++i)
+            {
+                results[i] = executor.Submit<CLint>("work", i);
+            }
+            for (auto& result : results)
+            {
+                Cloud::Bench::DoNotOptimize(result.get());
+            }
+        }, c_jobsPerIteration);
+    }
+}
+
+LUACPP_BENCHMARK(Executor)
+{
+    Cloud::LuaStateEx state;
+    state.DoChunk(c_jobScript);
+    auto work = state.GetFunction<CLint(CLint)>("work");
+    Cloud::Bench::Measure("executor", "job/inline on one state", 20, [&work]()
+    {
+        for (CLint i = 0; i < c_jobsPerIteration; ++i)
+        {
+            Cloud::Bench::DoNotOptimize(work(i));
+        }
+    }, c_jobsPerIteration);
+
+    MeasureWorkers(1, "job/1 worker");
+    MeasureWorkers(2, "job/2 workers");
+    MeasureWorkers(4, "job/4 workers");
+
+    const auto cores = std::thread::hardware_concurrency();
+    if (cores > 4)
+    {
+        MeasureWorkers(cores, "job/hardware_concurrency workers");
+    }
+}
@@ -0,0 +1,136 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_ex.h"
+
+namespace
+{
+    constexpr CLint c_callsPerLoop = 1000;
+
+    const CLchar* const c_loopScript =
+        "function loop(f, n)\n"
+        "    local s = 0\n"
+        "    for i = 1, n do s = f(i, 1) end\n"
+        "    return s\n"
+        "end\n"
+        "function luaAdd(a, b)\n"
+        "    return a + b\n"
+        "end\n";
+
+    CLint Add(CLint a, CLint b)
+    {
+        return a + b;
+    }
+
+    int RawAdd(lua_State* state)
+    {
+        const auto a = lua_tointeger(state, 1);
+        const auto b = lua_tointeger(state, 2);
+        lua_pushinteger(state, a + b);
+        return 1;
+    }
+
+    struct Adder
+    {
+        CLint Add(CLint a, CLint b) { return a + b + m_bias; }
+        CLint m_bias = 0;
+    };
+
+    void MeasureLoop(Cloud::LuaStateEx& state, const CLchar* name, const CLchar* function)
+    {
+        Cloud::Bench::Measure("function", name, 2000, [&state, function]()
+        {
+            state.GetGlobal("loop");
+            state.GetGlobal(function);
+            state.Push(c_callsPerLoop);
+            state.PCall(2, 1);
+            Cloud::Bench::DoNotOptimize(state.To<CLint>(-1));
+            state.Pop(1);
+        }, c_callsPerLoop);
+    }
+}
+
+LUACPP_BENCHMARK(FunctionCall)
+{
+    Cloud::LuaStateEx state;
+    state.DoChunk(c_loopScript);
+
+    Adder adder;
+    state.Register("rawAdd", &RawAdd);
+    state.RegisterFunction<&Add>("nativeAdd");
+    state.RegisterMethod<&Adder::Add>("methodAdd", &adder);
+    state.RegisterFunction("functionAdd", Cloud::Lua::Function<CLint(CLint, CLint)>(&Add));
+
+    MeasureLoop(state, "call/raw C API", "rawAdd");
+    MeasureLoop(state, "call/RegisterFunction<&f>", "nativeAdd");
+    MeasureLoop(state, "call/RegisterMethod<&C::m>", "methodAdd");
+    MeasureLoop(state, "call/RegisterFunction(std::function)", "functionAdd");
+}
+
+LUACPP_BENCHMARK(FunctionRef)
+{
+    Cloud::LuaStateEx state;
+    state.DoChunk(c_loopScript);
+
+    auto* s = Cloud::Bench::GetLuaState(state);
+    Cloud::Bench::Measure("function", "lua call/raw C API", 200000, [s]()
+    {
+        lua_getglobal(s, "luaAdd");
+        lua_pushinteger(s, 1);
+        lua_pushinteger(s, 2);
+        lua_pcall(s, 2, 1, 0);
+        Cloud::Bench::DoNotOptimize(lua_tointeger(s, -1));
+        lua_pop(s, 1);
+    });
+
+    Cloud::Bench::Measure("function", "lua call/LuaStateEx::Call", 200000, [&state]()
+    {
+        Cloud::Bench::DoNotOptimize(state.Call<CLint>("luaAdd", 1, 2));
+    });
+
+    auto luaAdd = state.GetFunction<CLint(CLint, CLint)>("luaAdd");
+    Cloud::Bench::Measure("function", "lua call/LuaFunctionRef", 200000, [&luaAdd]()
+    {
+        Cloud::Bench::DoNotOptimize(luaAdd(1, 2));
+    });
+}
+
+LUACPP_BENCHMARK(FunctionBatch)
+{
+    constexpr CLsize_t batchSize = 1000;
+
+    Cloud::LuaStateEx state;
+    state.DoChunk(c_loopScript);
+
+    auto luaAdd = state.GetFunction<CLint(CLint, CLint)>("luaAdd");
+    std::vector<std::tuple<CLint, CLint>> args(batchSize, std::make_tuple(1, 2));
+    std::vector<CLint> results(batchSize);
+
+    Cloud::Bench::Measure("function", "batch/LuaFunctionRef loop", 200, [&luaAdd, &args, &results]()
+    {
+        for (CLsize_t i = 0; i < args.size(); ++i)
+        {
+            results[i] = luaAdd(std::get<0>(args[i]), std::get<1>(args[i]));
+        }
+    }, batchSize);
+
+    Cloud::Bench::Measure("function", "batch/LuaFunctionRef::CallBatch", 200, [&luaAdd, &args, &results]()
+    {
+        Cloud::Bench::DoNotOptimize(luaAdd.CallBatch(args, results));
+    }, batchSize);
+}
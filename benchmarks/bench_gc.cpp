@@ -0,0 +1,107 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_ex.h"
+
+namespace
+{
+    // a frame of a game-like script: short-lived tables and strings while a rolling window of
+    // entities stays alive, so every cycle has a sizeable heap to mark
+    const CLchar* const c_frameScript =
+        "local live, cursor = {}, 0\n"
+        "function frame()\n"
+        "    for i = 1, 200 do\n"
+        "        cursor = cursor % 20000 + 1\n"
+        "        live[cursor] = { x = i, y = i * 2, name = 'entity' .. cursor, tags = { i } }\n"
+        "    end\n"
+        "end\n"
+        "for i = 1, 100 do frame() end\n";
+
+    const CLsize_t c_frameCount = 2000;
+
+    struct GcSettings
+    {
+        CLint           pause;
+        CLint           stepMultiplier;
+        const CLchar*   medianName;
+        const CLchar*   p99Name;
+        const CLchar*   maxName;
+    };
+
+    // LUAI_GCPAUSE and LUAI_GCMUL are 200 each
+    const GcSettings c_settings[] =
+    {
+        { 200, 200, "pause 200 mul 200/step p50", "pause 200 mul 200/step p99", "pause 200 mul 200/step max" },
+        { 100, 200, "pause 100 mul 200/step p50", "pause 100 mul 200/step p99", "pause 100 mul 200/step max" },
+        { 400, 200, "pause 400 mul 200/step p50", "pause 400 mul 200/step p99", "pause 400 mul 200/step max" },
+        { 200, 100, "pause 200 mul 100/step p50", "pause 200 mul 100/step p99", "pause 200 mul 100/step max" },
+        { 200, 400, "pause 200 mul 400/step p50", "pause 200 mul 400/step p99", "pause 200 mul 400/step max" },
+    };
+
+    void ReportPercentile(const CLchar* name, const Cloud::Lua::LatencyHistogram& histogram, double percentile)
+    {
+        Cloud::Bench::Result result = { "gc", name, static_cast<CLsize_t>(histogram.GetCount()), static_cast<double>(histogram.GetPercentile(percentile)) };
+        Cloud::Bench::Report(result);
+    }
+}
+
+// Step pauses of the incremental collector under different collectgarbage("setpause") and
+// ("setstepmul") settings, reported as percentiles of the step histogram (iterations is the step
+// count). Larger multipliers mean fewer, longer steps; larger pauses fewer cycles.
+LUACPP_BENCHMARK(GcPauses)
+{
+    for (const auto& settings : c_settings)
+    {
+        Cloud::LuaStateEx state;
+        auto* luaState = Cloud::Bench::GetLuaState(state);
+        lua_gc(luaState, LUA_GCSETPAUSE, settings.pause);
+        lua_gc(luaState, LUA_GCSETSTEPMUL, settings.stepMultiplier);
+        state.DoChunk(c_frameScript, "@frames.lua");
+
+        state.SetGcTelemetry(true);
+        const auto start = Cloud::Bench::Clock::now();
+        for (CLsize_t i = 0; i < c_frameCount; ++i)
+        {
+            state.Call<>("frame");
+        }
+        const auto elapsed = Cloud::Bench::ElapsedNanoseconds(start, Cloud::Bench::Clock::now());
+
+        const auto stats = state.GetGcStats();
+        ReportPercentile(settings.medianName, stats.steps, 50.0);
+        ReportPercentile(settings.p99Name, stats.steps, 99.0);
+        ReportPercentile(settings.maxName, stats.steps, 100.0);
+        printf("%-16s pause %d mul %d: %.0f ns/frame, peak %zu KB, p99 propagate %llu ns, atomic %llu ns, sweep %llu ns\n",
+               "gc", settings.pause, settings.stepMultiplier, elapsed / static_cast<double>(c_frameCount), state.GetMemoryStats().peakBytes / 1024,
+               static_cast<unsigned long long>(stats.GetPhase(Cloud::Lua::GcPhase::Propagate).GetPercentile(99.0)),
+               static_cast<unsigned long long>(stats.GetPhase(Cloud::Lua::GcPhase::Atomic).GetPercentile(99.0)),
+               static_cast<unsigned long long>(stats.GetPhase(Cloud::Lua::GcPhase::Sweep).GetPercentile(99.0)));
+    }
+
+    // cost of the hook itself
+    for (CLbool telemetry : { false, true })
+    {
+        Cloud::LuaStateEx state;
+        state.DoChunk(c_frameScript, "@frames.lua");
+        state.SetGcTelemetry(telemetry);
+
+        Cloud::Bench::Measure("gc", telemetry ? "frame/telemetry on" : "frame/telemetry off", c_frameCount, [&state]()
+        {
+            state.Call<>("frame");
+        });
+    }
+}
@@ -0,0 +1,50 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/instrumentation.h"
+
+LUACPP_BENCHMARK(Instrumentation)
+{
+    Cloud::Lua::LatencyHistogram histogram;
+    std::uint64_t value = 1;
+    Cloud::Bench::Measure("instrumentation", "histogram/Record", 10000000, [&histogram, &value]()
+    {
+        value = value * 6364136223846793005ull + 1442695040888963407ull;
+        histogram.Record(value >> 40);
+    });
+
+    auto counters = Cloud::Lua::MakeUnique<Cloud::LuaCallCounters>();
+    Cloud::Bench::Measure("instrumentation", "counters/CountCall+RecordLatency", 10000000, [&counters, &value]()
+    {
+        value = value * 6364136223846793005ull + 1442695040888963407ull;
+        counters->CountCall();
+        counters->RecordLatency(value >> 40);
+    });
+
+    Cloud::Bench::Measure("instrumentation", "counters/BeginCall+EndCall", 10000000, [&counters]()
+    {
+        counters->EndCall(counters->BeginCall());
+    });
+
+    Cloud::Lua::BindingStats stats;
+    Cloud::Bench::Measure("instrumentation", "counters/Snapshot", 10000, [&counters, &stats]()
+    {
+        counters->Snapshot(stats);
+        Cloud::Bench::DoNotOptimize(stats);
+    });
+}
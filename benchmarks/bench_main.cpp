@@ -0,0 +1,151 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include <cstring>
+
+const void* volatile Cloud::Bench::g_sink = nullptr;
+
+namespace
+{
+    void WriteJsonString(FILE* file, const CLchar* text)
+    {
+        fputc('"', file);
+        for (; *text; ++text)
+        {
+            if (*text == '"' || *text == '\\')
+            {
+                fputc('\\', file);
+            }
+            fputc(*text, file);
+        }
+        fputc('"', file);
+    }
+
+    // "op/raw C API" in the same group is the baseline of every other "op/..." result
+    const Cloud::Bench::Result* FindBaseline(const Cloud::Bench::Result& result)
+    {
+        const auto* separator = strchr(result.name, '/');
+        if (!separator)
+        {
+            return nullptr;
+        }
+
+        const auto prefixLength = static_cast<CLsize_t>(separator - result.name) + 1;
+        for (const auto& other : Cloud::Bench::Results())
+        {
+            if (&other != &result && strcmp(other.group, result.group) == 0
+                && strncmp(other.name, result.name, prefixLength) == 0 && strcmp(other.name + prefixLength, "raw C API") == 0)
+            {
+                return &other;
+            }
+        }
+
+        return nullptr;
+    }
+
+    CLbool WriteJson(const CLchar* fileName)
+    {
+        FILE* file = fopen(fileName, "w");
+        if (!file)
+        {
+            return false;
+        }
+
+#ifdef LUACPP_DEBUG
+        const CLchar* build = "debug";
+#else
+        const CLchar* build = "release";
+#endif
+
+        fprintf(file, "{\n  \"lua\": ");
+        WriteJsonString(file, LUA_RELEASE);
+        fprintf(file, ",\n  \"build\": \"%s\",\n  \"results\": [", build);
+
+        const auto& results = Cloud::Bench::Results();
+        for (CLsize_t i = 0; i < results.size(); ++i)
+        {
+            const auto& result = results[i];
+            fprintf(file, "%s\n    { \"group\": ", i > 0 ? "," : "");
+            WriteJsonString(file, result.group);
+            fprintf(file, ", \"name\": ");
+            WriteJsonString(file, result.name);
+            fprintf(file, ", \"iterations\": %zu, \"ns_per_op\": %.3f", result.iterations, result.nanosecondsPerOp);
+            if (result.instructions > 0)
+            {
+                fprintf(file, ", \"instructions\": %llu", static_cast<unsigned long long>(result.instructions));
+            }
+            if (result.peakBytes > 0)
+            {
+                fprintf(file, ", \"peak_bytes\": %zu", result.peakBytes);
+            }
+
+            const auto* baseline = FindBaseline(result);
+            if (baseline && baseline->nanosecondsPerOp > 0.0)
+            {
+                fprintf(file, ", \"vs_raw\": %.3f", result.nanosecondsPerOp / baseline->nanosecondsPerOp);
+            }
+            fprintf(file, " }");
+        }
+
+        fprintf(file, "\n  ]\n}\n");
+        return fclose(file) == 0;
+    }
+}
+
+// usage: LuaCppBenchmarks [filter] [--json file] [--scripts dir]
+// runs every registered benchmark whose name contains filter, --json also writes the results to file,
+// with each result's time relative to its "raw C API" baseline where there is one. --scripts is the
+// directory of the script workloads (benchmarks/scripts), the working directory by default
+int main(int argc, char** argv)
+{
+    const CLchar* filter = nullptr;
+    const CLchar* jsonFile = nullptr;
+    for (CLint i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            jsonFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--scripts") == 0 && i + 1 < argc)
+        {
+            Cloud::Bench::ScriptDirectory() = argv[++i];
+        }
+        else
+        {
+            filter = argv[i];
+        }
+    }
+
+    for (auto&& entry : Cloud::Bench::Registry())
+    {
+        if (filter && !strstr(entry.name, filter))
+        {
+            continue;
+        }
+
+        entry.func();
+    }
+
+    if (jsonFile && !WriteJson(jsonFile))
+    {
+        fprintf(stderr, "couldn't write %s\n", jsonFile);
+        return 1;
+    }
+
+    return 0;
+}
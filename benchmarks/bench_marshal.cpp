@@ -0,0 +1,116 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_ex.h"
+#include <cstring>
+
+namespace
+{
+    constexpr CLsize_t c_elementCount = 1000;
+}
+
+LUACPP_BENCHMARK(MarshalVector)
+{
+    Cloud::LuaStateEx state;
+    auto* s = Cloud::Bench::GetLuaState(state);
+
+    std::vector<CLfloat> values(c_elementCount);
+    for (CLsize_t i = 0; i < values.size(); ++i)
+    {
+        values[i] = static_cast<CLfloat>(i) * 0.5f;
+    }
+
+    Cloud::Bench::Measure("marshal", "push vector<float>/grow per element", 5000, [s, &values]()
+    {
+        lua_newtable(s);
+        for (CLsize_t i = 0; i < values.size(); ++i)
+        {
+            lua_pushnumber(s, values[i]);
+            lua_seti(s, -2, static_cast<lua_Integer>(i + 1));
+        }
+        lua_pop(s, 1);
+    });
+
+    Cloud::Bench::Measure("marshal", "push vector<float>/LuaState::Push", 5000, [&state, &values]()
+    {
+        state.Push(values);
+        state.Pop(1);
+    });
+
+    state.Push(values);
+
+    Cloud::Bench::Measure("marshal", "read vector<float>/lua_next", 5000, [s]()
+    {
+        std::vector<CLfloat> result;
+        lua_pushnil(s);
+        while (lua_next(s, -2))
+        {
+            result.push_back(static_cast<CLfloat>(lua_tonumber(s, -1)));
+            lua_pop(s, 1);
+        }
+        Cloud::Bench::DoNotOptimize(result);
+    });
+
+    Cloud::Bench::Measure("marshal", "read vector<float>/LuaState::To", 5000, [&state]()
+    {
+        Cloud::Bench::DoNotOptimize(state.To<std::vector<CLfloat>>(-1));
+    });
+
+    state.Pop(1);
+}
+
+LUACPP_BENCHMARK(MarshalString)
+{
+    Cloud::LuaStateEx state;
+
+    // distinct buffers, lua_pushstring caches strings by address
+    std::vector<Cloud::Lua::String> texts;
+    for (CLint i = 0; i < 1024; ++i)
+    {
+        texts.push_back(Cloud::Lua::String(200, 'x') + std::to_string(i));
+    }
+
+    CLsize_t next = 0;
+    Cloud::Bench::Measure("marshal", "push string/const CLchar*", 200000, [&state, &texts, &next]()
+    {
+        state.Push(texts[next++ % texts.size()].c_str());
+        state.Pop(1);
+    });
+
+    Cloud::Bench::Measure("marshal", "push string/Lua::StringView", 200000, [&state, &texts, &next]()
+    {
+        state.Push(Cloud::Lua::StringView(texts[next++ % texts.size()]));
+        state.Pop(1);
+    });
+
+    const auto& text = texts.front();
+    state.Push(text);
+
+    Cloud::Bench::Measure("marshal", "read string/const CLchar* + strlen", 200000, [&state]()
+    {
+        const auto* value = state.To<const CLchar*>(-1);
+        Cloud::Bench::DoNotOptimize(strlen(value));
+    });
+
+    Cloud::Bench::Measure("marshal", "read string/Lua::StringView", 200000, [&state]()
+    {
+        Cloud::Bench::DoNotOptimize(state.To<Cloud::Lua::StringView>(-1).size());
+    });
+
+    state.Pop(1);
+}
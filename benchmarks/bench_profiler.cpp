@@ -0,0 +1,53 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/profiler.h"
+#include "../source/state_ex.h"
+
+namespace
+{
+    const CLchar* const c_workloadScript =
+        "local function fib(n) if n < 2 then return n end return fib(n - 1) + fib(n - 2) end\n"
+        "local function fill(n) local t = {} for i = 1, n do t[i] = tostring(i) end return #t end\n"
+        "function work()\n"
+        "    return fib(20) + fill(2000)\n"
+        "end\n";
+}
+
+LUACPP_BENCHMARK(Profiler)
+{
+    for (CLsize_t rate : { 0, 1000, 10000 })
+    {
+        Cloud::LuaStateEx state;
+        state.DoChunk(c_workloadScript, "@workload.lua");
+
+        Cloud::LuaProfiler profiler(state);
+        if (rate > 0)
+        {
+            profiler.Start(rate);
+        }
+
+        const auto name = rate == 0 ? "workload/no profiler" : rate == 1000 ? "workload/1 kHz" : "workload/10 kHz";
+        Cloud::Bench::Measure("profiler", name, 500, [&state]()
+        {
+            Cloud::Bench::DoNotOptimize(state.Call<CLint>("work"));
+        });
+
+        profiler.Stop();
+    }
+}
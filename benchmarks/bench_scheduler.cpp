@@ -0,0 +1,69 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/scheduler.h"
+
+namespace
+{
+    constexpr CLint c_actorCount = 10000;
+
+    const CLchar* const c_actorScript =
+        "function actor(id)\n"
+        "    local position = 0\n"
+        "    while true do\n"
+        "        position = position + id\n"
+        "        scheduler.sleep(1)\n"
+        "    end\n"
+        "end\n"
+        "function spinner()\n"
+        "    local n = 0\n"
+        "    while true do n = n + 1 end\n"
+        "end\n";
+}
+
+LUACPP_BENCHMARK(Scheduler)
+{
+    Cloud::LuaStateEx state;
+    Cloud::LuaScheduler scheduler(state);
+    state.DoChunk(c_actorScript);
+
+    Cloud::Bench::Measure("scheduler", "spawn", c_actorCount, [&scheduler]()
+    {
+        scheduler.Spawn("actor", 1);
+    });
+
+    // every actor sleeps one tick per step, so a tick resumes all of them once
+    Cloud::Bench::Measure("scheduler", "tick/resume+sleep per actor", 100, [&scheduler]()
+    {
+        scheduler.Update(1);
+    }, scheduler.GetStats().tasks);
+
+    Cloud::LuaStateEx preemptedState;
+    Cloud::LuaScheduler preemptedScheduler(preemptedState);
+    preemptedState.DoChunk(c_actorScript);
+    for (CLint i = 0; i < 100; ++i)
+    {
+        preemptedScheduler.Spawn("spinner");
+    }
+
+    // a slice is the default budget of 10000 instructions
+    Cloud::Bench::Measure("scheduler", "run/preempted slice", 100, [&preemptedScheduler]()
+    {
+        preemptedScheduler.Run();
+    }, 100);
+}
@@ -0,0 +1,117 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_ex.h"
+
+namespace
+{
+    const CLchar* const c_payloadScript =
+        "function makePayload(count)\n"
+        "    local entities = {}\n"
+        "    for i = 1, count do\n"
+        "        entities[i] = { id = i, name = 'entity' .. i, health = 100.5, alive = true,\n"
+        "                        position = { i * 0.5, i * 1.5, 0.25 }, tags = { 'npc', 'hostile' } }\n"
+        "    end\n"
+        "    return { version = 3, entities = entities }\n"
+        "end\n";
+
+    // the baseline: a recursive lua_next/push copy straight from one stack to the other
+    void CopyValue(lua_State* from, CLint index, lua_State* to)
+    {
+        switch (lua_type(from, index))
+        {
+        case LUA_TNUMBER:
+            if (lua_isinteger(from, index))
+            {
+                lua_pushinteger(to, lua_tointeger(from, index));
+            }
+            else
+            {
+                lua_pushnumber(to, lua_tonumber(from, index));
+            }
+            break;
+        case LUA_TSTRING:
+        {
+            size_t length = 0;
+            const auto* string = lua_tolstring(from, index, &length);
+            lua_pushlstring(to, string, length);
+            break;
+        }
+        case LUA_TBOOLEAN:
+            lua_pushboolean(to, lua_toboolean(from, index));
+            break;
+        case LUA_TTABLE:
+            index = lua_absindex(from, index);
+            lua_newtable(to);
+            lua_pushnil(from);
+            while (lua_next(from, index) != 0)
+            {
+                CopyValue(from, -2, to);
+                CopyValue(from, -1, to);
+                lua_rawset(to, -3);
+                lua_pop(from, 1);
+            }
+            break;
+        default:
+            lua_pushnil(to);
+            break;
+        }
+    }
+
+    void MeasurePayload(CLint entityCount, const CLchar* serializeName, const CLchar* deserializeName, const CLchar* copyName)
+    {
+        Cloud::LuaStateEx source;
+        Cloud::LuaStateEx target;
+        source.DoChunk(c_payloadScript);
+        source.GetGlobal("makePayload");
+        source.Push(entityCount);
+        source.PCall(1, 1);
+
+        Cloud::Lua::String buffer;
+        source.Serialize(-1, buffer);
+        const auto iterations = static_cast<CLsize_t>(200000000 / (buffer.size() * 100)) + 10;
+
+        Cloud::Bench::Measure("serializer", serializeName, iterations, [&source, &buffer]()
+        {
+            buffer.clear();
+            source.Serialize(-1, buffer);
+        });
+
+        Cloud::Bench::Measure("serializer", deserializeName, iterations, [&target, &buffer]()
+        {
+            target.Deserialize(buffer);
+            target.Pop(1);
+        });
+
+        auto* from = Cloud::Bench::GetLuaState(source);
+        auto* to = Cloud::Bench::GetLuaState(target);
+        Cloud::Bench::Measure("serializer", copyName, iterations, [from, to]()
+        {
+            CopyValue(from, -1, to);
+            lua_pop(to, 1);
+        });
+    }
+}
+
+LUACPP_BENCHMARK(Serializer)
+{
+    // ~90 bytes per entity
+    MeasurePayload(11, "serialize/1 KB", "deserialize/1 KB", "copy/1 KB raw C API");
+    MeasurePayload(700, "serialize/64 KB", "deserialize/64 KB", "copy/64 KB raw C API");
+    MeasurePayload(11200, "serialize/1 MB", "deserialize/1 MB", "copy/1 MB raw C API");
+}
@@ -0,0 +1,94 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_ex.h"
+
+namespace
+{
+    const CLchar* const c_configScript =
+        "local units = {}\n"
+        "for i = 1, 2000 do\n"
+        "    units[i] = { id = i, name = 'unit' .. i, cost = i % 7, speed = 1.25, tags = { 'ground', 'melee' } }\n"
+        "end\n"
+        "config = { version = 3, units = units }\n";
+
+    const CLchar* const c_lookupScript =
+        "function lookup(count)\n"
+        "    local units, total = config.units, 0\n"
+        "    for i = 1, count do total = total + units[(i % #units) + 1].cost end\n"
+        "    return total\n"
+        "end\n"
+        "function iterate()\n"
+        "    local total = 0\n"
+        "    for _, unit in ipairs(config.units) do for k, v in pairs(unit) do total = total + 1 end end\n"
+        "    return total\n"
+        "end\n";
+
+    void MeasureLookups(Cloud::LuaStateEx& state, const CLchar* lookupName, const CLchar* iterateName)
+    {
+        state.DoChunk(c_lookupScript);
+
+        Cloud::Bench::Measure("shareddata", lookupName, 100, [&state]()
+        {
+            Cloud::Bench::DoNotOptimize(state.Call<CLint>("lookup", 10000));
+        }, 10000);
+
+        Cloud::Bench::Measure("shareddata", iterateName, 50, [&state]()
+        {
+            Cloud::Bench::DoNotOptimize(state.Call<CLint>("iterate"));
+        }, 2000);
+    }
+}
+
+LUACPP_BENCHMARK(SharedData)
+{
+    Cloud::LuaStateEx loader;
+    loader.DoChunk(c_configScript);
+    loader.GetGlobal("config");
+    const auto shared = loader.ToSharedData(-1);
+    loader.Pop(1);
+
+    {
+        Cloud::LuaStateEx state;
+        state.DoChunk(c_configScript);
+        MeasureLookups(state, "lookup/lua table", "pairs per unit/lua table");
+    }
+
+    {
+        Cloud::LuaStateEx state;
+        state.PushSharedData(shared);
+        state.SetGlobal("config");
+        MeasureLookups(state, "lookup/shared", "pairs per unit/shared");
+    }
+
+    // what each additional state pays for the data
+    Cloud::Bench::Measure("shareddata", "newstate/build tables", 50, []()
+    {
+        Cloud::LuaStateEx state;
+        state.DoChunk(c_configScript);
+        Cloud::Bench::DoNotOptimize(state);
+    });
+
+    Cloud::Bench::Measure("shareddata", "newstate/push shared", 50, [&shared]()
+    {
+        Cloud::LuaStateEx state;
+        state.PushSharedData(shared);
+        state.SetGlobal("config");
+        Cloud::Bench::DoNotOptimize(state);
+    });
+}
@@ -0,0 +1,289 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_ex.h"
+
+namespace
+{
+    // stack operations are a few nanoseconds, each iteration does a batch of them
+    constexpr CLsize_t c_opsPerIteration = 1000;
+    constexpr CLsize_t c_iterations = 2000;
+
+    struct Entity
+    {
+        CLint id = 0;
+    };
+
+    const CLchar* const c_rawEntityType = "BenchEntity";
+
+    // Push<_T> against the lua_push* it ends up as
+    template <typename _T, typename _RawPush>
+    void MeasurePush(Cloud::LuaStateEx& state, const CLchar* rawName, const CLchar* name, const _T& value, _RawPush rawPush)
+    {
+        auto* s = Cloud::Bench::GetLuaState(state);
+
+        Cloud::Bench::Measure("stack", rawName, c_iterations, [s, &value, &rawPush]()
+        {
+            for (CLsize_t i = 0; i < c_opsPerIteration; ++i)
+            {
+                rawPush(s, value);
+                lua_settop(s, 0);
+            }
+        }, c_opsPerIteration);
+
+        Cloud::Bench::Measure("stack", name, c_iterations, [&state, &value]()
+        {
+            for (CLsize_t i = 0; i < c_opsPerIteration; ++i)
+            {
+                state.Push(value);
+                state.SetTop(0);
+            }
+        }, c_opsPerIteration);
+    }
+
+    // To<_T> against the lua_to* it ends up as, the value is on top of the stack
+    template <typename _T, typename _RawTo>
+    void MeasureTo(Cloud::LuaStateEx& state, const CLchar* rawName, const CLchar* name, _RawTo rawTo)
+    {
+        auto* s = Cloud::Bench::GetLuaState(state);
+
+        Cloud::Bench::Measure("stack", rawName, c_iterations, [s, &rawTo]()
+        {
+            for (CLsize_t i = 0; i < c_opsPerIteration; ++i)
+            {
+                Cloud::Bench::DoNotOptimize(rawTo(s, -1));
+            }
+        }, c_opsPerIteration);
+
+        Cloud::Bench::Measure("stack", name, c_iterations, [&state]()
+        {
+            for (CLsize_t i = 0; i < c_opsPerIteration; ++i)
+            {
+                Cloud::Bench::DoNotOptimize(state.To<_T>(-1));
+            }
+        }, c_opsPerIteration);
+    }
+}
+
+LUACPP_BENCHMARK(Stack)
+{
+    Cloud::LuaStateEx state;
+    auto* s = Cloud::Bench::GetLuaState(state);
+
+    MeasurePush(state, "push bool/raw C API", "push bool/LuaState::Push", true,
+        [](lua_State* l, CLbool value) { lua_pushboolean(l, value); });
+    MeasurePush(state, "push int/raw C API", "push int/LuaState::Push", CLint(42),
+        [](lua_State* l, CLint value) { lua_pushinteger(l, value); });
+    MeasurePush(state, "push int64/raw C API", "push int64/LuaState::Push", std::int64_t(1) << 40,
+        [](lua_State* l, std::int64_t value) { lua_pushinteger(l, value); });
+    MeasurePush(state, "push float/raw C API", "push float/LuaState::Push", 1.5f,
+        [](lua_State* l, CLfloat value) { lua_pushnumber(l, value); });
+    MeasurePush(state, "push double/raw C API", "push double/LuaState::Push", 2.5,
+        [](lua_State* l, double value) { lua_pushnumber(l, value); });
+    MeasurePush(state, "push const CLchar*/raw C API", "push const CLchar*/LuaState::Push", static_cast<const CLchar*>("identifier"),
+        [](lua_State* l, const CLchar* value) { lua_pushstring(l, value); });
+    MeasurePush(state, "push Lua::String/raw C API", "push Lua::String/LuaState::Push", Cloud::Lua::String("identifier"),
+        [](lua_State* l, const Cloud::Lua::String& value) { lua_pushlstring(l, value.data(), value.size()); });
+
+    Entity entity;
+    MeasurePush(state, "push pointer/raw C API", "push pointer/LuaState::Push", &entity,
+        [](lua_State* l, Entity* value) { lua_pushlightuserdata(l, value); });
+
+    lua_pushboolean(s, 1);
+    MeasureTo<CLbool>(state, "to bool/raw C API", "to bool/LuaState::To",
+        [](lua_State* l, CLint index) { return lua_toboolean(l, index) != 0; });
+    lua_settop(s, 0);
+
+    lua_pushinteger(s, 42);
+    MeasureTo<CLint>(state, "to int/raw C API", "to int/LuaState::To",
+        [](lua_State* l, CLint index) { return static_cast<CLint>(lua_tointeger(l, index)); });
+    MeasureTo<std::int64_t>(state, "to int64/raw C API", "to int64/LuaState::To",
+        [](lua_State* l, CLint index) { return static_cast<std::int64_t>(lua_tointeger(l, index)); });
+    lua_settop(s, 0);
+
+    lua_pushnumber(s, 2.5);
+    MeasureTo<CLfloat>(state, "to float/raw C API", "to float/LuaState::To",
+        [](lua_State* l, CLint index) { return static_cast<CLfloat>(lua_tonumber(l, index)); });
+    MeasureTo<double>(state, "to double/raw C API", "to double/LuaState::To",
+        [](lua_State* l, CLint index) { return static_cast<double>(lua_tonumber(l, index)); });
+    lua_settop(s, 0);
+
+    lua_pushstring(s, "identifier");
+    MeasureTo<const CLchar*>(state, "to const CLchar*/raw C API", "to const CLchar*/LuaState::To",
+        [](lua_State* l, CLint index) { return lua_tostring(l, index); });
+    MeasureTo<Cloud::Lua::StringView>(state, "to Lua::StringView/raw C API", "to Lua::StringView/LuaState::To",
+        [](lua_State* l, CLint index) { size_t length = 0; const auto* data = lua_tolstring(l, index, &length); return Cloud::Lua::StringView(data, length); });
+    MeasureTo<Cloud::Lua::String>(state, "to Lua::String/raw C API", "to Lua::String/LuaState::To",
+        [](lua_State* l, CLint index) { size_t length = 0; const auto* data = lua_tolstring(l, index, &length); return Cloud::Lua::String(data, length); });
+    lua_settop(s, 0);
+}
+
+LUACPP_BENCHMARK(UserDataChecked)
+{
+    Cloud::LuaStateEx state;
+    auto* s = Cloud::Bench::GetLuaState(state);
+
+    // the usual C API way of a typed pointer: a userdata box with a named metatable
+    Entity entity;
+    luaL_newmetatable(s, c_rawEntityType);
+    lua_pop(s, 1);
+    *static_cast<Entity**>(lua_newuserdata(s, sizeof(Entity*))) = &entity;
+    luaL_setmetatable(s, c_rawEntityType);
+
+    Cloud::Bench::Measure("stack", "to boxed/raw C API", c_iterations, [s]()
+    {
+        for (CLsize_t i = 0; i < c_opsPerIteration; ++i)
+        {
+            auto** box = static_cast<Entity**>(luaL_testudata(s, -1, c_rawEntityType));
+            Cloud::Bench::DoNotOptimize(box ? *box : nullptr);
+        }
+    }, c_opsPerIteration);
+    lua_settop(s, 0);
+
+    state.PushLightUserDataChecked(&entity);
+    Cloud::Bench::Measure("stack", "to boxed/ToUserDataChecked", c_iterations, [&state]()
+    {
+        for (CLsize_t i = 0; i < c_opsPerIteration; ++i)
+        {
+            Cloud::Bench::DoNotOptimize(state.ToUserDataChecked<Entity>(-1));
+        }
+    }, c_opsPerIteration);
+    lua_settop(s, 0);
+
+    Cloud::Bench::Measure("stack", "push boxed/raw C API", c_iterations, [s, &entity]()
+    {
+        for (CLsize_t i = 0; i < c_opsPerIteration; ++i)
+        {
+            *static_cast<Entity**>(lua_newuserdata(s, sizeof(Entity*))) = &entity;
+            luaL_setmetatable(s, c_rawEntityType);
+            lua_settop(s, 0);
+        }
+    }, c_opsPerIteration);
+
+    Cloud::Bench::Measure("stack", "push boxed/PushLightUserDataChecked", c_iterations, [&state, &entity]()
+    {
+        for (CLsize_t i = 0; i < c_opsPerIteration; ++i)
+        {
+            state.PushLightUserDataChecked(&entity);
+            state.SetTop(0);
+        }
+    }, c_opsPerIteration);
+}
+
+LUACPP_BENCHMARK(TableFields)
+{
+    Cloud::LuaStateEx state;
+    auto* s = Cloud::Bench::GetLuaState(state);
+
+    // a record of a few named fields, the shape most bindings hand to scripts
+    Cloud::Bench::Measure("table", "push record/raw C API", 200000, [s]()
+    {
+        lua_createtable(s, 0, 4);
+        lua_pushinteger(s, 7);
+        lua_setfield(s, -2, "id");
+        lua_pushnumber(s, 1.5);
+        lua_setfield(s, -2, "x");
+        lua_pushnumber(s, -2.5);
+        lua_setfield(s, -2, "y");
+        lua_pushstring(s, "archer");
+        lua_setfield(s, -2, "name");
+        lua_settop(s, 0);
+    });
+
+    Cloud::Bench::Measure("table", "push record/LuaState", 200000, [&state]()
+    {
+        state.CreateTable(0, 4);
+        state.Push(7);
+        state.SetField(-2, "id");
+        state.Push(1.5);
+        state.SetField(-2, "x");
+        state.Push(-2.5);
+        state.SetField(-2, "y");
+        state.Push("archer");
+        state.SetField(-2, "name");
+        state.SetTop(0);
+    });
+
+    state.DoChunk("record = { id = 7, x = 1.5, y = -2.5, name = 'archer' }");
+
+    Cloud::Bench::Measure("table", "read record/raw C API", 200000, [s]()
+    {
+        lua_getglobal(s, "record");
+        lua_getfield(s, -1, "id");
+        lua_getfield(s, -2, "x");
+        lua_getfield(s, -3, "y");
+        lua_getfield(s, -4, "name");
+        Cloud::Bench::DoNotOptimize(lua_tointeger(s, -4) + lua_tonumber(s, -3) + lua_tonumber(s, -2));
+        Cloud::Bench::DoNotOptimize(lua_tostring(s, -1));
+        lua_settop(s, 0);
+    });
+
+    Cloud::Bench::Measure("table", "read record/LuaState", 200000, [&state]()
+    {
+        state.GetGlobal("record");
+        state.GetField(-1, "id");
+        state.GetField(-2, "x");
+        state.GetField(-3, "y");
+        state.GetField(-4, "name");
+        Cloud::Bench::DoNotOptimize(state.To<CLint>(-4) + state.To<double>(-3) + state.To<double>(-2));
+        Cloud::Bench::DoNotOptimize(state.To<const CLchar*>(-1));
+        state.SetTop(0);
+    });
+
+    const std::vector<Cloud::Lua::String> names(100, "identifier");
+
+    Cloud::Bench::Measure("table", "push vector<String>/raw C API", 20000, [s, &names]()
+    {
+        lua_createtable(s, static_cast<CLint>(names.size()), 0);
+        for (CLsize_t i = 0; i < names.size(); ++i)
+        {
+            lua_pushlstring(s, names[i].data(), names[i].size());
+            lua_rawseti(s, -2, static_cast<lua_Integer>(i + 1));
+        }
+        lua_settop(s, 0);
+    });
+
+    Cloud::Bench::Measure("table", "push vector<String>/LuaState::Push", 20000, [&state, &names]()
+    {
+        state.Push(names);
+        state.SetTop(0);
+    });
+}
+
+LUACPP_BENCHMARK(StateConstruction)
+{
+    Cloud::Bench::Measure("state", "construct/raw C API", 2000, []()
+    {
+        auto* s = luaL_newstate();
+        luaL_openlibs(s);
+        Cloud::Bench::DoNotOptimize(s);
+        lua_close(s);
+    });
+
+    Cloud::Bench::Measure("state", "construct/LuaState", 2000, []()
+    {
+        Cloud::LuaState state;
+        Cloud::Bench::DoNotOptimize(state);
+    });
+
+    Cloud::Bench::Measure("state", "construct/LuaStateEx", 2000, []()
+    {
+        Cloud::LuaStateEx state;
+        Cloud::Bench::DoNotOptimize(state);
+    });
+}
@@ -0,0 +1,50 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_pool.h"
+
+namespace
+{
+    const CLchar* const c_setupScript =
+        "config = {}\n"
+        "for i = 1, 500 do config['key' .. i] = { id = i, weight = i * 0.25 } end\n"
+        "function handle(x) local entry = config['key' .. x] return entry and entry.id or 0 end\n";
+
+    void Setup(Cloud::LuaStateEx& state)
+    {
+        state.DoChunk(c_setupScript);
+    }
+}
+
+LUACPP_BENCHMARK(StatePool)
+{
+    Cloud::Bench::Measure("statepool", "acquire/construct+setup", 1000, []()
+    {
+        Cloud::LuaStateEx state;
+        Setup(state);
+        Cloud::Bench::DoNotOptimize(state);
+    });
+
+    Cloud::LuaStatePool pool(4, &Setup);
+    Cloud::Bench::Measure("statepool", "acquire/checkout+reset", 1000, [&pool]()
+    {
+        auto state = pool.Checkout();
+        state->DoChunk("request = handle(42)");
+        Cloud::Bench::DoNotOptimize(state);
+    });
+}
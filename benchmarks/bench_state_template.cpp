@@ -0,0 +1,73 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_template.h"
+
+namespace
+{
+    // a few dozen modules worth of functions and data tables
+    Cloud::Lua::String MakeScripts()
+    {
+        Cloud::Lua::String source;
+        for (CLint module = 0; module < 40; ++module)
+        {
+            const auto name = "module" + std::to_string(module);
+            source += "package.preload['" + name + "'] = function()\n"
+                      "    local M = { data = {} }\n"
+                      "    for i = 1, 50 do M.data[i] = { id = i, label = 'entry' .. i } end\n";
+            for (CLint function = 0; function < 10; ++function)
+            {
+                source += "    function M.f" + std::to_string(function) + "(x) return M.data[(x % 50) + 1].id + " + std::to_string(function) + " end\n";
+            }
+            source += "    return M\nend\n"
+                      + name + " = require('" + name + "')\n";
+        }
+        return source;
+    }
+}
+
+LUACPP_BENCHMARK(StateTemplate)
+{
+    const auto scripts = MakeScripts();
+
+    Cloud::Bench::Measure("statetemplate", "newstate/construct+run", 200, [&scripts]()
+    {
+        Cloud::LuaStateEx state;
+        state.DoChunk(scripts.c_str(), "@modules.lua");
+        Cloud::Bench::DoNotOptimize(state);
+    });
+
+    for (CLbool strip : { false, true })
+    {
+        Cloud::LuaStateTemplate stateTemplate;
+        stateTemplate.GetState().DoChunk(scripts.c_str(), "@modules.lua");
+        stateTemplate.Capture(strip);
+
+        Cloud::Bench::Measure("statetemplate", strip ? "newstate/fork(stripped)" : "newstate/fork", 200, [&stateTemplate]()
+        {
+            auto state = stateTemplate.Fork();
+            Cloud::Bench::DoNotOptimize(state);
+        });
+    }
+
+    Cloud::Bench::Measure("statetemplate", "newstate/construct", 200, []()
+    {
+        Cloud::LuaStateEx state;
+        Cloud::Bench::DoNotOptimize(state);
+    });
+}
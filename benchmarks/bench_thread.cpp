@@ -0,0 +1,116 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "benchmark.h"
+#include "../source/state_ex.h"
+
+#include <vector>
+
+namespace
+{
+    const CLchar* const c_behaviourScript =
+        "function behaviour(x)\n"
+        "    while true do x = coroutine.yield(x + 1) end\n"
+        "end\n"
+        "function hostBehaviour(x)\n"
+        "    while true do x = wait(x) end\n"
+        "end\n";
+
+    Cloud::LuaYield<CLint> Wait(CLint x)
+    {
+        return Cloud::LuaYield<CLint>(x + 1);
+    }
+
+#ifdef LUACPP_HAS_COROUTINES
+    std::vector<std::coroutine_handle<>> s_pending;
+
+    struct Completion
+    {
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { s_pending.push_back(handle); }
+        void await_resume() const {}
+    };
+
+    Cloud::LuaTask<CLint> Request(CLint x)
+    {
+        co_await Completion();
+        co_return x + 1;
+    }
+
+    Cloud::LuaTask<CLint> Drive(Cloud::LuaThread& thread)
+    {
+        co_return co_await thread.ResumeAsync<CLint>(1);
+    }
+#endif
+}
+
+LUACPP_BENCHMARK(Thread)
+{
+    Cloud::LuaStateEx state;
+    state.RegisterFunction<&Wait>("wait");
+    state.DoChunk(c_behaviourScript);
+
+    auto* s = Cloud::Bench::GetLuaState(state);
+    auto* raw = lua_newthread(s);
+    lua_getglobal(raw, "behaviour");
+    Cloud::Bench::Measure("thread", "resume/raw C API", 200000, [raw]()
+    {
+        lua_pushinteger(raw, 1);
+        lua_resume(raw, nullptr, 1);
+        Cloud::Bench::DoNotOptimize(lua_tointeger(raw, -1));
+        lua_settop(raw, 0);
+    });
+    lua_pop(s, 1);
+
+    auto behaviour = state.NewThread("behaviour");
+    Cloud::Bench::Measure("thread", "resume/coroutine.yield", 200000, [&behaviour]()
+    {
+        Cloud::Bench::DoNotOptimize(behaviour.Resume<CLint>(1));
+    });
+
+    auto hostBehaviour = state.NewThread("hostBehaviour");
+    Cloud::Bench::Measure("thread", "resume/LuaYield", 200000, [&hostBehaviour]()
+    {
+        Cloud::Bench::DoNotOptimize(hostBehaviour.Resume<CLint>(1));
+    });
+
+#ifdef LUACPP_HAS_COROUTINES
+    // a Lua call awaited from C++ that waits on one host completion
+    state.RegisterFunction<&Request>("request");
+    state.DoChunk("function asyncBehaviour(x) return request(x) end");
+    Cloud::Bench::Measure("thread", "resumeasync/LuaTask round trip", 20000, [&state]()
+    {
+        auto thread = state.NewThread("asyncBehaviour");
+        auto task = Drive(thread);
+        task.Start();
+        while (!s_pending.empty())
+        {
+            auto handle = s_pending.back();
+            s_pending.pop_back();
+            handle.resume();
+        }
+        Cloud::Bench::DoNotOptimize(task.GetResult());
+    });
+#endif
+
+    // creation and first resume of a thread per behaviour, the thread is collected afterwards
+    Cloud::Bench::Measure("thread", "create+resume+release", 20000, [&state]()
+    {
+        auto thread = state.NewThread("behaviour");
+        Cloud::Bench::DoNotOptimize(thread.Resume<CLint>(1));
+    });
+}
@@ -0,0 +1,167 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include "benchmark.h"
+#include "instruction_counter.h"
+#include "../source/state_ex.h"
+
+namespace
+{
+    // scripts in benchmarks/scripts, each returns a checksum
+    struct Workload
+    {
+        const CLchar* fileName;
+        const CLchar* compileName;
+        const CLchar* runName;
+        const CLchar* collectName;
+    };
+
+    const Workload c_workloads[] =
+    {
+        { "binary_trees.lua",   "binary-trees/compile",     "binary-trees/run",     "binary-trees/full gc" },
+        { "nbody.lua",          "nbody/compile",            "nbody/run",            "nbody/full gc" },
+        { "spectral_norm.lua",  "spectral-norm/compile",    "spectral-norm/run",    "spectral-norm/full gc" },
+        { "fannkuch.lua",       "fannkuch/compile",         "fannkuch/run",         "fannkuch/full gc" },
+        { "strings.lua",        "strings/compile",          "strings/run",          "strings/full gc" },
+        { "tables.lua",         "tables/compile",           "tables/run",           "tables/full gc" },
+        { "closures.lua",       "closures/compile",         "closures/run",         "closures/full gc" },
+    };
+
+    const CLsize_t c_repetitions = 3;
+
+    // --scripts, or the working directory
+    Cloud::Lua::String GetScriptDirectory()
+    {
+        auto path = Cloud::Bench::ScriptDirectory();
+        if (!path.empty() && path.back() != '/' && path.back() != '\\')
+        {
+            path += '/';
+        }
+        return path;
+    }
+
+    struct PhaseTimes
+    {
+        double          compile     = 0.0;
+        double          run         = 0.0;
+        double          collect     = 0.0;
+        std::uint64_t   instructions = 0;
+        CLsize_t        peakBytes   = 0;
+    };
+
+    CLbool RunWorkload(const Cloud::Lua::String& fileName, Cloud::Bench::InstructionCounter& counter, PhaseTimes& times)
+    {
+        using Cloud::Bench::Clock;
+        using Cloud::Bench::ElapsedNanoseconds;
+
+        Cloud::LuaStateEx state;
+        auto* luaState = Cloud::Bench::GetLuaState(state);
+
+        auto start = Clock::now();
+        if (state.LoadFile(fileName.c_str()) != Cloud::Lua::ErrorCode::Ok)
+        {
+            printf("VmWorkloads: %s\n", lua_tostring(luaState, -1));
+            return false;
+        }
+        times.compile = ElapsedNanoseconds(start, Clock::now());
+
+        counter.Start();
+        start = Clock::now();
+        const auto result = state.PCall(0, 1);
+        times.run = ElapsedNanoseconds(start, Clock::now());
+        times.instructions = counter.Stop();
+
+        if (result != Cloud::Lua::ErrorCode::Ok)
+        {
+            printf("VmWorkloads: %s\n", lua_tostring(luaState, -1));
+            return false;
+        }
+        Cloud::Bench::DoNotOptimize(lua_tonumber(luaState, -1));
+        lua_pop(luaState, 1);
+
+        start = Clock::now();
+        lua_gc(luaState, LUA_GCCOLLECT, 0);
+        times.collect = ElapsedNanoseconds(start, Clock::now());
+
+        times.peakBytes = state.GetMemoryStats().peakBytes;
+        return true;
+    }
+}
+
+// Whole scripts in a fresh state each, timed per phase: compile (LoadFile), run (the chunk, with
+// user space instructions where perf counters are available) and a full collection afterwards.
+// Best of a few repetitions, the workloads take a few hundred milliseconds each.
+LUACPP_BENCHMARK(VmWorkloads)
+{
+    const auto directory = GetScriptDirectory();
+    Cloud::Bench::InstructionCounter counter;
+
+    for (const auto& workload : c_workloads)
+    {
+        PhaseTimes best;
+        CLbool first = true;
+        CLbool failed = false;
+
+        for (CLsize_t i = 0; i < c_repetitions; ++i)
+        {
+            PhaseTimes times;
+            failed = !RunWorkload(directory + workload.fileName, counter, times);
+            if (failed)
+            {
+                break;
+            }
+
+            if (first)
+            {
+                best = times;
+                first = false;
+                continue;
+            }
+
+            best.compile = std::min(best.compile, times.compile);
+            best.collect = std::min(best.collect, times.collect);
+            if (times.run < best.run)
+            {
+                best.run = times.run;
+                best.instructions = times.instructions;
+            }
+            best.peakBytes = std::max(best.peakBytes, times.peakBytes);
+        }
+
+        if (failed)
+        {
+            continue;
+        }
+
+        Cloud::Bench::Result compile = { "vm", workload.compileName, c_repetitions, best.compile };
+        Cloud::Bench::Report(compile);
+
+        Cloud::Bench::Result run = { "vm", workload.runName, c_repetitions, best.run };
+        run.instructions = best.instructions;
+        run.peakBytes = best.peakBytes;
+        Cloud::Bench::Report(run);
+
+        Cloud::Bench::Result collect = { "vm", workload.collectName, c_repetitions, best.collect };
+        Cloud::Bench::Report(collect);
+    }
+
+    if (!counter.IsAvailable())
+    {
+        printf("VmWorkloads: instruction counts unavailable (perf_event_open)\n");
+    }
+}
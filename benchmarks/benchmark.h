@@ -0,0 +1,149 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_BENCHMARK_HEADER
+#define CLOUD_LUA_CPP_BENCHMARK_HEADER
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <cstdio>
+#include "../source/state.h"
+
+namespace Cloud
+{
+    namespace Bench
+    {
+        using Clock = std::chrono::steady_clock;
+        using BenchmarkFunc = void(*)();
+
+        struct Result
+        {
+            const CLchar*   group;  // literals, results are kept until the end of the run
+            const CLchar*   name;
+            CLsize_t        iterations;
+            double          nanosecondsPerOp;
+            std::uint64_t   instructions    = 0; // per op, 0 when not counted
+            CLsize_t        peakBytes       = 0; // Lua heap, 0 when not tracked
+        };
+
+        struct Entry
+        {
+            const CLchar*   name;
+            BenchmarkFunc   func;
+        };
+
+        inline std::vector<Entry>& Registry()
+        {
+            static std::vector<Entry> registry;
+            return registry;
+        }
+
+        // everything reported so far, for the JSON output
+        inline std::vector<Result>& Results()
+        {
+            static std::vector<Result> results;
+            return results;
+        }
+
+        // --scripts dir, where the script workloads are loaded from, empty for the working directory
+        inline Lua::String& ScriptDirectory()
+        {
+            static Lua::String directory;
+            return directory;
+        }
+
+        struct Registrar
+        {
+            Registrar(const CLchar* name, BenchmarkFunc func)
+            {
+                Registry().push_back({ name, func });
+            }
+        };
+
+        extern const void* volatile g_sink;
+
+        // raw lua_State of a LuaState, for the C API baselines
+        struct LuaStateAccess : public LuaState
+        {
+            static lua_State* Get(const LuaState& state) { return static_cast<const LuaStateAccess&>(state).GetState(); }
+        };
+
+        inline lua_State* GetLuaState(const LuaState& state)
+        {
+            return LuaStateAccess::Get(state);
+        }
+
+        // keeps the optimizer from throwing away benchmarked results
+        template <typename _T>
+        inline void DoNotOptimize(const _T& value)
+        {
+            g_sink = &value;
+        }
+
+        inline double ElapsedNanoseconds(Clock::time_point start, Clock::time_point end)
+        {
+            return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+
+        inline void Report(const Result& result)
+        {
+            printf("%-16s %-40s %12zu iters %14.2f ns/op", result.group, result.name, result.iterations, result.nanosecondsPerOp);
+            if (result.instructions > 0)
+            {
+                printf(" %14llu instr", static_cast<unsigned long long>(result.instructions));
+            }
+            if (result.peakBytes > 0)
+            {
+                printf(" %10zu KB peak", result.peakBytes / 1024);
+            }
+            printf("\n");
+            Results().push_back(result);
+        }
+
+        // runs func iterations times after a short warm up and reports the average time per operation,
+        // operationsPerIteration is for funcs that loop internally (e.g. a Lua loop calling into C++)
+        template <typename _Func>
+        Result Measure(const CLchar* group, const CLchar* name, CLsize_t iterations, _Func&& func, CLsize_t operationsPerIteration = 1)
+        {
+            const auto warmup = iterations / 10 + 1;
+            for (CLsize_t i = 0; i < warmup; ++i)
+            {
+                func();
+            }
+
+            const auto start = Clock::now();
+            for (CLsize_t i = 0; i < iterations; ++i)
+            {
+                func();
+            }
+            const auto end = Clock::now();
+
+            const auto operations = static_cast<double>(iterations) * static_cast<double>(operationsPerIteration);
+            Result result = { group, name, iterations, ElapsedNanoseconds(start, end) / operations };
+            Report(result);
+            return result;
+        }
+    }
+}
+
+#define LUACPP_BENCHMARK(benchmarkName) \
+    static void benchmarkName(); \
+    static Cloud::Bench::Registrar benchmarkName##Registrar(#benchmarkName, &benchmarkName); \
+    static void benchmarkName()
+
+#endif // CLOUD_LUA_CPP_BENCHMARK_HEADER
@@ -0,0 +1,105 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_INSTRUCTION_COUNTER_HEADER
+#define CLOUD_LUA_CPP_INSTRUCTION_COUNTER_HEADER
+
+#include <cstdint>
+#include "../source/luacpp.h"
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Cloud
+{
+    namespace Bench
+    {
+        // User space instructions retired by the calling thread, through perf_event_open on Linux.
+        // Unavailable elsewhere, in most VMs and containers and with kernel.perf_event_paranoid > 2,
+        // then Stop returns 0.
+        class InstructionCounter
+        {
+        public:
+            InstructionCounter()
+                : m_file(-1)
+            {
+#if defined(__linux__)
+                perf_event_attr attributes;
+                std::memset(&attributes, 0, sizeof(attributes));
+                attributes.size = sizeof(attributes);
+                attributes.type = PERF_TYPE_HARDWARE;
+                attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+                attributes.disabled = 1;
+                attributes.exclude_kernel = 1;
+                attributes.exclude_hv = 1;
+                m_file = static_cast<CLint>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+#endif
+            }
+
+            InstructionCounter(const InstructionCounter&) = delete;
+
+            ~InstructionCounter()
+            {
+#if defined(__linux__)
+                if (m_file >= 0)
+                {
+                    close(m_file);
+                }
+#endif
+            }
+
+            CLbool IsAvailable() const { return m_file >= 0; }
+
+            void Start()
+            {
+#if defined(__linux__)
+                if (m_file >= 0)
+                {
+                    ioctl(m_file, PERF_EVENT_IOC_RESET, 0);
+                    ioctl(m_file, PERF_EVENT_IOC_ENABLE, 0);
+                }
+#endif
+            }
+
+            std::uint64_t Stop()
+            {
+                std::uint64_t count = 0;
+#if defined(__linux__)
+                if (m_file >= 0)
+                {
+                    ioctl(m_file, PERF_EVENT_IOC_DISABLE, 0);
+                    if (read(m_file, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count)))
+                    {
+                        count = 0;
+                    }
+                }
+#endif
+                return count;
+            }
+
+        private:
+            CLint m_file;
+        };
+    }
+}
+
+#endif // CLOUD_LUA_CPP_INSTRUCTION_COUNTER_HEADER
@@ -0,0 +1,28 @@
+-- binary-trees: allocation of many short lived tables
+local function bottomUp(depth)
+    if depth == 0 then
+        return {}
+    end
+    depth = depth - 1
+    return { bottomUp(depth), bottomUp(depth) }
+end
+
+local function check(tree)
+    if tree[1] then
+        return 1 + check(tree[1]) + check(tree[2])
+    end
+    return 1
+end
+
+local maxDepth = 12
+local longLived = bottomUp(maxDepth)
+local total = 0
+
+for depth = 4, maxDepth, 2 do
+    local iterations = 1 << (maxDepth - depth + 4)
+    for _ = 1, iterations do
+        total = total + check(bottomUp(depth))
+    end
+end
+
+return total + check(longLived)
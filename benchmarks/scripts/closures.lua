@@ -0,0 +1,38 @@
+-- closure churn: creating and calling many short lived closures and upvalues
+local function makeCounter(start)
+    local count = start
+    return function(step)
+        count = count + step
+        return count
+    end
+end
+
+local function compose(f, g)
+    return function(x) return f(g(x)) end
+end
+
+local total = 0
+for i = 1, 200000 do
+    local counter = makeCounter(i)
+    counter(1)
+    total = total + counter(2)
+end
+
+local double = function(x) return x * 2 end
+local increment = function(x) return x + 1 end
+for i = 1, 200000 do
+    local f = compose(double, compose(increment, double))
+    total = total + f(i)
+end
+
+local handlers = {}
+for i = 1, 1000 do
+    handlers[i] = function(event) return event + i end
+end
+for round = 1, 200 do
+    for i = 1, #handlers do
+        total = total + handlers[i](round)
+    end
+end
+
+return total
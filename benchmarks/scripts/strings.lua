@@ -0,0 +1,24 @@
+-- string-heavy: format, gsub, find and concatenation
+local words = { "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel" }
+local total = 0
+
+for i = 1, 20000 do
+    local line = string.format("%d:%s:%0.3f:%x", i, words[i % #words + 1], i / 7, i * 31)
+    local replaced = line:gsub("%a+", string.upper):gsub("(%d+)", "<%1>")
+    local first, last = replaced:find("<%d+>", 1)
+    total = total + #replaced + (first or 0) + (last or 0)
+
+    local parts = {}
+    for field in line:gmatch("[^:]+") do
+        parts[#parts + 1] = field:reverse()
+    end
+    total = total + #table.concat(parts, ",")
+end
+
+local buffer = {}
+for i = 1, 20000 do
+    buffer[#buffer + 1] = words[i % #words + 1] .. i
+end
+local joined = table.concat(buffer, " ")
+
+return total + #joined + select(2, joined:gsub("echo", "ECHO"))
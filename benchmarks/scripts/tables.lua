@@ -0,0 +1,36 @@
+-- table-heavy: insert, remove, sort and hash churn
+local random = 42
+local function nextRandom()
+    random = (random * 1103515245 + 12345) % 2147483648
+    return random
+end
+
+local list = {}
+for i = 1, 100000 do
+    table.insert(list, nextRandom() % 1000000)
+end
+table.sort(list)
+
+local records = {}
+for i = 1, 20000 do
+    records[i] = { key = nextRandom() % 1000, id = i }
+end
+table.sort(records, function(a, b)
+    if a.key ~= b.key then return a.key < b.key end
+    return a.id < b.id
+end)
+
+local queue = {}
+for i = 1, 2000 do table.insert(queue, 1, i) end
+local drained = 0
+while #queue > 0 do drained = drained + table.remove(queue) end
+
+local counts = {}
+for i = 1, 200000 do
+    local key = "k" .. (nextRandom() % 5000)
+    counts[key] = (counts[key] or 0) + 1
+end
+local distinct = 0
+for _ in pairs(counts) do distinct = distinct + 1 end
+
+return list[1] + list[#list] + records[1].id + drained + distinct
@@ -1104,6 +1104,17 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+LUA_API void lua_setgchook (lua_State *L, lua_GCHook f, void *ud) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  g->gchook = f;
+  g->gchookud = ud;
+  g->gchookevent = -1;
+  lua_unlock(L);
+}
+
+
 
 /*
 ** miscellaneous functions
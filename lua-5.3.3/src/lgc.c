@@ -1039,7 +1039,7 @@ static lu_mem sweepstep (lua_State *L, global_State *g,
 }
 
 
-static lu_mem singlestep (lua_State *L) {
+static lu_mem dosinglestep (lua_State *L) {
   global_State *g = G(L);
   switch (g->gcstate) {
     case GCSpause: {
@@ -1094,6 +1094,67 @@ static lu_mem singlestep (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** GC telemetry (LuaCpp)
+** =======================================================
+*/
+
+static void callgchook (global_State *g, int event) {
+  g->gchook(g->gchookud, event, cast(size_t, gettotalbytes(g)));
+}
+
+
+/*
+** report the start of a step or full collection; a previous one may
+** have been left without an end by an error in a finalizer, so the
+** last reported phase is forgotten
+*/
+static void gchookbegin (global_State *g, int event) {
+  if (g->gchook) {
+    g->gchookevent = -1;
+    callgchook(g, event);
+  }
+}
+
+
+static void gchookend (global_State *g) {
+  if (g->gchook) {
+    g->gchookevent = -1;
+    callgchook(g, LUA_GCEVEND);
+  }
+}
+
+
+/* report 'event' unless it is the phase already reported */
+static void gchookphase (global_State *g, int event) {
+  if (g->gchook && g->gchookevent != event) {
+    g->gchookevent = event;
+    callgchook(g, event);
+  }
+}
+
+
+static int gcphaseevent (int gcstate) {
+  switch (gcstate) {
+    case GCSpause: case GCSpropagate: return LUA_GCEVPROPAGATE;
+    case GCSatomic: return LUA_GCEVATOMIC;
+    case GCScallfin: return LUA_GCEVFINALIZE;
+    default: return LUA_GCEVSWEEP;
+  }
+}
+
+/* }====================================================== */
+
+
+static lu_mem singlestep (lua_State *L) {
+  global_State *g = G(L);
+  if (g->gchook)
+    gchookphase(g, gcphaseevent(g->gcstate));
+  return dosinglestep(L);
+}
+
+
 /*
 ** advances the garbage collector until it reaches a state allowed
 ** by 'statemask'
@@ -1130,6 +1191,7 @@ void luaC_step (lua_State *L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  gchookbegin(g, LUA_GCEVSTEP);
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1139,8 +1201,11 @@ void luaC_step (lua_State *L) {
   else {
     debt = (debt / g->gcstepmul) * STEPMULADJ;  /* convert 'work units' to Kb */
     luaE_setdebt(g, debt);
+    if (g->tobefnz)
+      gchookphase(g, LUA_GCEVFINALIZE);
     runafewfinalizers(L);
   }
+  gchookend(g);
 }
 
 
@@ -1157,6 +1222,7 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
   lua_assert(g->gckind == KGC_NORMAL);
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+  gchookbegin(g, LUA_GCEVFULL);
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
@@ -1169,6 +1235,7 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
   g->gckind = KGC_NORMAL;
   setpause(g);
+  gchookend(g);
 }
 
 /* }====================================================== */
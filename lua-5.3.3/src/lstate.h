@@ -143,6 +143,9 @@ typedef struct global_State {
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  lua_GCHook gchook;  /* GC telemetry, see 'lua_setgchook' */
+  void *gchookud;  /* auxiliary data to 'gchook' */
+  int gchookevent;  /* last phase reported to 'gchook' */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
@@ -312,6 +312,25 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
 
+/*
+** GC telemetry (LuaCpp): the hook is called when an incremental step or
+** a full collection starts and ends, and when the collector enters a
+** phase within one. 'totalbytes' is the heap size at that point. The hook
+** runs inside the collector and must not call back into Lua.
+*/
+#define LUA_GCEVSTEP		0
+#define LUA_GCEVFULL		1
+#define LUA_GCEVEND		2
+#define LUA_GCEVPROPAGATE	3
+#define LUA_GCEVATOMIC		4
+#define LUA_GCEVSWEEP		5
+#define LUA_GCEVFINALIZE	6
+
+typedef void (*lua_GCHook) (void *ud, int event, size_t totalbytes);
+
+LUA_API void (lua_setgchook) (lua_State *L, lua_GCHook f, void *ud);
+
+
 /*
 ** miscellaneous functions
 */
@@ -0,0 +1,294 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "allocator.h"
+
+#include <cstdlib>
+#include <cstring>
+
+Cloud::LuaDefaultAllocator::LuaDefaultAllocator()
+    : LuaAllocator(&LuaDefaultAllocator::Allocate)
+{
+}
+
+void* Cloud::LuaDefaultAllocator::Allocate(void* userData, void* pointer, CLsize_t oldSize, CLsize_t newSize)
+{
+    LUACPP_UNUSED(userData);
+    LUACPP_UNUSED(oldSize);
+
+    if (newSize == 0)
+    {
+        std::free(pointer);
+        return nullptr;
+    }
+
+    return std::realloc(pointer, newSize);
+}
+
+Cloud::LuaPoolAllocator::LuaPoolAllocator(CLsize_t slabLimit)
+    : LuaAllocator(&LuaPoolAllocator::Allocate)
+    , m_slabs(nullptr)
+    , m_slabCursor(nullptr)
+    , m_slabEnd(nullptr)
+    , m_slabBytes(0)
+    , m_slabLimit(slabLimit)
+    , m_adoptedBlocks(0)
+{
+    for (auto& freeList : m_freeLists)
+    {
+        freeList = nullptr;
+    }
+}
+
+Cloud::LuaPoolAllocator::~LuaPoolAllocator()
+{
+    // blocks kept by a failed shrink are somewhere in the free lists, outside of any slab
+    if (m_adoptedBlocks > 0)
+    {
+        for (auto* block : m_freeLists)
+        {
+            while (block)
+            {
+                auto* next = block->next;
+                if (!IsInSlab(block))
+                {
+                    std::free(block);
+                }
+                block = next;
+            }
+        }
+    }
+
+    while (m_slabs)
+    {
+        auto* next = m_slabs->next;
+        std::free(m_slabs);
+        m_slabs = next;
+    }
+}
+
+void* Cloud::LuaPoolAllocator::Allocate(void* userData, void* pointer, CLsize_t oldSize, CLsize_t newSize)
+{
+    auto* allocator = static_cast<LuaPoolAllocator*>(userData);
+
+    // when pointer is null, oldSize encodes the type of the object being allocated
+    if (!pointer)
+    {
+        oldSize = 0;
+    }
+
+    const auto oldPooled = oldSize != 0 && oldSize <= MaxBlockSize;
+    const auto newPooled = newSize != 0 && newSize <= MaxBlockSize;
+
+    if (newSize == 0)
+    {
+        if (oldPooled)
+        {
+            allocator->FreeBlockToClass(pointer, SizeClass(oldSize));
+        }
+        else
+        {
+            std::free(pointer);
+        }
+        return nullptr;
+    }
+
+    if (!oldPooled && !newPooled)
+    {
+        return std::realloc(pointer, newSize);
+    }
+
+    if (oldPooled && newPooled && SizeClass(oldSize) == SizeClass(newSize))
+    {
+        return pointer;
+    }
+
+    void* result = newPooled ? allocator->AllocateBlock(SizeClass(newSize)) : std::malloc(newSize);
+    if (!result)
+    {
+        // Lua assumes shrinking never fails, the malloc block is kept and joins the pool of its
+        // new size class when it's freed
+        if (pointer && newSize < oldSize)
+        {
+            ++allocator->m_adoptedBlocks;
+            return pointer;
+        }
+
+        // Lua keeps the old block on failure
+        return nullptr;
+    }
+
+    if (pointer)
+    {
+        std::memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+
+        if (oldPooled)
+        {
+            allocator->FreeBlockToClass(pointer, SizeClass(oldSize));
+        }
+        else
+        {
+            std::free(pointer);
+        }
+    }
+
+    return result;
+}
+
+void* Cloud::LuaPoolAllocator::AllocateBlock(CLsize_t sizeClass)
+{
+    if (!m_freeLists[sizeClass])
+    {
+        Refill(sizeClass);
+
+        if (!m_freeLists[sizeClass])
+        {
+            return nullptr;
+        }
+    }
+
+    auto* block = m_freeLists[sizeClass];
+    m_freeLists[sizeClass] = block->next;
+    return block;
+}
+
+void Cloud::LuaPoolAllocator::FreeBlockToClass(void* pointer, CLsize_t sizeClass)
+{
+    auto* block = static_cast<FreeBlock*>(pointer);
+    block->next = m_freeLists[sizeClass];
+    m_freeLists[sizeClass] = block;
+}
+
+void Cloud::LuaPoolAllocator::Refill(CLsize_t sizeClass)
+{
+    const auto blockSize = (sizeClass + 1) * Granularity;
+
+    if (m_slabCursor + blockSize > m_slabEnd)
+    {
+        NewSlab();
+
+        if (!m_slabCursor)
+        {
+            return;
+        }
+    }
+
+    FreeBlock* head = m_freeLists[sizeClass];
+    for (CLsize_t i = 0; i < RefillCount && m_slabCursor + blockSize <= m_slabEnd; ++i)
+    {
+        auto* block = reinterpret_cast<FreeBlock*>(m_slabCursor);
+        block->next = head;
+        head = block;
+        m_slabCursor += blockSize;
+    }
+
+    m_freeLists[sizeClass] = head;
+}
+
+CLbool Cloud::LuaPoolAllocator::IsInSlab(const void* pointer) const
+{
+    const auto* bytes = static_cast<const CLchar*>(pointer);
+    for (const auto* slab = m_slabs; slab; slab = slab->next)
+    {
+        const auto* begin = reinterpret_cast<const CLchar*>(slab);
+        if (bytes >= begin && bytes < begin + SlabSize)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Cloud::LuaPoolAllocator::NewSlab()
+{
+    const auto limitReached = m_slabLimit != 0 && m_slabBytes + SlabSize > m_slabLimit;
+    auto* slab = limitReached ? nullptr : static_cast<Slab*>(std::malloc(SlabSize));
+    if (!slab)
+    {
+        m_slabCursor = nullptr;
+        m_slabEnd = nullptr;
+        return;
+    }
+
+    slab->next = m_slabs;
+    m_slabs = slab;
+    m_slabBytes += SlabSize;
+
+    // keep blocks aligned to the granularity
+    m_slabCursor = reinterpret_cast<CLchar*>(slab) + Granularity;
+    m_slabEnd = reinterpret_cast<CLchar*>(slab) + SlabSize;
+}
+
+Cloud::LuaAccountingAllocator::LuaAccountingAllocator(Lua::UniquePtr<LuaAllocator> inner, CLsize_t limit)
+    : LuaAllocator(&LuaAccountingAllocator::Allocate)
+    , m_inner(std::move(inner))
+    , m_innerFunction(m_inner ? m_inner->GetFunction() : nullptr)
+    , m_innerUserData(m_inner ? m_inner->GetUserData() : nullptr)
+    , m_limit(limit)
+{
+}
+
+void* Cloud::LuaAccountingAllocator::Allocate(void* userData, void* pointer, CLsize_t oldSize, CLsize_t newSize)
+{
+    auto* allocator = static_cast<LuaAccountingAllocator*>(userData);
+    auto& stats = allocator->m_stats;
+
+    const auto trackedOldSize = pointer ? oldSize : 0;
+
+    if (newSize > trackedOldSize && allocator->m_limit != 0)
+    {
+        if (stats.liveBytes - trackedOldSize + newSize > allocator->m_limit)
+        {
+            ++stats.failedAllocations;
+            return nullptr;
+        }
+    }
+
+    void* result;
+    if (allocator->m_innerFunction)
+    {
+        result = allocator->m_innerFunction(allocator->m_innerUserData, pointer, oldSize, newSize);
+    }
+    else if (newSize == 0)
+    {
+        std::free(pointer);
+        result = nullptr;
+    }
+    else
+    {
+        result = std::realloc(pointer, newSize);
+    }
+
+    if (!result && newSize != 0)
+    {
+        ++stats.failedAllocations;
+        return nullptr;
+    }
+
+    if (!pointer && newSize != 0)
+    {
+        ++stats.allocationCount;
+    }
+
+    stats.liveBytes = stats.liveBytes - trackedOldSize + newSize;
+    if (stats.liveBytes > stats.peakBytes)
+    {
+        stats.peakBytes = stats.liveBytes;
+    }
+
+    return result;
+}
@@ -0,0 +1,138 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_ALLOCATOR_HEADER
+#define CLOUD_LUA_CPP_ALLOCATOR_HEADER
+
+#include "luacpp.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        struct MemoryStats
+        {
+            CLsize_t liveBytes          = 0;
+            CLsize_t peakBytes          = 0;
+            CLsize_t allocationCount    = 0;
+            CLsize_t failedAllocations  = 0;
+        };
+    }
+
+    // Base for allocators handed to lua_newstate.
+    // Lua calls the lua_Alloc function directly with the allocator as userdata,
+    // so there's no virtual dispatch on the allocation path.
+    class LuaAllocator
+    {
+    public:
+        LuaAllocator(lua_Alloc function) : m_function(function) {}
+        LuaAllocator(const LuaAllocator&) = delete;
+        virtual ~LuaAllocator() {};
+
+        lua_Alloc       GetFunction() const { return m_function; }
+        void*           GetUserData() { return this; }
+
+    private:
+        lua_Alloc m_function;
+    };
+
+    // Plain realloc/free, same behaviour as l_alloc in lauxlib.c.
+    class LuaDefaultAllocator : public LuaAllocator
+    {
+    public:
+        LuaDefaultAllocator();
+
+        static void* Allocate(void* userData, void* pointer, CLsize_t oldSize, CLsize_t newSize);
+    };
+
+    // Size-class allocator for the small objects Lua churns through (strings, tables, nodes, closures, call infos).
+    // Blocks up to MaxBlockSize come from per-class free lists that are refilled from large slabs,
+    // bigger blocks fall through to realloc/free.
+    // Not thread-safe, one allocator belongs to one lua_State.
+    // Slabs are only released when the allocator is destroyed, slabLimit caps their total size (0 means no cap),
+    // past it pooled sizes fail like malloc does.
+    class LuaPoolAllocator : public LuaAllocator
+    {
+    public:
+        static constexpr CLsize_t Granularity   = 16;
+        static constexpr CLsize_t MaxBlockSize  = 512;
+        static constexpr CLsize_t ClassCount    = MaxBlockSize / Granularity;
+        static constexpr CLsize_t SlabSize      = 64 * 1024;
+        static constexpr CLsize_t RefillCount   = 32;
+
+        explicit LuaPoolAllocator(CLsize_t slabLimit = 0);
+        ~LuaPoolAllocator() override;
+
+        CLsize_t        GetSlabBytes() const { return m_slabBytes; }
+        CLsize_t        GetAdoptedBlocks() const { return m_adoptedBlocks; }
+
+        static void* Allocate(void* userData, void* pointer, CLsize_t oldSize, CLsize_t newSize);
+
+    private:
+        struct FreeBlock
+        {
+            FreeBlock* next;
+        };
+
+        struct Slab
+        {
+            Slab* next;
+        };
+
+        static CLsize_t SizeClass(CLsize_t size) { return (size - 1) / Granularity; }
+
+        void*           AllocateBlock(CLsize_t sizeClass);
+        void            FreeBlockToClass(void* pointer, CLsize_t sizeClass);
+        void            Refill(CLsize_t sizeClass);
+        void            NewSlab();
+        CLbool          IsInSlab(const void* pointer) const;
+
+        FreeBlock*      m_freeLists[ClassCount];
+        Slab*           m_slabs;
+        CLchar*         m_slabCursor;
+        CLchar*         m_slabEnd;
+        CLsize_t        m_slabBytes;
+        CLsize_t        m_slabLimit;
+        CLsize_t        m_adoptedBlocks;    // malloc blocks kept by a shrink the pool couldn't serve
+    };
+
+    // Tracks live/peak bytes of a state and enforces an optional hard limit.
+    // Growing past the limit fails the allocation, Lua then runs an emergency collection
+    // and raises LUA_ERRMEM if that didn't free enough. Shrinking never fails.
+    // Forwards to inner, or to realloc/free when there's no inner allocator.
+    class LuaAccountingAllocator : public LuaAllocator
+    {
+    public:
+        explicit LuaAccountingAllocator(Lua::UniquePtr<LuaAllocator> inner = nullptr, CLsize_t limit = 0);
+
+        const Lua::MemoryStats& GetStats() const { return m_stats; }
+
+        CLsize_t        GetLimit() const { return m_limit; }
+        void            SetLimit(CLsize_t limit) { m_limit = limit; } // 0 means no limit
+
+        static void* Allocate(void* userData, void* pointer, CLsize_t oldSize, CLsize_t newSize);
+
+    private:
+        Lua::UniquePtr<LuaAllocator> m_inner;
+        lua_Alloc           m_innerFunction;
+        void*               m_innerUserData;
+        CLsize_t            m_limit;
+        Lua::MemoryStats    m_stats;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_ALLOCATOR_HEADER
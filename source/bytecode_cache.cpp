@@ -0,0 +1,200 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "bytecode_cache.h"
+#include "mapped_file.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    namespace fs = std::filesystem;
+    using Clock = std::chrono::steady_clock;
+
+    const CLchar c_entryMagic[8] = { 'L', 'C', 'P', 'P', 'B', 'C', '0', '1' };
+
+    // native layout, cache files aren't meant to move between machines
+    struct EntryHeader
+    {
+        CLchar          magic[8];
+        std::uint64_t   sourceTime;
+        std::uint64_t   sourceSize;
+        std::uint64_t   sourceHash;
+        std::uint64_t   pathLength;
+    };
+
+    std::atomic<CLsize_t> s_temporaryCounter(0);
+
+    CLbool ReadFile(const fs::path& path, Cloud::Lua::String& contents)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            return false;
+        }
+
+        const auto size = static_cast<CLsize_t>(file.tellg());
+        contents.resize(size);
+        file.seekg(0);
+        return size == 0 || file.read(&contents[0], static_cast<std::streamsize>(size)).good();
+    }
+
+    int WriteBytecode(lua_State*, const void* data, size_t size, void* userData)
+    {
+        static_cast<Cloud::Lua::String*>(userData)->append(static_cast<const CLchar*>(data), size);
+        return 0;
+    }
+
+    CLbool WriteEntry(const fs::path& entryPath, const Cloud::Lua::String& contents)
+    {
+        // write next to the entry and rename, readers never see a partial file
+        auto temporaryPath = entryPath;
+        temporaryPath += "." + std::to_string(Clock::now().time_since_epoch().count()) + "." + std::to_string(s_temporaryCounter++) + ".tmp";
+
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file || !file.write(contents.data(), static_cast<std::streamsize>(contents.size())))
+            {
+                std::error_code ignored;
+                fs::remove(temporaryPath, ignored);
+                return false;
+            }
+        }
+
+        std::error_code error;
+        fs::rename(temporaryPath, entryPath, error);
+        if (error)
+        {
+            fs::remove(temporaryPath, error);
+            return false;
+        }
+
+        return true;
+    }
+}
+
+Cloud::LuaBytecodeCache::LuaBytecodeCache(const CLchar* directory)
+    : m_directory(directory)
+    , m_hits(0)
+    , m_misses(0)
+    , m_stale(0)
+    , m_writeFailures(0)
+    , m_compileNanoseconds(0)
+{
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+}
+
+Cloud::Lua::ErrorCode Cloud::LuaBytecodeCache::Load(lua_State* state, const CLchar* fileName)
+{
+    // hashed straight from the mapping, pipes and other special files are read into a buffer
+    LuaMappedFile mappedSource(fileName);
+    Lua::String bufferedSource;
+    if (!mappedSource.IsOpen() && !ReadFile(fileName, bufferedSource))
+    {
+        lua_pushfstring(state, "cannot open %s", fileName);
+        return Lua::ErrorCode::ErrFile;
+    }
+
+    const auto* source = mappedSource.IsOpen() ? mappedSource.GetData() : bufferedSource.data();
+    const auto sourceSize = mappedSource.IsOpen() ? mappedSource.GetSize() : bufferedSource.size();
+
+    const Lua::String chunkName = Lua::String("@") + fileName;
+    const auto bodyOffset = Lua::SkipScriptPrefix(source, sourceSize);
+    const auto* body = source + bodyOffset;
+    const auto bodySize = sourceSize - bodyOffset;
+
+    // already compiled, nothing to cache
+    if (bodySize > 0 && body[0] == LUA_SIGNATURE[0])
+    {
+        return static_cast<Lua::ErrorCode>(luaL_loadbufferx(state, body, bodySize, chunkName.c_str(), "b"));
+    }
+
+    std::error_code error;
+    const auto path = fs::absolute(fileName, error).string();
+
+    EntryHeader key = {};
+    std::memcpy(key.magic, c_entryMagic, sizeof(c_entryMagic));
+    key.sourceTime = static_cast<std::uint64_t>(fs::last_write_time(fileName, error).time_since_epoch().count());
+    key.sourceSize = sourceSize;
+    key.sourceHash = Lua::Fnv1a(source, sourceSize);
+    key.pathLength = path.size();
+
+    CLchar entryName[32];
+    std::snprintf(entryName, sizeof(entryName), "%016llx.luac", static_cast<unsigned long long>(Lua::Fnv1a(path.data(), path.size())));
+    const auto entryPath = fs::path(m_directory) / entryName;
+
+    Lua::String entry;
+    if (ReadFile(entryPath, entry))
+    {
+        const auto prefixSize = sizeof(EntryHeader) + path.size();
+        if (entry.size() > prefixSize
+            && std::memcmp(entry.data(), &key, sizeof(EntryHeader)) == 0
+            && entry.compare(sizeof(EntryHeader), path.size(), path) == 0)
+        {
+            if (luaL_loadbufferx(state, entry.data() + prefixSize, entry.size() - prefixSize, chunkName.c_str(), "b") == LUA_OK)
+            {
+                ++m_hits;
+                return Lua::ErrorCode::Ok;
+            }
+
+            // e.g. written by a differently configured Lua
+            lua_pop(state, 1);
+        }
+
+        ++m_stale;
+    }
+
+    ++m_misses;
+
+    const auto start = Clock::now();
+    const auto result = static_cast<Lua::ErrorCode>(luaL_loadbufferx(state, body, bodySize, chunkName.c_str(), "t"));
+    if (result != Lua::ErrorCode::Ok)
+    {
+        return result;
+    }
+
+    entry.assign(reinterpret_cast<const CLchar*>(&key), sizeof(EntryHeader));
+    entry += path;
+    lua_dump(state, &WriteBytecode, &entry, 0);
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    m_compileNanoseconds += static_cast<std::uint64_t>(elapsed);
+
+    if (!WriteEntry(entryPath, entry))
+    {
+        ++m_writeFailures;
+        LUACPP_TRACE("Lua bytecode cache: couldn't write '%s' for '%s'", entryPath.string().c_str(), fileName);
+    }
+
+    return Lua::ErrorCode::Ok;
+}
+
+Cloud::Lua::BytecodeCacheStats Cloud::LuaBytecodeCache::GetStats() const
+{
+    Lua::BytecodeCacheStats stats;
+    stats.hits = m_hits.load();
+    stats.misses = m_misses.load();
+    stats.stale = m_stale.load();
+    stats.writeFailures = m_writeFailures.load();
+    stats.compileNanoseconds = static_cast<double>(m_compileNanoseconds.load());
+    return stats;
+}
@@ -0,0 +1,69 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_BYTECODE_CACHE_HEADER
+#define CLOUD_LUA_CPP_BYTECODE_CACHE_HEADER
+
+#include <atomic>
+#include <cstdint>
+#include "luacpp.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        struct BytecodeCacheStats
+        {
+            CLsize_t    hits                = 0;
+            CLsize_t    misses              = 0; // every compile, including stale entries
+            CLsize_t    stale               = 0; // an entry existed but no longer matched the source
+            CLsize_t    writeFailures       = 0;
+            double      compileNanoseconds  = 0.0; // parse, compile and dump of the misses
+        };
+    }
+
+    // On-disk cache of compiled chunks for LuaState::LoadFile, enabled with LuaState::SetBytecodeCache.
+    // One file per script in the cache directory, named after the hash of the script's absolute path.
+    // An entry holds the path, mtime, size and FNV-1a hash of the source it was compiled from,
+    // followed by the lua_dump output. The source is still read and hashed on every load, an entry
+    // is only used when all of the key matches, anything else recompiles and rewrites it.
+    // Entries are written to a temporary file and renamed into place, so one cache can be shared by
+    // several states, threads and processes. Precompiled (binary) scripts are loaded as they are.
+    class LuaBytecodeCache
+    {
+    public:
+        explicit LuaBytecodeCache(const CLchar* directory); // created if missing
+        LuaBytecodeCache(const LuaBytecodeCache&) = delete;
+
+        // same contract as luaL_loadfile: pushes the chunk or an error message
+        Lua::ErrorCode          Load(lua_State* state, const CLchar* fileName);
+
+        Lua::BytecodeCacheStats GetStats() const;
+        const Lua::String&      GetDirectory() const { return m_directory; }
+
+    private:
+        Lua::String                 m_directory;
+
+        std::atomic<CLsize_t>       m_hits;
+        std::atomic<CLsize_t>       m_misses;
+        std::atomic<CLsize_t>       m_stale;
+        std::atomic<CLsize_t>       m_writeFailures;
+        std::atomic<std::uint64_t>  m_compileNanoseconds;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_BYTECODE_CACHE_HEADER
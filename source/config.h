@@ -19,6 +19,7 @@
 #define CLOUD_LUA_CPP_CONFIG_HEADER
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <unordered_map>
 #include <memory>
@@ -26,10 +27,29 @@
 #include <typeinfo>
 #include <assert.h>
 
+#if defined(__has_include)
+#if __has_include(<version>)
+#include <version>
+#endif
+#endif
+
+#if defined(__cpp_lib_span)
+#include <span>
+#define LUACPP_HAS_STD_SPAN
+#endif
+
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+#include <coroutine>
+#define LUACPP_HAS_COROUTINES
+#endif
+
 #ifdef _DEBUG
 #define LUACPP_DEBUG
 #endif
 
+// define LUACPP_INSTRUMENTATION for call counts and latency histograms of the Lua::Function bindings,
+// see instrumentation.h and LuaStateEx::GetBindingStats
+
 #ifdef LUACPP_DEBUG
 
 #define LUACPP_TRACE Cloud::Lua::DefaultTrace
@@ -63,7 +83,13 @@ namespace Cloud
         using UniquePtr = std::unique_ptr<_T, _D>;
 
         template <class _T>
-        constexpr UniquePtr<_T> MakeUnique = std::make_unique<_T>;
+        using SharedPtr = std::shared_ptr<_T>;
+
+        template <class _T, class... _Args>
+        inline UniquePtr<_T> MakeUnique(_Args&&... args)
+        {
+            return std::make_unique<_T>(std::forward<_Args>(args)...);
+        }
 
         template <class _Fty>
         using Function = std::function<_Fty>;
@@ -72,6 +98,7 @@ namespace Cloud
         using UnorderedMap = std::unordered_map<_Kty, _Ty>;
 
         using String = std::string;
+        using StringView = std::string_view;
     }
 }
 
@@ -0,0 +1,117 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "coroutine.h"
+
+#ifdef LUACPP_HAS_COROUTINES
+
+static_assert(LUA_EXTRASPACE >= sizeof(void*), "LuaAsyncDriver is kept in LUA_EXTRASPACE");
+
+Cloud::LuaAsyncDriver::LuaAsyncDriver(lua_State* thread, lua_State* owner)
+    : m_thread(thread)
+    , m_owner(owner)
+    , m_status(LUA_OK)
+    , m_pushTask(nullptr)
+{
+}
+
+Cloud::LuaAsyncDriver::~LuaAsyncDriver()
+{
+    // abandoned while Lua waited, the coroutine stays suspended and raises an error if resumed
+    if (m_task)
+    {
+        m_task.destroy();
+        Install(nullptr);
+    }
+}
+
+void Cloud::LuaAsyncDriver::SetPendingTask(std::coroutine_handle<> task, PushTaskResult push)
+{
+    LUACPP_ASSERT(!m_task, "LuaAsyncDriver: the coroutine is already waiting for a task");
+    m_task = task;
+    m_pushTask = push;
+}
+
+CLint Cloud::LuaAsyncDriver::PushPendingTask(lua_State* state)
+{
+    auto task = m_task;
+    m_task = nullptr;
+    return m_pushTask(state, task);
+}
+
+void Cloud::LuaAsyncDriver::OnTaskComplete()
+{
+    if (Step(0))
+    {
+        m_continuation.resume();
+    }
+}
+
+CLbool Cloud::LuaAsyncDriver::Step(CLint argCount)
+{
+    Install(this);
+    m_status = lua_resume(m_thread, m_owner, argCount);
+    if (m_status == LUA_YIELD && m_task)
+    {
+        return false;
+    }
+
+    Install(nullptr);
+    return true;
+}
+
+void Cloud::LuaAsyncDriver::Install(LuaAsyncDriver* driver)
+{
+    *static_cast<LuaAsyncDriver**>(lua_getextraspace(m_thread)) = driver;
+}
+
+void Cloud::LuaTaskInvoker::PushException(lua_State* state, const std::exception_ptr& exception)
+{
+    try
+    {
+        std::rethrow_exception(exception);
+    }
+    catch (const std::exception& error)
+    {
+        lua_pushstring(state, error.what());
+    }
+    catch (...)
+    {
+        lua_pushliteral(state, "unknown exception in a LuaTask");
+    }
+}
+
+int Cloud::LuaTaskInvoker::Continue(lua_State* state, int status, lua_KContext context)
+{
+    LUACPP_UNUSED(status);
+    LUACPP_UNUSED(context);
+
+    CLint results = Error;
+    auto* driver = LuaAsyncDriver::Get(state);
+    if (driver && driver->HasPendingTask())
+    {
+        results = driver->PushPendingTask(state);
+    }
+    else
+    {
+        lua_pushliteral(state, "the host call this coroutine waited for was abandoned");
+    }
+
+    return results == Error ? lua_error(state) : results;
+}
+
+#endif // LUACPP_HAS_COROUTINES
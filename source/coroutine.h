@@ -0,0 +1,306 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_COROUTINE_HEADER
+#define CLOUD_LUA_CPP_COROUTINE_HEADER
+
+#include "config.h"
+
+#ifdef LUACPP_HAS_COROUTINES
+
+#include <exception>
+#include <optional>
+#include "function_ref.h"
+
+namespace Cloud
+{
+    template <typename _T>
+    class LuaTask;
+
+    // Runs a Lua coroutine for LuaThread::ResumeAsync and owns the host call (a LuaTask) it waits for.
+    // While the coroutine runs, the driver sits in the LUA_EXTRASPACE of its lua_State, that's how
+    // bound functions returning a LuaTask find it.
+    class LuaAsyncDriver
+    {
+    public:
+        using PushTaskResult = CLint(*)(lua_State* state, std::coroutine_handle<> task);
+
+        LuaAsyncDriver(const LuaAsyncDriver&) = delete;
+
+        // the driver of the coroutine running on state, nullptr outside ResumeAsync
+        static LuaAsyncDriver* Get(lua_State* state)
+        {
+            return *static_cast<LuaAsyncDriver**>(lua_getextraspace(state));
+        }
+
+        CLbool  HasPendingTask() const { return static_cast<CLbool>(m_task); }
+        void    SetPendingTask(std::coroutine_handle<> task, PushTaskResult push);
+
+        // pushes the result or error message of the finished task and destroys it, see LuaTaskInvoker
+        CLint   PushPendingTask(lua_State* state);
+
+        // the pending task finished: continues the Lua coroutine and, once that yields, returns
+        // or fails, the C++ coroutine awaiting it
+        void    OnTaskComplete();
+
+    protected:
+        LuaAsyncDriver(lua_State* thread, lua_State* owner);
+        ~LuaAsyncDriver();
+
+        // lua_resume, true unless the coroutine is now waiting for a task
+        CLbool  Step(CLint argCount);
+        CLint   GetStatus() const { return m_status; }
+
+        std::coroutine_handle<> m_continuation;
+
+    private:
+        void    Install(LuaAsyncDriver* driver);
+
+        lua_State*              m_thread;
+        lua_State*              m_owner;
+        CLint                   m_status;
+        std::coroutine_handle<> m_task;
+        PushTaskResult          m_pushTask;
+    };
+
+    struct LuaTaskPromiseBase
+    {
+        // hands control to whoever waits: the Lua coroutine through its driver or an awaiting C++ coroutine
+        struct FinalAwaiter
+        {
+            CLbool await_ready() const noexcept { return false; }
+
+            template <typename _Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<_Promise> handle) noexcept
+            {
+                auto& promise = handle.promise();
+                if (auto* driver = promise.m_driver)
+                {
+                    // destroys the task, nothing here may be touched afterwards
+                    driver->OnTaskComplete();
+                    return std::noop_coroutine();
+                }
+
+                return promise.m_continuation ? promise.m_continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter        final_suspend() const noexcept { return {}; }
+        void                unhandled_exception() { m_exception = std::current_exception(); }
+
+        std::coroutine_handle<> m_continuation;
+        LuaAsyncDriver*         m_driver = nullptr;
+        std::exception_ptr      m_exception;
+    };
+
+    template <typename _T>
+    struct LuaTaskPromise : LuaTaskPromiseBase
+    {
+        LuaTask<_T> get_return_object();
+
+        void return_value(_T value) { m_value.emplace(std::move(value)); }
+
+        _T GetResult()
+        {
+            if (m_exception)
+            {
+                std::rethrow_exception(m_exception);
+            }
+            return std::move(*m_value);
+        }
+
+        std::optional<_T> m_value;
+    };
+
+    template <>
+    struct LuaTaskPromise<void> : LuaTaskPromiseBase
+    {
+        LuaTask<void> get_return_object();
+
+        void return_void() {}
+
+        void GetResult()
+        {
+            if (m_exception)
+            {
+                std::rethrow_exception(m_exception);
+            }
+        }
+    };
+
+    // A lazily started C++20 coroutine producing a _T.
+    //
+    // Returned from a bound function it's a host call Lua can wait for: the calling Lua coroutine is
+    // suspended with lua_yieldk until the task finishes and the call then returns its result, or raises
+    // what it threw as a Lua error. That only works for coroutines run by LuaThread::ResumeAsync,
+    // anywhere else the call fails. The task has to be resumed on the thread owning the Lua state,
+    // e.g. by posting completions to the host's event loop.
+    //
+    //   LuaTask<Lua::String> Fetch(Lua::String url) { co_return co_await http.Get(url); }
+    //   state.RegisterFunction<&Fetch>("fetch");
+    //
+    // C++ coroutines can co_await a task as well, a top level task is run with Start().
+    template <typename _T = void>
+    class LuaTask
+    {
+    public:
+        using promise_type = LuaTaskPromise<_T>;
+        using Handle = std::coroutine_handle<promise_type>;
+
+        explicit LuaTask(Handle handle)
+            : m_handle(handle)
+        {}
+
+        LuaTask(const LuaTask&) = delete;
+
+        LuaTask(LuaTask&& other)
+            : m_handle(other.m_handle)
+        {
+            other.m_handle = nullptr;
+        }
+
+        ~LuaTask()
+        {
+            if (m_handle)
+            {
+                m_handle.destroy();
+            }
+        }
+
+        CLbool  IsDone() const { return !m_handle || m_handle.done(); }
+
+        // runs the task up to its first suspension, awaited tasks are started by the awaiter
+        void    Start() { m_handle.resume(); }
+
+        // only once done, rethrows what the task threw
+        _T      GetResult() { return m_handle.promise().GetResult(); }
+
+        Handle  Release()
+        {
+            auto handle = m_handle;
+            m_handle = nullptr;
+            return handle;
+        }
+
+        struct Awaiter
+        {
+            CLbool await_ready() const { return handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+            {
+                handle.promise().m_continuation = awaiting;
+                return handle;
+            }
+
+            _T await_resume() { return handle.promise().GetResult(); }
+
+            Handle handle;
+        };
+
+        Awaiter operator co_await() const { return Awaiter{ m_handle }; }
+
+    private:
+        Handle m_handle;
+    };
+
+    template <typename _T>
+    LuaTask<_T> LuaTaskPromise<_T>::get_return_object()
+    {
+        return LuaTask<_T>(LuaTask<_T>::Handle::from_promise(*this));
+    }
+
+    inline LuaTask<void> LuaTaskPromise<void>::get_return_object()
+    {
+        return LuaTask<void>(LuaTask<void>::Handle::from_promise(*this));
+    }
+
+    template <typename _T>
+    struct IsLuaTask : std::false_type {};
+
+    template <typename _T>
+    struct IsLuaTask<LuaTask<_T>> : std::true_type {};
+
+    // The Lua side of a bound function returning a LuaTask, see LuaNativeInvoker
+    struct LuaTaskInvoker
+    {
+        enum : CLint
+        {
+            Error       = -1,   // the message is on the stack, raise it
+            Suspended   = -2,   // lua_yieldk with Continue
+        };
+
+        // runs the task up to its first suspension, the result count if it finished right away
+        template <typename _T>
+        static CLint Start(lua_State* state, LuaTask<_T> task)
+        {
+            auto* driver = LuaAsyncDriver::Get(state);
+            if (!driver)
+            {
+                lua_pushliteral(state, "host calls returning a LuaTask need a coroutine run by LuaThread::ResumeAsync");
+                return Error;
+            }
+
+            auto handle = task.Release();
+            handle.resume();
+            if (handle.done())
+            {
+                return PushResult<_T>(state, handle);
+            }
+
+            handle.promise().m_driver = driver;
+            driver->SetPendingTask(handle, &PushResult<_T>);
+            return Suspended;
+        }
+
+        template <typename _T>
+        static CLint PushResult(lua_State* state, std::coroutine_handle<> task)
+        {
+            auto handle = LuaTask<_T>::Handle::from_address(task.address());
+            auto& promise = handle.promise();
+
+            CLint results = 0;
+            if (promise.m_exception)
+            {
+                PushException(state, promise.m_exception);
+                results = Error;
+            }
+            else
+            {
+                if constexpr (!std::is_void<_T>::value)
+                {
+                    LuaStack<std::decay_t<_T>>::Push(state, *promise.m_value);
+                    results = 1;
+                }
+            }
+
+            handle.destroy();
+            return results;
+        }
+
+        static void PushException(lua_State* state, const std::exception_ptr& exception);
+
+        // lua_KFunction, runs when the driver resumes the coroutine after the task finished
+        static int Continue(lua_State* state, int status, lua_KContext context);
+    };
+}
+
+#endif // LUACPP_HAS_COROUTINES
+
+#endif // CLOUD_LUA_CPP_COROUTINE_HEADER
@@ -0,0 +1,230 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "executor.h"
+
+Cloud::LuaExecutor::LuaExecutor(CLsize_t workerCount, const Initializer& initializer)
+    : m_workerCount(workerCount > 0 ? workerCount : 1)
+    , m_initializer(initializer)
+    , m_workers(new Worker[m_workerCount])
+    , m_initialized(0)
+    , m_sleeping(0)
+    , m_submitted(0)
+    , m_stopping(false)
+{
+    for (CLsize_t i = 0; i < m_workerCount; ++i)
+    {
+        m_workers[i].thread = std::thread(&LuaExecutor::WorkerMain, this, i);
+    }
+
+    std::exception_ptr initError;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this] { return m_initialized == m_workerCount; });
+        initError = m_initError;
+    }
+
+    // nothing was submitted yet, the destructor won't run for a throwing constructor
+    if (initError)
+    {
+        Stop();
+        std::rethrow_exception(initError);
+    }
+}
+
+Cloud::LuaExecutor::~LuaExecutor()
+{
+    Stop();
+}
+
+void Cloud::LuaExecutor::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wakeup.notify_all();
+
+    for (CLsize_t i = 0; i < m_workerCount; ++i)
+    {
+        m_workers[i].thread.join();
+    }
+}
+
+Cloud::Lua::ExecutorStats Cloud::LuaExecutor::GetStats() const
+{
+    Lua::ExecutorStats stats;
+    stats.workers = m_workerCount;
+    for (CLsize_t i = 0; i < m_workerCount; ++i)
+    {
+        stats.executed += m_workers[i].executed.load(std::memory_order_relaxed);
+        stats.stolen += m_workers[i].stolen.load(std::memory_order_relaxed);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats.submitted = m_submitted;
+    stats.injected = m_injected.size();
+    return stats;
+}
+
+void Cloud::LuaExecutor::Enqueue(Job* job)
+{
+    CLbool wake;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_injected.push_back(job);
+        ++m_submitted;
+        wake = m_sleeping > 0;
+    }
+
+    if (wake)
+    {
+        m_wakeup.notify_one();
+    }
+}
+
+void Cloud::LuaExecutor::WorkerMain(CLsize_t index)
+{
+    LuaStateEx state;
+    std::exception_ptr initError;
+    try
+    {
+        m_initializer(state);
+    }
+    catch (...)
+    {
+        initError = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (initError && !m_initError)
+        {
+            m_initError = initError;
+        }
+        ++m_initialized;
+    }
+    m_ready.notify_one();
+
+    if (initError)
+    {
+        return;
+    }
+
+    auto* luaState = state.GetState();
+    lua_settop(luaState, 0);
+
+    auto& worker = m_workers[index];
+    auto random = static_cast<std::uint32_t>(index * 2654435761u + 1);
+
+    for (;;)
+    {
+        auto* job = worker.deque.Pop();
+        if (!job)
+        {
+            job = TakeInjected(worker);
+        }
+        if (!job)
+        {
+            job = Steal(index, random);
+        }
+
+        if (!job)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_injected.empty())
+            {
+                // every other deque is drained by its owner before it stops
+                if (m_stopping)
+                {
+                    break;
+                }
+
+                ++m_sleeping;
+                m_wakeup.wait(lock);
+                --m_sleeping;
+            }
+            continue;
+        }
+
+        job->Run(luaState);
+        delete job;
+        worker.executed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+Cloud::LuaExecutor::Job* Cloud::LuaExecutor::TakeInjected(Worker& worker)
+{
+    Job* job = nullptr;
+    CLsize_t moved = 0;
+    CLbool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_injected.empty())
+        {
+            return nullptr;
+        }
+
+        job = m_injected.front();
+        m_injected.pop_front();
+
+        // a fair share for this worker, the rest of the workers take from the queue or steal it
+        auto batch = m_injected.size() / m_workerCount;
+        batch = batch < c_maxBatch ? batch : c_maxBatch;
+        for (; moved < batch && worker.deque.Push(m_injected.front()); ++moved)
+        {
+            m_injected.pop_front();
+        }
+        wake = moved > 0 && m_sleeping > 0;
+    }
+
+    if (wake)
+    {
+        m_wakeup.notify_all();
+    }
+    return job;
+}
+
+Cloud::LuaExecutor::Job* Cloud::LuaExecutor::Steal(CLsize_t thief, std::uint32_t& random)
+{
+    if (m_workerCount < 2)
+    {
+        return nullptr;
+    }
+
+    // xorshift32, a random first victim keeps the thieves from piling onto the same worker
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+
+    const auto first = static_cast<CLsize_t>(random % m_workerCount);
+    for (CLsize_t i = 0; i < m_workerCount; ++i)
+    {
+        const auto victim = (first + i) % m_workerCount;
+        if (victim == thief)
+        {
+            continue;
+        }
+
+        if (auto* job = m_workers[victim].deque.Steal())
+        {
+            m_workers[thief].stolen.fetch_add(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,298 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_EXECUTOR_HEADER
+#define CLOUD_LUA_CPP_EXECUTOR_HEADER
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "state_ex.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        struct ExecutorStats
+        {
+            CLsize_t    workers     = 0;
+            CLsize_t    submitted   = 0;
+            CLsize_t    executed    = 0;
+            CLsize_t    stolen      = 0; // jobs a worker took from another worker's deque
+            CLsize_t    injected    = 0; // jobs still waiting in the shared queue
+        };
+    }
+
+    // what the future of a failed LuaExecutor call throws
+    class LuaCallError : public std::runtime_error
+    {
+    public:
+        LuaCallError(Lua::ErrorCode error, const CLchar* message)
+            : std::runtime_error(message)
+            , m_error(error)
+        {}
+
+        Lua::ErrorCode GetError() const { return m_error; }
+
+    private:
+        Lua::ErrorCode m_error;
+    };
+
+    // Single producer, multi consumer deque of Chase and Lev (the C11 formulation of Le et al.):
+    // the owning thread pushes and pops at the bottom, any thread steals from the top, no locks.
+    // Fixed capacity, Push fails when full.
+    template <typename _T, CLsize_t _Capacity>
+    class LuaWorkStealingDeque
+    {
+        static_assert((_Capacity & (_Capacity - 1)) == 0, "the capacity has to be a power of two");
+
+    public:
+        LuaWorkStealingDeque()
+            : m_top(0)
+            , m_bottom(0)
+        {
+            for (auto& slot : m_slots)
+            {
+                slot.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        // owner only
+        CLbool Push(_T* item)
+        {
+            const auto bottom = m_bottom.load(std::memory_order_relaxed);
+            const auto top = m_top.load(std::memory_order_acquire);
+            if (bottom - top >= static_cast<std::int64_t>(_Capacity))
+            {
+                return false;
+            }
+
+            m_slots[bottom & c_mask].store(item, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // owner only, nullptr when empty
+        _T* Pop()
+        {
+            const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+            m_bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto top = m_top.load(std::memory_order_relaxed);
+
+            if (top > bottom)
+            {
+                m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            auto* item = m_slots[bottom & c_mask].load(std::memory_order_relaxed);
+            if (top == bottom)
+            {
+                // the last item, race the thieves for it
+                if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                {
+                    item = nullptr;
+                }
+                m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        // any thread, nullptr when empty or when another thread won the race
+        _T* Steal()
+        {
+            auto top = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const auto bottom = m_bottom.load(std::memory_order_acquire);
+
+            if (top >= bottom)
+            {
+                return nullptr;
+            }
+
+            auto* item = m_slots[top & c_mask].load(std::memory_order_relaxed);
+            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                return nullptr;
+            }
+            return item;
+        }
+
+        CLsize_t GetFreeSlots() const
+        {
+            const auto used = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+            return used >= static_cast<std::int64_t>(_Capacity) ? 0 : _Capacity - static_cast<CLsize_t>(used > 0 ? used : 0);
+        }
+
+    private:
+        static constexpr std::int64_t c_mask = static_cast<std::int64_t>(_Capacity) - 1;
+
+        alignas(64) std::atomic<std::int64_t>   m_top;
+        alignas(64) std::atomic<std::int64_t>   m_bottom;
+        std::atomic<_T*>                        m_slots[_Capacity];
+    };
+
+    // N worker threads, each owning a LuaStateEx set up by the same initializer, running
+    // "call global F with these values" jobs and handing the results back through futures.
+    //
+    //   LuaExecutor executor(std::thread::hardware_concurrency(), [](LuaStateEx& state) { state.DoFile("jobs.lua"); });
+    //   std::future<CLint> cost = executor.Submit<CLint>("pathCost", from, to);
+    //
+    // Submissions go to a shared queue. An idle worker moves a batch from there into its own
+    // lock-free work-stealing deque, and idle workers steal from the other deques before they sleep.
+    // Arguments are copied into the job, strings included. A failed call makes the future throw a
+    // LuaCallError. The initializers run on the worker threads, the constructor waits for them and
+    // rethrows the first exception one of them threw. The destructor finishes every submitted job
+    // before joining.
+    class LuaExecutor
+    {
+    public:
+        using Initializer = Lua::Function<void(LuaStateEx&)>;
+
+        LuaExecutor(CLsize_t workerCount, const Initializer& initializer);
+        LuaExecutor(const LuaExecutor&) = delete;
+        ~LuaExecutor();
+
+        // _Return follows LuaFunctionRef: void, a value or a tuple, strings as Lua::String
+        template <typename _Return, typename... _Args>
+        std::future<_Return> Submit(const CLchar* functionName, _Args&&... args)
+        {
+            auto* job = new CallJob<_Return, StoredArg<_Args>...>(functionName, std::forward<_Args>(args)...);
+            auto future = job->GetFuture();
+            Enqueue(job);
+            return future;
+        }
+
+        CLsize_t            GetWorkerCount() const { return m_workerCount; }
+        Lua::ExecutorStats  GetStats() const;
+
+    private:
+        class Job
+        {
+        public:
+            virtual ~Job() {}
+            virtual void Run(lua_State* state) = 0;
+        };
+
+        // string arguments are owned by the job, the caller's buffer may be gone when it runs
+        template <typename _T>
+        using StoredArg = std::conditional_t<
+            std::is_same<std::decay_t<_T>, const CLchar*>::value || std::is_same<std::decay_t<_T>, CLchar*>::value || std::is_same<std::decay_t<_T>, Lua::StringView>::value,
+            Lua::String, std::decay_t<_T>>;
+
+        template <typename _Return, typename... _Args>
+        class CallJob : public Job
+        {
+        public:
+            template <typename... _Values>
+            CallJob(const CLchar* functionName, _Values&&... values)
+                : m_function(functionName)
+                , m_args(std::forward<_Values>(values)...)
+            {}
+
+            std::future<_Return> GetFuture() { return m_promise.get_future(); }
+
+            void Run(lua_State* state) override
+            {
+                // a user type the template didn't register would raise outside a protected call
+                if (!(LuaHostStack<_Args>::CanPush(state) && ...))
+                {
+                    m_promise.set_exception(std::make_exception_ptr(LuaCallError(Lua::ErrorCode::ErrRun, "argument of an unregistered user type")));
+                    return;
+                }
+
+                lua_getglobal(state, m_function.c_str());
+                std::apply([state](const auto&... values)
+                {
+                    LUACPP_UNUSED(state);
+                    (LuaStack<std::decay_t<decltype(values)>>::Push(state, values), ...);
+                }, m_args);
+
+                constexpr auto argCount = static_cast<CLint>(sizeof...(_Args));
+                const auto error = static_cast<Lua::ErrorCode>(lua_pcall(state, argCount, LuaReturn<_Return>::Count, 0));
+
+                if (error != Lua::ErrorCode::Ok)
+                {
+                    m_promise.set_exception(std::make_exception_ptr(LuaCallError(error, lua_isstring(state, -1) ? lua_tostring(state, -1) : "<no message>")));
+                    lua_settop(state, 0);
+                    return;
+                }
+
+                if (!LuaReturn<_Return>::CanRead(state))
+                {
+                    m_promise.set_exception(std::make_exception_ptr(LuaCallError(Lua::ErrorCode::ErrRun, "result of the wrong type")));
+                }
+                else if constexpr (std::is_void<_Return>::value)
+                {
+                    m_promise.set_value();
+                }
+                else
+                {
+                    m_promise.set_value(LuaReturn<_Return>::Pop(state));
+                }
+                lua_settop(state, 0);
+            }
+
+        private:
+            Lua::String             m_function;
+            std::tuple<_Args...>    m_args;
+            std::promise<_Return>   m_promise;
+        };
+
+        static constexpr CLsize_t c_dequeCapacity = 256;
+        static constexpr CLsize_t c_maxBatch = 32;
+
+        struct alignas(64) Worker
+        {
+            LuaWorkStealingDeque<Job, c_dequeCapacity>  deque;
+            std::atomic<CLsize_t>                       executed { 0 };
+            std::atomic<CLsize_t>                       stolen { 0 };
+            std::thread                                 thread;
+        };
+
+        void    Stop();
+        void    Enqueue(Job* job);
+        void    WorkerMain(CLsize_t index);
+        Job*    TakeInjected(Worker& worker);
+        Job*    Steal(CLsize_t thief, std::uint32_t& random);
+
+        const CLsize_t                  m_workerCount;
+        Initializer                     m_initializer;
+        Lua::UniquePtr<Worker[]>        m_workers;
+
+        mutable std::mutex              m_mutex;
+        std::condition_variable         m_wakeup;
+        std::condition_variable         m_ready;
+        CLsize_t                        m_initialized;
+        std::exception_ptr              m_initError;
+        std::deque<Job*>                m_injected;
+        CLsize_t                        m_sleeping;
+        CLsize_t                        m_submitted;
+        CLbool                          m_stopping;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_EXECUTOR_HEADER
@@ -18,7 +18,13 @@
 #ifndef CLOUD_LUA_CPP_FUNCTION_HEADER
 #define CLOUD_LUA_CPP_FUNCTION_HEADER
 
+#include <tuple>
 #include "state.h"
+#include "coroutine.h"
+
+#ifdef LUACPP_INSTRUMENTATION
+#include "instrumentation.h"
+#endif
 
 namespace Cloud
 {
@@ -28,108 +34,194 @@ namespace Cloud
         LuaFunctionBase() {};
         LuaFunctionBase(const LuaFunctionBase&) = delete;
         virtual ~LuaFunctionBase() {};
-        virtual CLint Invoke(LuaState& state) = 0;
+        virtual CLint Invoke(lua_State* state) = 0;
+
+#ifdef LUACPP_INSTRUMENTATION
+        LuaCallCounters& GetCounters() { return m_counters; }
+
+    private:
+        LuaCallCounters m_counters;
+#endif
     };
 
+    template <typename _Return, typename... _Args>
+    struct LuaNativeInvoker;
+
+    // Returned from a bound function to suspend the calling coroutine: the values are passed to
+    // LuaThread::Resume (or coroutine.resume) and the arguments of the next resume become the results
+    // of the call in Lua. Outside a coroutine the call raises a Lua error.
+    //
+    //   LuaYield<CLint> Wait(CLint frames) { return LuaYield<CLint>(frames); }
+    template <typename... _Values>
+    struct LuaYield
+    {
+        static constexpr CLint Count = static_cast<CLint>(sizeof...(_Values));
+
+        explicit LuaYield(_Values... args)
+            : values(std::move(args)...)
+        {}
+
+        std::tuple<_Values...> values;
+    };
+
+    template <typename _T>
+    struct IsLuaYield : std::false_type {};
+
+    template <typename... _Values>
+    struct IsLuaYield<LuaYield<_Values...>> : std::true_type {};
+
+    // Wraps a Lua::Function. The closure's upvalue points at this object and the trampoline
+    // works on the calling lua_State, nothing refers back to the owning LuaState, so the
+    // state can be moved around freely. The owner keeps the object alive as long as the state.
     template <typename _Return, typename... _Args>
     class LuaFunction : public LuaFunctionBase
     {
         using Func = Lua::Function<_Return(_Args...)>;
-        using ArgsTuple = std::tuple<_Args...>;
 
     public:
         LuaFunction(LuaState& state, const CLchar* funcName, const Func& func)
             : LuaFunctionBase()
-            , m_state(state)
-            , m_funcName(funcName)
             , m_function(func)
         {
-            m_state.PushLightUserData(this);
-            m_state.PushCClosure(LuaFunction::InvokeBase, 1);
-            m_state.SetGlobal(funcName);
+            state.PushLightUserData(this);
+            state.PushCClosure(LuaFunction::InvokeBase, 1);
+            state.SetGlobal(funcName);
         }
 
         LuaFunction(const LuaFunction&) = delete;
 
-        LuaFunction(LuaFunction&& other)
-            : m_state(other.m_state)
-            , m_funcName(other.m_funcName)
-            , m_function(std::move(other.m_function))
-        {}
-
-        ~LuaFunction() override
+        CLint Invoke(lua_State* state) override
         {
-            m_state.PushNil();
-            m_state.SetGlobal(m_funcName);
+            return LuaNativeInvoker<_Return, _Args...>::Apply(state, m_function);
         }
 
-        template <typename... _Types, CLsize_t... _N>
-        static auto GetArgs(LuaState& state, const CLint stackIndex, Indices<_N...>)
+        static CLint InvokeBase(lua_State* state)
         {
-            LUACPP_UNUSED(state);
-            LUACPP_UNUSED(stackIndex);
-            return std::make_tuple(state.To<_Types>(stackIndex + _N)...);
+            auto* func = static_cast<LuaFunction<_Return, _Args...>*>(lua_touserdata(state, lua_upvalueindex(1)));
+#ifdef LUACPP_INSTRUMENTATION
+            auto& counters = func->GetCounters();
+            const auto start = counters.BeginCall();
+            const auto results = func->Invoke(state);
+            counters.EndCall(start);
+            return results;
+#else
+            return func->Invoke(state);
+#endif
         }
 
-        template <typename... _Types>
-        static auto GetArgs(LuaState& state, const CLint stackIndex)
-        {
-            constexpr auto numArgs = sizeof...(_Types);
-            return GetArgs<_Types...>(state, stackIndex, IndicesBuilderType<numArgs>());
-        }
+    private:
+        Func m_function;
+    };
 
-        template <typename... _Args, CLsize_t... _N>
-        static auto CallFunction(Func&& func, ArgsTuple&& args, Indices<_N...>)
+    // Calls a callable with arguments read straight from the Lua stack, starting at firstIndex,
+    // and pushes the result. Used by the generated trampolines below.
+    template <typename _Return, typename... _Args>
+    struct LuaNativeInvoker
+    {
+        template <typename _Callable, CLsize_t... _N>
+        static CLint Apply(lua_State* state, _Callable&& callable, CLint firstIndex, Indices<_N...>)
         {
-            LUACPP_UNUSED(args);
-            return std::forward<Func>(func)(std::get<_N>(std::forward<ArgsTuple>(args))...);
+            LUACPP_UNUSED(state);
+            LUACPP_UNUSED(firstIndex);
+
+            if constexpr (std::is_void<_Return>::value)
+            {
+                callable(LuaStack<std::decay_t<_Args>>::To(state, static_cast<CLint>(_N) + firstIndex)...);
+                return 0;
+            }
+            else if constexpr (IsLuaYield<_Return>::value)
+            {
+                {
+                    auto yield = callable(LuaStack<std::decay_t<_Args>>::To(state, static_cast<CLint>(_N) + firstIndex)...);
+                    std::apply([state](const auto&... values)
+                    {
+                        LUACPP_UNUSED(state);
+                        (LuaStack<std::decay_t<decltype(values)>>::Push(state, values), ...);
+                    }, yield.values);
+                }
+
+                // lua_yield longjmps out of the trampoline, everything above is destroyed by now
+                return lua_yield(state, _Return::Count);
+            }
+#ifdef LUACPP_HAS_COROUTINES
+            else if constexpr (IsLuaTask<_Return>::value)
+            {
+                const auto results = LuaTaskInvoker::Start(state, callable(LuaStack<std::decay_t<_Args>>::To(state, static_cast<CLint>(_N) + firstIndex)...));
+
+                // like above, both longjmp
+                if (results == LuaTaskInvoker::Error)
+                {
+                    return lua_error(state);
+                }
+                if (results == LuaTaskInvoker::Suspended)
+                {
+                    return lua_yieldk(state, 0, 0, &LuaTaskInvoker::Continue);
+                }
+                return results;
+            }
+#endif
+            else
+            {
+                LuaStack<std::decay_t<_Return>>::Push(state, callable(LuaStack<std::decay_t<_Args>>::To(state, static_cast<CLint>(_N) + firstIndex)...));
+                return 1;
+            }
         }
 
-        static auto CallFunction(Func&& func, ArgsTuple&& args)
+        template <typename _Callable>
+        static CLint Apply(lua_State* state, _Callable&& callable, CLint firstIndex = 1)
         {
-            return CallFunction(std::forward<Func>(func), std::forward<ArgsTuple>(args), IndicesBuilderType<sizeof...(_Args)>());
+            return Apply(state, std::forward<_Callable>(callable), firstIndex, IndicesBuilderType<sizeof...(_Args)>());
         }
+    };
 
-        template<typename _Return, CLsize_t _NumArgs, typename... _Args>
-        struct Invoker
-        {
-            static CLint Apply(LuaState& state, Func&& func)
-            {
-                constexpr auto numArgs = static_cast<CLint>(sizeof...(_Args));
-                auto&& args = GetArgs<_Args...>(state, -numArgs);
-                auto&& ret = CallFunction(std::forward<Func>(func), std::forward<ArgsTuple>(args));
-                state.Push(ret);
-                return 1;
-            }
-        };
+    template <typename _Signature, _Signature _Function>
+    struct LuaNativeFunctionImpl;
 
-        template<CLsize_t _NumArgs, typename... _Args>
-        struct Invoker<void, _NumArgs, _Args...>
+    // free function: the function pointer is a template argument, so the call is direct
+    template <typename _Return, typename... _Args, _Return(*_Function)(_Args...)>
+    struct LuaNativeFunctionImpl<_Return(*)(_Args...), _Function>
+    {
+        static CLint Invoke(lua_State* state)
         {
-            static CLint Apply(LuaState& state, Func&& func)
+            return LuaNativeInvoker<_Return, _Args...>::Apply(state, [](auto&&... args) -> _Return
             {
-                constexpr auto numArgs = static_cast<CLint>(sizeof...(_Args));
-                auto&& args = GetArgs<_Args...>(state, -numArgs);
-                CallFunction(std::forward<Func>(func), std::forward<ArgsTuple>(args));
-                return 0;
-            }
-        };
+                return _Function(std::forward<decltype(args)>(args)...);
+            });
+        }
+    };
 
-        CLint Invoke(LuaState& state) override
+    // member function: the instance is the closure's only upvalue
+    template <typename _Class, typename _Return, typename... _Args, _Return(_Class::*_Method)(_Args...)>
+    struct LuaNativeFunctionImpl<_Return(_Class::*)(_Args...), _Method>
+    {
+        static CLint Invoke(lua_State* state)
         {
-            return Invoker<_Return, sizeof...(_Args), _Args...>::Apply(state, std::forward<Func>(m_function));
+            auto* instance = static_cast<_Class*>(lua_touserdata(state, lua_upvalueindex(1)));
+            return LuaNativeInvoker<_Return, _Args...>::Apply(state, [instance](auto&&... args) -> _Return
+            {
+                return (instance->*_Method)(std::forward<decltype(args)>(args)...);
+            });
         }
+    };
 
-        static CLint InvokeBase(lua_State* state)
+    template <typename _Class, typename _Return, typename... _Args, _Return(_Class::*_Method)(_Args...) const>
+    struct LuaNativeFunctionImpl<_Return(_Class::*)(_Args...) const, _Method>
+    {
+        static CLint Invoke(lua_State* state)
         {
-            auto* func = static_cast<LuaFunction<_Return, _Args...>*>(lua_touserdata(state, lua_upvalueindex(1)));
-            return func->Invoke(func->m_state);
+            const auto* instance = static_cast<const _Class*>(lua_touserdata(state, lua_upvalueindex(1)));
+            return LuaNativeInvoker<_Return, _Args...>::Apply(state, [instance](auto&&... args) -> _Return
+            {
+                return (instance->*_Method)(std::forward<decltype(args)>(args)...);
+            });
         }
+    };
 
-    private:
-        LuaState& m_state;
-        const CLchar* m_funcName;
-        Func m_function;
+    // Compile-time binding: LuaNativeFunction<&func>::Invoke is a plain lua_CFunction,
+    // no heap object, no virtual call and no std::function between Lua and func.
+    template <auto _Function>
+    struct LuaNativeFunction : LuaNativeFunctionImpl<decltype(_Function), _Function>
+    {
     };
 }
 
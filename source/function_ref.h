@@ -0,0 +1,330 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_FUNCTION_REF_HEADER
+#define CLOUD_LUA_CPP_FUNCTION_REF_HEADER
+
+#include <tuple>
+#include "stack.h"
+#include "utility.h"
+
+namespace Cloud
+{
+    // How many results a call returns and how to read them off the stack. Pop raises a Lua error for
+    // a result that isn't of the user type asked for, the host side checks CanRead first.
+    // Note that a const CLchar* or Lua::StringView result points into a string that is no longer on the stack,
+    // use Lua::String to keep it.
+    template <typename _T>
+    struct LuaReturn
+    {
+        static constexpr CLint Count = 1;
+
+        static _T Pop(lua_State* state)
+        {
+            auto value = LuaStack<_T>::To(state, -1);
+            lua_pop(state, 1);
+            return value;
+        }
+
+        static CLbool CanRead(lua_State* state)
+        {
+            return LuaHostStack<_T>::CanRead(state, -1);
+        }
+
+        static _T Default() { return _T(); }
+    };
+
+    template <>
+    struct LuaReturn<void>
+    {
+        static constexpr CLint Count = 0;
+
+        static void Pop(lua_State*) {}
+        static CLbool CanRead(lua_State*) { return true; }
+        static void Default() {}
+    };
+
+    template <typename... _Types>
+    struct LuaReturn<std::tuple<_Types...>>
+    {
+        static constexpr CLint Count = static_cast<CLint>(sizeof...(_Types));
+
+        template <CLsize_t... _N>
+        static std::tuple<_Types...> Read(lua_State* state, Indices<_N...>)
+        {
+            LUACPP_UNUSED(state);
+            return std::tuple<_Types...>(LuaStack<_Types>::To(state, static_cast<CLint>(_N) - Count)...);
+        }
+
+        static std::tuple<_Types...> Pop(lua_State* state)
+        {
+            auto values = Read(state, IndicesBuilderType<sizeof...(_Types)>());
+            lua_pop(state, Count);
+            return values;
+        }
+
+        template <CLsize_t... _N>
+        static CLbool CanRead(lua_State* state, Indices<_N...>)
+        {
+            LUACPP_UNUSED(state);
+            return (LuaHostStack<_Types>::CanRead(state, static_cast<CLint>(_N) - Count) && ...);
+        }
+
+        static CLbool CanRead(lua_State* state)
+        {
+            return CanRead(state, IndicesBuilderType<sizeof...(_Types)>());
+        }
+
+        static std::tuple<_Types...> Default() { return std::tuple<_Types...>(); }
+    };
+
+    namespace Lua
+    {
+        struct BatchResult
+        {
+            ErrorCode   error           = ErrorCode::Ok;
+            CLsize_t    completed       = 0; // elements that ran to completion
+            CLsize_t    failedIndex     = 0; // only meaningful when error isn't Ok
+        };
+    }
+
+    template <typename _Signature>
+    class LuaFunctionRef;
+
+    // A Lua function resolved once and pinned in the registry.
+    // Calling it is a registry lookup, the pushes, lua_pcall and the reads,
+    // no global lookup by name and no stack sentry.
+    // Must be destroyed before the state it was created from.
+    template <typename _Return, typename... _Args>
+    class LuaFunctionRef<_Return(_Args...)>
+    {
+    public:
+        LuaFunctionRef()
+            : m_state(nullptr)
+            , m_ref(LUA_NOREF)
+            , m_lastError(Lua::ErrorCode::Ok)
+        {}
+
+        // pins the function at stackIndex, the stack itself is left untouched
+        LuaFunctionRef(lua_State* state, CLint stackIndex)
+            : m_state(state)
+            , m_lastError(Lua::ErrorCode::Ok)
+        {
+            lua_pushvalue(state, stackIndex);
+            m_ref = luaL_ref(state, LUA_REGISTRYINDEX);
+        }
+
+        LuaFunctionRef(const LuaFunctionRef&) = delete;
+
+        LuaFunctionRef(LuaFunctionRef&& other)
+            : m_state(other.m_state)
+            , m_ref(other.m_ref)
+            , m_lastError(other.m_lastError)
+        {
+            other.m_ref = LUA_NOREF;
+        }
+
+        LuaFunctionRef& operator=(LuaFunctionRef&& other)
+        {
+            if (this != &other)
+            {
+                Reset();
+                m_state = other.m_state;
+                m_ref = other.m_ref;
+                m_lastError = other.m_lastError;
+                other.m_ref = LUA_NOREF;
+            }
+            return *this;
+        }
+
+        ~LuaFunctionRef()
+        {
+            Reset();
+        }
+
+        void Reset()
+        {
+            if (m_state && m_ref != LUA_NOREF)
+            {
+                luaL_unref(m_state, LUA_REGISTRYINDEX, m_ref);
+            }
+            m_ref = LUA_NOREF;
+        }
+
+        CLbool          IsValid() const { return m_ref != LUA_NOREF && m_ref != LUA_REFNIL; }
+        Lua::ErrorCode  GetLastError() const { return m_lastError; }
+
+        void PushFunction() const
+        {
+            lua_rawgeti(m_state, LUA_REGISTRYINDEX, m_ref);
+        }
+
+        // on error the error is traced and popped, GetLastError() has the code
+        // and a default constructed result is returned. Calling an invalid ref,
+        // running out of stack, an argument of an unregistered user type and a result
+        // that isn't of the user type asked for fail with ErrRun.
+        _Return operator()(_Args... args)
+        {
+            constexpr auto argCount = static_cast<CLint>(sizeof...(_Args));
+            if (!CanCall(c_callSlots))
+            {
+                return LuaReturn<_Return>::Default();
+            }
+
+            if (!(LuaHostStack<std::decay_t<_Args>>::CanPush(m_state) && ...))
+            {
+                LUACPP_TRACE("Lua function ref error:\nargument of an unregistered user type");
+                m_lastError = Lua::ErrorCode::ErrRun;
+                return LuaReturn<_Return>::Default();
+            }
+
+            PushFunction();
+            (LuaStack<std::decay_t<_Args>>::Push(m_state, args), ...);
+
+            m_lastError = static_cast<Lua::ErrorCode>(lua_pcall(m_state, argCount, LuaReturn<_Return>::Count, 0));
+
+            if (m_lastError != Lua::ErrorCode::Ok)
+            {
+                LUACPP_TRACE("Lua function ref error:\n%s", lua_isstring(m_state, -1) ? lua_tostring(m_state, -1) : "<no message>");
+                lua_pop(m_state, 1);
+                return LuaReturn<_Return>::Default();
+            }
+
+            if (!LuaReturn<_Return>::CanRead(m_state))
+            {
+                LUACPP_TRACE("Lua function ref error:\nresult of the wrong type");
+                m_lastError = Lua::ErrorCode::ErrRun;
+                lua_pop(m_state, LuaReturn<_Return>::Count);
+                return LuaReturn<_Return>::Default();
+            }
+
+            return LuaReturn<_Return>::Pop(m_state);
+        }
+
+        using ArgsTuple = std::tuple<std::decay_t<_Args>...>;
+        using ResultType = std::conditional_t<std::is_void<_Return>::value, CLchar, _Return>;
+
+        // Calls the function once per element of args inside a single protected call,
+        // results[i] receives the result of args[i]. The first error stops the batch.
+        Lua::BatchResult CallBatch(Lua::Span<const ArgsTuple> args, Lua::Span<ResultType> results)
+        {
+            LUACPP_ASSERT(results.size() >= args.size(), "CallBatch needs a result slot per argument set");
+            return RunBatch(args, results.data());
+        }
+
+        Lua::BatchResult CallBatch(Lua::Span<const ArgsTuple> args)
+        {
+            return RunBatch(args, nullptr);
+        }
+
+    private:
+        // the function and its arguments, then its results in their place
+        static constexpr CLint c_callSlots = static_cast<CLint>(sizeof...(_Args)) + 1 > LuaReturn<_Return>::Count
+            ? static_cast<CLint>(sizeof...(_Args)) + 1 : LuaReturn<_Return>::Count;
+
+        struct BatchContext
+        {
+            Lua::Span<const ArgsTuple>  args;
+            ResultType*                 results;
+            CLsize_t                    current;
+        };
+
+        // runs inside the protected call: [context, function]
+        static int BatchRunner(lua_State* state)
+        {
+            auto* context = static_cast<BatchContext*>(lua_touserdata(state, 1));
+            constexpr auto argCount = static_cast<CLint>(sizeof...(_Args));
+            luaL_checkstack(state, c_callSlots, "too many arguments");
+
+            for (; context->current < context->args.size(); ++context->current)
+            {
+                lua_pushvalue(state, 2);
+                std::apply([state](const auto&... values)
+                {
+                    LUACPP_UNUSED(state);
+                    (LuaStack<std::decay_t<decltype(values)>>::Push(state, values), ...);
+                }, context->args[context->current]);
+
+                lua_call(state, argCount, LuaReturn<_Return>::Count);
+
+                if constexpr (std::is_void<_Return>::value)
+                {
+                    LUACPP_UNUSED(context->results);
+                }
+                else
+                {
+                    context->results[context->current] = LuaReturn<_Return>::Pop(state);
+                }
+            }
+
+            return 0;
+        }
+
+        Lua::BatchResult RunBatch(Lua::Span<const ArgsTuple> args, ResultType* results)
+        {
+            if (!CanCall(3))
+            {
+                return { m_lastError, 0, 0 };
+            }
+
+            BatchContext context = { args, results, 0 };
+
+            lua_pushcfunction(m_state, &LuaFunctionRef::BatchRunner);
+            lua_pushlightuserdata(m_state, &context);
+            PushFunction();
+
+            Lua::BatchResult result;
+            result.error = static_cast<Lua::ErrorCode>(lua_pcall(m_state, 2, 0, 0));
+            result.completed = context.current;
+            m_lastError = result.error;
+
+            if (result.error != Lua::ErrorCode::Ok)
+            {
+                result.failedIndex = context.current;
+                LUACPP_TRACE("Lua batch call error at index %zu:\n%s", context.current, lua_isstring(m_state, -1) ? lua_tostring(m_state, -1) : "<no message>");
+                lua_pop(m_state, 1);
+            }
+
+            return result;
+        }
+
+        CLbool CanCall(CLint stackSlots)
+        {
+            if (!IsValid())
+            {
+                LUACPP_TRACE("Lua function ref error:\ncalling an invalid ref");
+                m_lastError = Lua::ErrorCode::ErrRun;
+                return false;
+            }
+
+            if (!lua_checkstack(m_state, stackSlots))
+            {
+                LUACPP_TRACE("Lua function ref error:\nstack overflow");
+                m_lastError = Lua::ErrorCode::ErrRun;
+                return false;
+            }
+
+            return true;
+        }
+
+        lua_State*      m_state;
+        CLint           m_ref;
+        Lua::ErrorCode  m_lastError;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_FUNCTION_REF_HEADER
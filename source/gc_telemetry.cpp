@@ -0,0 +1,130 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "gc_telemetry.h"
+
+#include <algorithm>
+
+namespace
+{
+    std::uint64_t ToNanoseconds(std::chrono::steady_clock::duration duration)
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+}
+
+Cloud::LuaGcTelemetry::LuaGcTelemetry(lua_State* state)
+    : m_state(state)
+    , m_depth(0)
+{
+    lua_setgchook(m_state, &LuaGcTelemetry::Hook, this);
+}
+
+Cloud::LuaGcTelemetry::~LuaGcTelemetry()
+{
+    lua_setgchook(m_state, nullptr, nullptr);
+}
+
+void Cloud::LuaGcTelemetry::Hook(void* userData, int event, size_t totalBytes)
+{
+    auto* telemetry = static_cast<LuaGcTelemetry*>(userData);
+    const auto now = Clock::now();
+
+    switch (event)
+    {
+    case LUA_GCEVSTEP:
+        telemetry->Begin(false, totalBytes, now);
+        break;
+    case LUA_GCEVFULL:
+        telemetry->Begin(true, totalBytes, now);
+        break;
+    case LUA_GCEVEND:
+        telemetry->End(totalBytes, now);
+        break;
+    default:
+        telemetry->EnterPhase(event - LUA_GCEVPROPAGATE, totalBytes, now);
+        break;
+    }
+}
+
+void Cloud::LuaGcTelemetry::Begin(CLbool full, CLsize_t totalBytes, Clock::time_point now)
+{
+    // steps don't nest, anything still open was left by an error in a finalizer, as are
+    // collections nested deeper than finalizers calling collectgarbage would get
+    if (!full || m_depth == c_maxDepth)
+    {
+        m_depth = 0;
+    }
+
+    auto& frame = m_frames[m_depth++];
+    frame.start = now;
+    frame.phaseStart = now;
+    frame.phaseBytes = totalBytes;
+    frame.phase = -1;
+    frame.full = full;
+    std::fill(std::begin(frame.phaseNanoseconds), std::end(frame.phaseNanoseconds), 0);
+}
+
+void Cloud::LuaGcTelemetry::End(CLsize_t totalBytes, Clock::time_point now)
+{
+    if (m_depth == 0)
+    {
+        return;
+    }
+
+    auto& frame = m_frames[--m_depth];
+    ClosePhase(frame, totalBytes, now);
+
+    (frame.full ? m_stats.fullCollections : m_stats.steps).Record(ToNanoseconds(now - frame.start));
+    for (CLsize_t phase = 0; phase < c_phaseCount; ++phase)
+    {
+        if (frame.phaseNanoseconds[phase] > 0)
+        {
+            m_stats.phases[phase].Record(frame.phaseNanoseconds[phase]);
+        }
+    }
+}
+
+void Cloud::LuaGcTelemetry::EnterPhase(CLint phase, CLsize_t totalBytes, Clock::time_point now)
+{
+    LUACPP_ASSERT(phase >= 0 && phase < static_cast<CLint>(c_phaseCount), "LuaGcTelemetry: unknown GC event");
+
+    // singlestep outside of a step or collection, e.g. while closing the state
+    if (m_depth == 0)
+    {
+        return;
+    }
+
+    auto& frame = m_frames[m_depth - 1];
+    ClosePhase(frame, totalBytes, now);
+    frame.phase = phase;
+}
+
+void Cloud::LuaGcTelemetry::ClosePhase(Frame& frame, CLsize_t totalBytes, Clock::time_point now)
+{
+    if (frame.phase >= 0)
+    {
+        frame.phaseNanoseconds[frame.phase] += ToNanoseconds(now - frame.phaseStart);
+        if (frame.phase != static_cast<CLint>(Lua::GcPhase::Finalize) && totalBytes < frame.phaseBytes)
+        {
+            m_stats.bytesFreed += frame.phaseBytes - totalBytes;
+        }
+    }
+
+    frame.phaseStart = now;
+    frame.phaseBytes = totalBytes;
+}
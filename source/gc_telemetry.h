@@ -0,0 +1,96 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_GC_TELEMETRY_HEADER
+#define CLOUD_LUA_CPP_GC_TELEMETRY_HEADER
+
+#include <chrono>
+#include "latency_histogram.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        enum class GcPhase
+        {
+            Propagate,  // incremental marking, including the roots at the start of a cycle
+            Atomic,     // the last, non-incremental mark and the clearing of weak tables
+            Sweep,
+            Finalize,   // __gc metamethods and whatever they run
+            Count,
+        };
+
+        struct GcStats
+        {
+            LatencyHistogram    steps;              // incremental steps, the pauses the running scripts see
+            LatencyHistogram    fullCollections;    // collectgarbage("collect"), LUA_GCCOLLECT and emergency collections
+            LatencyHistogram    phases[static_cast<CLsize_t>(GcPhase::Count)]; // time one step or collection spent in a phase
+            std::uint64_t       bytesFreed          = 0; // heap shrinkage outside of finalizers, which may allocate
+
+            const LatencyHistogram& GetPhase(GcPhase phase) const { return phases[static_cast<CLsize_t>(phase)]; }
+        };
+    }
+
+    // Pause times of the collector, fed by the lua_setgchook hook added to the bundled Lua (lgc.c).
+    // The hook reports the start and end of every luaC_step and luaC_fullgc and each phase change
+    // in between, the clock is only read on those events. Without telemetry the collector pays a
+    // null check per singlestep.
+    // A full collection started by a finalizer in the middle of a step is timed on its own and is
+    // part of the step's finalize time as well. A step or collection cut short by an error in a
+    // finalizer isn't recorded.
+    class LuaGcTelemetry
+    {
+    public:
+        explicit LuaGcTelemetry(lua_State* state);
+        LuaGcTelemetry(const LuaGcTelemetry&) = delete;
+        ~LuaGcTelemetry();
+
+        const Lua::GcStats& GetStats() const { return m_stats; }
+        void                Reset() { m_stats = Lua::GcStats(); }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr CLsize_t c_maxDepth = 4;
+        static constexpr CLsize_t c_phaseCount = static_cast<CLsize_t>(Lua::GcPhase::Count);
+
+        // a step or full collection in progress
+        struct Frame
+        {
+            Clock::time_point   start;
+            Clock::time_point   phaseStart;
+            CLsize_t            phaseBytes;
+            CLint               phase;      // -1 before the first phase event
+            CLbool              full;
+            std::uint64_t       phaseNanoseconds[c_phaseCount];
+        };
+
+        static void Hook(void* userData, int event, size_t totalBytes);
+
+        void        Begin(CLbool full, CLsize_t totalBytes, Clock::time_point now);
+        void        End(CLsize_t totalBytes, Clock::time_point now);
+        void        EnterPhase(CLint phase, CLsize_t totalBytes, Clock::time_point now);
+        void        ClosePhase(Frame& frame, CLsize_t totalBytes, Clock::time_point now);
+
+        lua_State*      m_state;
+        Frame           m_frames[c_maxDepth];
+        CLsize_t        m_depth;
+        Lua::GcStats    m_stats;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_GC_TELEMETRY_HEADER
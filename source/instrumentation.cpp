@@ -0,0 +1,88 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "instrumentation.h"
+
+Cloud::LuaCallCounters::LuaCallCounters()
+    : m_shards(nullptr)
+{
+}
+
+Cloud::LuaCallCounters::~LuaCallCounters()
+{
+    delete[] m_shards.load();
+}
+
+void Cloud::LuaCallCounters::Snapshot(Lua::BindingStats& stats) const
+{
+    stats.calls = 0;
+    stats.latency.Clear();
+
+    const auto* shards = m_shards.load(std::memory_order_acquire);
+    if (!shards)
+    {
+        return;
+    }
+
+    for (CLsize_t s = 0; s < c_shardCount; ++s)
+    {
+        const auto& shard = shards[s];
+        stats.calls += shard.calls.load(std::memory_order_relaxed);
+        stats.latency.m_totalNanoseconds += static_cast<double>(shard.totalNanoseconds.load(std::memory_order_relaxed));
+
+        for (CLsize_t i = 0; i < Lua::LatencyHistogram::c_bucketCount; ++i)
+        {
+            const auto count = shard.buckets[i].load(std::memory_order_relaxed);
+            stats.latency.m_buckets[i] += count;
+            stats.latency.m_count += count;
+        }
+    }
+}
+
+void Cloud::LuaCallCounters::Reset()
+{
+    auto* shards = m_shards.load(std::memory_order_acquire);
+    if (!shards)
+    {
+        return;
+    }
+
+    for (CLsize_t s = 0; s < c_shardCount; ++s)
+    {
+        auto& shard = shards[s];
+        shard.calls.store(0, std::memory_order_relaxed);
+        shard.totalNanoseconds.store(0, std::memory_order_relaxed);
+        for (auto& bucket : shard.buckets)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+Cloud::LuaCallCounters::Shard* Cloud::LuaCallCounters::AllocateShards()
+{
+    // value initialized, all zero; forks calling the binding for the first time at once race here,
+    // the losers free their copy
+    auto* shards = new Shard[c_shardCount]();
+    Shard* expected = nullptr;
+    if (!m_shards.compare_exchange_strong(expected, shards, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+        delete[] shards;
+        return expected;
+    }
+    return shards;
+}
@@ -0,0 +1,115 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_INSTRUMENTATION_HEADER
+#define CLOUD_LUA_CPP_INSTRUMENTATION_HEADER
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "latency_histogram.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        struct BindingStats
+        {
+            const CLchar*       name    = nullptr;
+            std::uint64_t       calls   = 0; // includes calls that raised an error or yielded
+            LatencyHistogram    latency;     // calls that returned, see LuaCallCounters::BeginCall
+        };
+    }
+
+    // Call count and latency histogram of one binding, striped over 8 cache line aligned shards.
+    // Threads are dealt the shards round-robin on first use, so up to 8 threads calling the same
+    // binding (forks of a template, say) never share a line and threads beyond 8 share a shard with
+    // an earlier one, the counters are relaxed atomics for that. A snapshot taken
+    // while calls are running may be off by those calls. The shards take about 34 KB and are allocated
+    // on the first call, bindings that are never called only cost a pointer.
+    class LuaCallCounters
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr CLsize_t c_shardCount = 8;
+
+        LuaCallCounters();
+        LuaCallCounters(const LuaCallCounters&) = delete;
+        ~LuaCallCounters();
+
+        // counts the call and returns its start for EndCall, called once the call returned; a Lua error
+        // or a yield longjmps past EndCall, so no destructor is relied on and those calls have no latency
+        Clock::time_point BeginCall()
+        {
+            CountCall();
+            return Clock::now();
+        }
+
+        void EndCall(Clock::time_point start)
+        {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            RecordLatency(static_cast<std::uint64_t>(elapsed));
+        }
+
+        void CountCall()
+        {
+            GetShard().calls.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void RecordLatency(std::uint64_t nanoseconds)
+        {
+            auto& shard = GetShard();
+            shard.buckets[Lua::LatencyHistogram::GetBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+            shard.totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        }
+
+        void Snapshot(Lua::BindingStats& stats) const;
+        void Reset();
+
+    private:
+        struct alignas(64) Shard
+        {
+            std::atomic<std::uint64_t> calls;
+            std::atomic<std::uint64_t> totalNanoseconds;
+            std::atomic<std::uint64_t> buckets[Lua::LatencyHistogram::c_bucketCount];
+        };
+
+        static CLsize_t GetThreadShard()
+        {
+            static std::atomic<CLsize_t> s_nextShard(0);
+            thread_local const CLsize_t s_shard = s_nextShard.fetch_add(1, std::memory_order_relaxed) % c_shardCount;
+            return s_shard;
+        }
+
+        Shard& GetShard()
+        {
+            auto* shards = m_shards.load(std::memory_order_acquire);
+            if (!shards)
+            {
+                shards = AllocateShards();
+            }
+            return shards[GetThreadShard()];
+        }
+
+        Shard* AllocateShards();
+
+        std::atomic<Shard*> m_shards;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_INSTRUMENTATION_HEADER
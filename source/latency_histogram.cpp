@@ -0,0 +1,94 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "latency_histogram.h"
+
+std::uint64_t Cloud::Lua::LatencyHistogram::GetBucketLowerBound(CLsize_t bucket)
+{
+    if (bucket < c_subBucketCount)
+    {
+        return bucket;
+    }
+
+    const auto shift = (bucket - c_subBucketCount) / c_subBucketCount;
+    const auto subBucket = (bucket - c_subBucketCount) % c_subBucketCount;
+    return static_cast<std::uint64_t>(c_subBucketCount + subBucket) << shift;
+}
+
+std::uint64_t Cloud::Lua::LatencyHistogram::GetBucketUpperBound(CLsize_t bucket)
+{
+    if (bucket < c_subBucketCount)
+    {
+        return bucket + 1;
+    }
+
+    const auto shift = (bucket - c_subBucketCount) / c_subBucketCount;
+    return GetBucketLowerBound(bucket) + (std::uint64_t(1) << shift);
+}
+
+void Cloud::Lua::LatencyHistogram::Record(std::uint64_t nanoseconds, std::uint64_t count)
+{
+    m_buckets[GetBucket(nanoseconds)] += count;
+    m_count += count;
+    m_totalNanoseconds += static_cast<double>(nanoseconds) * static_cast<double>(count);
+}
+
+void Cloud::Lua::LatencyHistogram::Merge(const LatencyHistogram& other)
+{
+    for (CLsize_t i = 0; i < c_bucketCount; ++i)
+    {
+        m_buckets[i] += other.m_buckets[i];
+    }
+    m_count += other.m_count;
+    m_totalNanoseconds += other.m_totalNanoseconds;
+}
+
+void Cloud::Lua::LatencyHistogram::Clear()
+{
+    m_buckets.fill(0);
+    m_count = 0;
+    m_totalNanoseconds = 0.0;
+}
+
+double Cloud::Lua::LatencyHistogram::GetMean() const
+{
+    return m_count > 0 ? m_totalNanoseconds / static_cast<double>(m_count) : 0.0;
+}
+
+std::uint64_t Cloud::Lua::LatencyHistogram::GetPercentile(double percentile) const
+{
+    if (m_count == 0)
+    {
+        return 0;
+    }
+
+    // the rank of the value, 1 based, at least the first one
+    auto rank = static_cast<std::uint64_t>(percentile / 100.0 * static_cast<double>(m_count) + 0.5);
+    rank = rank < 1 ? 1 : rank > m_count ? m_count : rank;
+
+    std::uint64_t seen = 0;
+    for (CLsize_t i = 0; i < c_bucketCount; ++i)
+    {
+        seen += m_buckets[i];
+        if (seen >= rank)
+        {
+            return GetBucketUpperBound(i);
+        }
+    }
+
+    return GetBucketUpperBound(c_bucketCount - 1);
+}
@@ -0,0 +1,100 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_LATENCY_HISTOGRAM_HEADER
+#define CLOUD_LUA_CPP_LATENCY_HISTOGRAM_HEADER
+
+#include <array>
+#include <cstdint>
+#include "luacpp.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Cloud
+{
+    class LuaCallCounters;
+
+    namespace Lua
+    {
+        // Log-linear latency buckets in nanoseconds, the layout of an HDR histogram with 16 sub-buckets
+        // per power of two: exact below 16 ns, within 6.25% above, values from 2^36 ns (~69 s) up share
+        // the last bucket.
+        class LatencyHistogram
+        {
+        public:
+            static constexpr CLsize_t   c_subBucketBits = 4;
+            static constexpr CLsize_t   c_subBucketCount = CLsize_t(1) << c_subBucketBits;
+            static constexpr CLsize_t   c_maxBits = 36;
+            static constexpr CLsize_t   c_bucketCount = c_subBucketCount + (c_maxBits - c_subBucketBits) * c_subBucketCount;
+
+            static CLsize_t GetBucket(std::uint64_t nanoseconds)
+            {
+                if (nanoseconds < c_subBucketCount)
+                {
+                    return static_cast<CLsize_t>(nanoseconds);
+                }
+
+                const auto exponent = HighestBit(nanoseconds);
+                if (exponent >= c_maxBits)
+                {
+                    return c_bucketCount - 1;
+                }
+
+                const auto subBucket = static_cast<CLsize_t>(nanoseconds >> (exponent - c_subBucketBits)) - c_subBucketCount;
+                return c_subBucketCount + (exponent - c_subBucketBits) * c_subBucketCount + subBucket;
+            }
+
+            // index of the highest set bit, value isn't 0
+            static CLsize_t HighestBit(std::uint64_t value)
+            {
+#if defined(_MSC_VER)
+                unsigned long index = 0;
+                _BitScanReverse64(&index, value);
+                return index;
+#else
+                return static_cast<CLsize_t>(63 - __builtin_clzll(value));
+#endif
+            }
+
+            // the smallest value counted in bucket and the first one past it
+            static std::uint64_t GetBucketLowerBound(CLsize_t bucket);
+            static std::uint64_t GetBucketUpperBound(CLsize_t bucket);
+
+            void            Record(std::uint64_t nanoseconds, std::uint64_t count = 1);
+            void            Merge(const LatencyHistogram& other);
+            void            Clear();
+
+            std::uint64_t   GetCount() const { return m_count; }
+            std::uint64_t   GetBucketCount(CLsize_t bucket) const { return m_buckets[bucket]; }
+            double          GetMean() const;
+            // the upper bound of the bucket holding the percentile (0..100), 0 when empty
+            std::uint64_t   GetPercentile(double percentile) const;
+            std::uint64_t   GetMax() const { return GetPercentile(100.0); }
+
+        private:
+            friend class Cloud::LuaCallCounters;
+
+            std::array<std::uint64_t, c_bucketCount> m_buckets = {};
+            std::uint64_t   m_count = 0;
+            double          m_totalNanoseconds = 0.0;
+        };
+    }
+}
+
+#endif // CLOUD_LUA_CPP_LATENCY_HISTOGRAM_HEADER
@@ -16,6 +16,9 @@
 */
 
 #include "luacpp.h"
+#include "allocator.h"
+
+#include <cstring>
 
 int Cloud::Lua::LuaPrint(lua_State* state)
 {
@@ -38,20 +41,26 @@ int Cloud::Lua::LuaPanic(lua_State* state)
     return 0;  /* return to Lua to abort */
 }
 
-Cloud::Lua::StateUniquePtr Cloud::Lua::NewState()
+Cloud::Lua::StateUniquePtr Cloud::Lua::NewState(LuaAllocator* allocator)
 {
-    auto* state = luaL_newstate();
+    auto* state = allocator
+        ? lua_newstate(allocator->GetFunction(), allocator->GetUserData())
+        : luaL_newstate();
     if (state)
     {
         lua_atpanic(state, &LuaPanic);
+
+        // Lua leaves it uninitialised and copies it into every new thread, LuaAsyncDriver::Get
+        // relies on it being null outside ResumeAsync
+        std::memset(lua_getextraspace(state), 0, LUA_EXTRASPACE);
     }
 
     return StateUniquePtr(state);
 }
 
-Cloud::Lua::StateUniquePtr Cloud::Lua::NewStateAndSetup()
+Cloud::Lua::StateUniquePtr Cloud::Lua::NewStateAndSetup(LuaAllocator* allocator)
 {
-    auto luaState = NewState();
+    auto luaState = NewState(allocator);
 
     // open standard libs
     auto* s = luaState.get();
@@ -77,7 +86,7 @@ void Cloud::Lua::DefaultTrace(const CLchar* output, ...)
     va_list argList;
     va_start(argList, output);
 
-    printf(output, argList);
+    vprintf(output, argList);
     printf("\n");
 
     va_end(argList);
@@ -23,6 +23,8 @@
 
 namespace Cloud
 {
+    class LuaAllocator;
+
     namespace Lua
     {
         enum class ErrorCode : int
@@ -65,8 +67,8 @@ namespace Cloud
         int LuaPrint(lua_State* state);
         int LuaPanic(lua_State* state);
         
-        StateUniquePtr NewState();
-        StateUniquePtr NewStateAndSetup();
+        StateUniquePtr NewState(LuaAllocator* allocator = nullptr);
+        StateUniquePtr NewStateAndSetup(LuaAllocator* allocator = nullptr);
 
         void DefaultTrace(const CLchar* output, ...);
     }
@@ -0,0 +1,180 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Cloud::LuaMappedFile::LuaMappedFile()
+    : m_data(nullptr)
+    , m_size(0)
+    , m_open(false)
+{
+}
+
+Cloud::LuaMappedFile::LuaMappedFile(const CLchar* fileName)
+    : LuaMappedFile()
+{
+    Open(fileName);
+}
+
+Cloud::LuaMappedFile::~LuaMappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+CLbool Cloud::LuaMappedFile::Open(const CLchar* fileName)
+{
+    Close();
+
+    auto file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    if (size.QuadPart > 0)
+    {
+        // the view keeps the mapping alive, both handles can go right away
+        auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            m_data = static_cast<const CLchar*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+        }
+
+        if (!m_data)
+        {
+            CloseHandle(file);
+            return false;
+        }
+    }
+
+    CloseHandle(file);
+    m_size = static_cast<CLsize_t>(size.QuadPart);
+    m_open = true;
+    return true;
+}
+
+void Cloud::LuaMappedFile::Close()
+{
+    if (m_data)
+    {
+        UnmapViewOfFile(m_data);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+#else
+
+CLbool Cloud::LuaMappedFile::Open(const CLchar* fileName)
+{
+    Close();
+
+    const auto file = open(fileName, O_RDONLY);
+    if (file < 0)
+    {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        close(file);
+        return false;
+    }
+
+    if (info.st_size > 0)
+    {
+        auto* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        if (data == MAP_FAILED)
+        {
+            close(file);
+            return false;
+        }
+        m_data = static_cast<const CLchar*>(data);
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(file);
+    m_size = static_cast<CLsize_t>(info.st_size);
+    m_open = true;
+    return true;
+}
+
+void Cloud::LuaMappedFile::Close()
+{
+    if (m_data)
+    {
+        munmap(const_cast<CLchar*>(m_data), m_size);
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+}
+
+#endif
+
+CLsize_t Cloud::Lua::SkipScriptPrefix(const CLchar* data, CLsize_t size)
+{
+    CLsize_t offset = size >= 3 && data[0] == '\xEF' && data[1] == '\xBB' && data[2] == '\xBF' ? 3 : 0;
+    if (offset < size && data[offset] == '#')
+    {
+        while (offset < size && data[offset] != '\n')
+        {
+            ++offset;
+        }
+    }
+    return offset;
+}
+
+Cloud::Lua::ErrorCode Cloud::Lua::LoadMappedFile(lua_State* state, const CLchar* fileName)
+{
+    LuaMappedFile file(fileName);
+    if (!file.IsOpen())
+    {
+        return static_cast<ErrorCode>(luaL_loadfile(state, fileName));
+    }
+
+    const auto offset = SkipScriptPrefix(file.GetData(), file.GetSize());
+    const auto chunkName = String("@") + fileName;
+
+    // luaL_loadbufferx's reader returns the whole buffer in one call, lua_load picks text or binary
+    return static_cast<ErrorCode>(luaL_loadbufferx(state, file.GetData() + offset, file.GetSize() - offset, chunkName.c_str(), nullptr));
+}
@@ -0,0 +1,60 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_MAPPED_FILE_HEADER
+#define CLOUD_LUA_CPP_MAPPED_FILE_HEADER
+
+#include "luacpp.h"
+
+namespace Cloud
+{
+    // Read-only memory mapping of a whole regular file (mmap / MapViewOfFile).
+    // Opening anything else (pipes, devices, missing files) fails, callers fall back to stdio.
+    class LuaMappedFile
+    {
+    public:
+        LuaMappedFile();
+        explicit LuaMappedFile(const CLchar* fileName);
+        LuaMappedFile(const LuaMappedFile&) = delete;
+        ~LuaMappedFile();
+
+        CLbool          Open(const CLchar* fileName);
+        void            Close();
+
+        CLbool          IsOpen() const { return m_open; }
+        const CLchar*   GetData() const { return m_data; } // nullptr for empty files
+        CLsize_t        GetSize() const { return m_size; }
+
+    private:
+        const CLchar*   m_data;
+        CLsize_t        m_size;
+        CLbool          m_open;
+    };
+
+    namespace Lua
+    {
+        // Offset of the chunk in a script file: skips a UTF-8 BOM and a first line starting with '#'
+        // like luaL_loadfilex does, the newline stays so line numbers don't shift.
+        CLsize_t        SkipScriptPrefix(const CLchar* data, CLsize_t size);
+
+        // luaL_loadfile through a mapping: the whole file is handed to lua_load as a single block,
+        // without the stdio buffer copies. Falls back to luaL_loadfile if the file can't be mapped.
+        ErrorCode       LoadMappedFile(lua_State* state, const CLchar* fileName);
+    }
+}
+
+#endif // CLOUD_LUA_CPP_MAPPED_FILE_HEADER
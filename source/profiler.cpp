@@ -0,0 +1,453 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // registry key of the profiler sampling the state, the hook has no upvalues
+    const CLchar c_profilerKey = 0;
+
+#ifndef _WIN32
+    // the profiler running on this thread, read by the signal handler
+    thread_local std::atomic<Cloud::LuaProfiler*> s_threadProfiler(nullptr);
+    std::once_flag s_signalHandlerOnce;
+#endif
+
+    // appends to a fixed buffer, whatever doesn't fit is cut
+    class TextWriter
+    {
+    public:
+        TextWriter(CLchar* data, CLsize_t capacity)
+            : m_data(data)
+            , m_capacity(capacity)
+            , m_length(0)
+        {}
+
+        // ';' separates the frames of a collapsed stack, it can't appear inside one
+        void Append(const CLchar* text)
+        {
+            for (; *text && m_length < m_capacity; ++text)
+            {
+                m_data[m_length++] = *text == ';' || *text == '\n' ? ',' : *text;
+            }
+        }
+
+        void AppendSeparator(CLchar separator)
+        {
+            if (m_length < m_capacity)
+            {
+                m_data[m_length++] = separator;
+            }
+        }
+
+        void AppendInteger(CLint value)
+        {
+            CLchar digits[16];
+            std::snprintf(digits, sizeof(digits), "%d", value);
+            Append(digits);
+        }
+
+        CLsize_t GetLength() const { return m_length; }
+
+    private:
+        CLchar*     m_data;
+        CLsize_t    m_capacity;
+        CLsize_t    m_length;
+    };
+}
+
+Cloud::LuaProfiler::LuaProfiler(LuaState& state)
+    : m_state(state.GetState())
+    , m_stopping(false)
+#ifdef _WIN32
+    , m_hooked(false)
+    , m_tickPending(false)
+#else
+    , m_stateThread()
+#endif
+    , m_samples(0)
+    , m_dropped(0)
+    , m_skipped(0)
+    , m_truncated(0)
+    , m_hookNanoseconds(0)
+{
+}
+
+Cloud::LuaProfiler::~LuaProfiler()
+{
+    Stop();
+}
+
+CLbool Cloud::LuaProfiler::Start(CLsize_t samplesPerSecond)
+{
+    if (IsRunning() || samplesPerSecond == 0 || !BeginTicks())
+    {
+        return false;
+    }
+
+    const auto existing = lua_rawgetp(m_state, LUA_REGISTRYINDEX, &c_profilerKey);
+    LUACPP_ASSERT(existing == LUA_TNIL, "LuaProfiler: one profiler per state");
+    LUACPP_UNUSED(existing);
+    lua_pop(m_state, 1);
+    lua_pushlightuserdata(m_state, this);
+    lua_rawsetp(m_state, LUA_REGISTRYINDEX, &c_profilerKey);
+
+    m_stopping = false;
+    m_timer = std::thread(&LuaProfiler::TimerLoop, this, std::chrono::nanoseconds(1000000000 / samplesPerSecond));
+    return true;
+}
+
+void Cloud::LuaProfiler::Stop()
+{
+    if (!IsRunning())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_timerMutex);
+        m_stopping = true;
+    }
+    m_timerWakeup.notify_one();
+    m_timer.join();
+
+    EndTicks();
+
+    lua_pushnil(m_state);
+    lua_rawsetp(m_state, LUA_REGISTRYINDEX, &c_profilerKey);
+
+    Drain();
+}
+
+void Cloud::LuaProfiler::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_stacksMutex);
+    m_stacks.clear();
+    m_samples = 0;
+    m_dropped = 0;
+    m_skipped = 0;
+    m_truncated = 0;
+    m_hookNanoseconds = 0;
+}
+
+void Cloud::LuaProfiler::WriteCollapsed(Lua::String& out) const
+{
+    std::vector<std::pair<Lua::String, CLsize_t>> stacks;
+    {
+        std::lock_guard<std::mutex> lock(m_stacksMutex);
+        stacks.assign(m_stacks.begin(), m_stacks.end());
+    }
+    std::sort(stacks.begin(), stacks.end());
+
+    for (const auto& stack : stacks)
+    {
+        out += stack.first;
+        out += ' ';
+        out += std::to_string(stack.second);
+        out += '\n';
+    }
+}
+
+CLbool Cloud::LuaProfiler::WriteCollapsed(const CLchar* fileName) const
+{
+    Lua::String contents;
+    WriteCollapsed(contents);
+
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    return file && file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+}
+
+Cloud::Lua::ProfilerStats Cloud::LuaProfiler::GetStats() const
+{
+    Lua::ProfilerStats stats;
+    stats.samples = m_samples.load();
+    stats.dropped = m_dropped.load();
+    stats.skipped = m_skipped.load();
+    stats.truncated = m_truncated.load();
+    stats.hookNanoseconds = static_cast<double>(m_hookNanoseconds.load());
+
+    std::lock_guard<std::mutex> lock(m_stacksMutex);
+    stats.stacks = m_stacks.size();
+    return stats;
+}
+
+void Cloud::LuaProfiler::TimerLoop(std::chrono::nanoseconds period)
+{
+    auto next = Clock::now();
+    for (;;)
+    {
+        // fixed rate, but no burst of samples after a stall
+        next += period;
+        const auto now = Clock::now();
+        if (next < now)
+        {
+            next = now + period;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_timerMutex);
+            if (m_timerWakeup.wait_until(lock, next, [this]() { return m_stopping; }))
+            {
+                return;
+            }
+        }
+
+        Drain();
+        PostTick();
+    }
+}
+
+void Cloud::LuaProfiler::Drain()
+{
+    const auto* sample = m_ring.Front();
+    if (!sample)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_stacksMutex);
+    for (; sample; sample = m_ring.Front())
+    {
+        ++m_stacks[Lua::String(sample->text, sample->length)];
+        m_ring.Pop();
+    }
+}
+
+void Cloud::LuaProfiler::TakeSample(lua_State* state)
+{
+    auto* sample = m_ring.Reserve();
+    if (!sample)
+    {
+        ++m_dropped;
+        return;
+    }
+
+    const auto start = Clock::now();
+
+    lua_Debug frames[c_maxFrames];
+    CLsize_t depth = 0;
+    while (depth < c_maxFrames && lua_getstack(state, static_cast<CLint>(depth), &frames[depth]))
+    {
+        ++depth;
+    }
+
+    TextWriter writer(sample->text, sizeof(sample->text));
+    lua_Debug outer;
+    if (depth == c_maxFrames && lua_getstack(state, static_cast<CLint>(depth), &outer))
+    {
+        ++m_truncated;
+        writer.Append("[truncated]");
+        writer.AppendSeparator(';');
+    }
+
+    for (auto level = depth; level-- > 0;)
+    {
+        auto& frame = frames[level];
+        lua_getinfo(state, "Sn", &frame);
+
+        if (frame.what[0] == 'C')
+        {
+            writer.Append("[C] ");
+            writer.Append(frame.name ? frame.name : "?");
+        }
+        else if (frame.what[0] == 'm')
+        {
+            writer.Append("main ");
+            writer.Append(frame.short_src);
+        }
+        else
+        {
+            writer.Append(frame.name ? frame.name : "?");
+            writer.AppendSeparator(' ');
+            writer.Append(frame.short_src);
+            writer.AppendSeparator(':');
+            writer.AppendInteger(frame.linedefined);
+        }
+
+        if (level > 0)
+        {
+            writer.AppendSeparator(';');
+        }
+    }
+
+    sample->length = writer.GetLength();
+    m_ring.Commit();
+    ++m_samples;
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    m_hookNanoseconds.fetch_add(static_cast<std::uint64_t>(elapsed), std::memory_order_relaxed);
+}
+
+#ifdef _WIN32
+
+CLbool Cloud::LuaProfiler::BeginTicks()
+{
+    // someone else's hook is left alone, the ticks are counted as skipped
+    const auto hook = lua_gethook(m_state);
+    m_hooked = !hook || hook == &LuaProfiler::SampleHook;
+    if (m_hooked)
+    {
+        lua_sethook(m_state, &LuaProfiler::SampleHook, LUA_MASKCOUNT, c_hookInstructions);
+    }
+    m_tickPending = false;
+    return true;
+}
+
+void Cloud::LuaProfiler::EndTicks()
+{
+    // unless it was replaced in the meantime
+    if (m_hooked && lua_gethook(m_state) == &LuaProfiler::SampleHook)
+    {
+        lua_sethook(m_state, nullptr, 0, 0);
+    }
+    m_hooked = false;
+}
+
+void Cloud::LuaProfiler::PostTick()
+{
+    if (!m_hooked)
+    {
+        ++m_skipped;
+        return;
+    }
+
+    // a tick still pending while the state sits outside Lua is taken once
+    m_tickPending.store(true, std::memory_order_release);
+}
+
+void Cloud::LuaProfiler::SampleHook(lua_State* state, lua_Debug* debug)
+{
+    LUACPP_UNUSED(debug);
+
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &c_profilerKey);
+    auto* profiler = static_cast<LuaProfiler*>(lua_touserdata(state, -1));
+    lua_pop(state, 1);
+
+    // coroutines inherit the hook, only the main thread is sampled
+    if (!profiler || state != profiler->m_state)
+    {
+        lua_sethook(state, nullptr, 0, 0);
+        return;
+    }
+
+    if (profiler->m_tickPending.exchange(false, std::memory_order_acq_rel))
+    {
+        profiler->TakeSample(state);
+    }
+}
+
+#else
+
+CLbool Cloud::LuaProfiler::BeginTicks()
+{
+    if (s_threadProfiler.load())
+    {
+        return false;
+    }
+
+    // never removed, a signal arriving after Stop finds no profiler and is ignored
+    std::call_once(s_signalHandlerOnce, []()
+    {
+        struct sigaction action = {};
+        action.sa_handler = &LuaProfiler::SignalHandler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, nullptr);
+    });
+
+    m_stateThread = pthread_self();
+    s_threadProfiler = this;
+    return true;
+}
+
+void Cloud::LuaProfiler::EndTicks()
+{
+    s_threadProfiler = nullptr;
+
+    // a pending sample is dropped, unless the hook was replaced in the meantime
+    if (lua_gethook(m_state) == &LuaProfiler::SampleHook)
+    {
+        lua_sethook(m_state, nullptr, 0, 0);
+    }
+}
+
+void Cloud::LuaProfiler::PostTick()
+{
+    pthread_kill(m_stateThread, SIGPROF);
+}
+
+void Cloud::LuaProfiler::SignalHandler(CLint signal)
+{
+    LUACPP_UNUSED(signal);
+
+    // on the state's thread, which may be anywhere inside Lua, so only the hook is touched
+    auto* profiler = s_threadProfiler.load(std::memory_order_relaxed);
+    if (!profiler)
+    {
+        return;
+    }
+
+    const auto hook = lua_gethook(profiler->m_state);
+    if (hook == &LuaProfiler::SampleHook)
+    {
+        // the previous tick is still pending while the state sits outside Lua, unless the signal
+        // interrupted SampleHook removing it and left it half removed
+        if (lua_gethookmask(profiler->m_state) != 0)
+        {
+            return;
+        }
+    }
+    else if (hook)
+    {
+        profiler->m_skipped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    lua_sethook(profiler->m_state, &LuaProfiler::SampleHook, LUA_MASKCOUNT, 1);
+}
+
+void Cloud::LuaProfiler::SampleHook(lua_State* state, lua_Debug* debug)
+{
+    LUACPP_UNUSED(debug);
+
+    // one sample per tick
+    lua_sethook(state, nullptr, 0, 0);
+
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &c_profilerKey);
+    auto* profiler = static_cast<LuaProfiler*>(lua_touserdata(state, -1));
+    lua_pop(state, 1);
+
+    // coroutines created while a tick is pending inherit the hook, only the main thread is sampled
+    if (profiler && state == profiler->m_state)
+    {
+        profiler->TakeSample(state);
+    }
+}
+
+#endif
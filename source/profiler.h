@@ -0,0 +1,196 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_PROFILER_HEADER
+#define CLOUD_LUA_CPP_PROFILER_HEADER
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "state.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        struct ProfilerStats
+        {
+            CLsize_t    samples         = 0;
+            CLsize_t    dropped         = 0; // the ring was full
+            CLsize_t    skipped         = 0; // ticks where the state had someone else's hook installed
+            CLsize_t    truncated       = 0; // stacks deeper than the frame limit, the outermost frames are cut
+            CLsize_t    stacks          = 0; // distinct stacks collected
+            double      hookNanoseconds = 0.0; // spent taking the samples, on the Lua thread
+        };
+    }
+
+    // Single producer, single consumer ring of fixed size slots, written and read in place.
+    template <typename _T, CLsize_t _Capacity>
+    class LuaSpscRing
+    {
+        static_assert((_Capacity & (_Capacity - 1)) == 0, "the capacity has to be a power of two");
+
+    public:
+        LuaSpscRing()
+            : m_head(0)
+            , m_tail(0)
+        {}
+
+        // producer only, the slot to fill or nullptr when full, published by Commit
+        _T* Reserve()
+        {
+            const auto head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) == _Capacity)
+            {
+                return nullptr;
+            }
+            return &m_slots[head & c_mask];
+        }
+
+        void Commit()
+        {
+            m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // consumer only, the oldest slot or nullptr when empty, released by Pop
+        const _T* Front() const
+        {
+            const auto tail = m_tail.load(std::memory_order_relaxed);
+            if (tail == m_head.load(std::memory_order_acquire))
+            {
+                return nullptr;
+            }
+            return &m_slots[tail & c_mask];
+        }
+
+        void Pop()
+        {
+            m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        static constexpr CLsize_t c_mask = _Capacity - 1;
+
+        alignas(64) std::atomic<CLsize_t>   m_head;
+        alignas(64) std::atomic<CLsize_t>   m_tail;
+        _T                                  m_slots[_Capacity];
+    };
+
+    // Sampling profiler for the Lua code a state runs, with output for flamegraphs.
+    //
+    //   LuaProfiler profiler(state);
+    //   profiler.Start(1000);
+    //   state.PCall(...);
+    //   profiler.Stop();
+    //   profiler.WriteCollapsed("profile.folded");   // flamegraph.pl profile.folded > profile.svg
+    //
+    // At every tick a timer thread sends SIGPROF to the state's thread. Like lua.c does for SIGINT, the
+    // handler arms a count hook with a count of one, so the hook is only ever set on the state's own
+    // thread. At its next instruction the state walks its stack once, writes the collapsed stack into a
+    // lock-free SPSC ring and removes the hook again, so between samples the VM runs without any hook.
+    // Windows has no signals, there Start installs a count hook that runs every c_hookInstructions
+    // instructions until Stop and samples once the timer thread flagged a tick, which makes the VM
+    // noticeably slower while profiling. Either way the timer thread never calls into the state, it
+    // only drains the ring and counts identical stacks.
+    // Frames are "name source:line" for Lua functions and "[C] name" for C functions, bindings included,
+    // root first. Functions called from C++ have no name in Lua and show up as "?".
+    // A state that isn't running Lua isn't sampled, time spent in host code shows up on the calling
+    // frame when it returns. Only the main thread is hooked: coroutines and LuaScheduler tasks aren't
+    // sampled, their time shows up on the frame that resumed them.
+    // Ticks are skipped while the state has someone else's hook installed (on Windows, when it had one
+    // at Start), that hook is never replaced. Start and Stop must be called on the state's thread, one
+    // running profiler per state and per thread, stopped before the state is closed. The SIGPROF
+    // handler stays installed once the first profiler started.
+    class LuaProfiler
+    {
+    public:
+        explicit LuaProfiler(LuaState& state);
+        LuaProfiler(const LuaProfiler&) = delete;
+        ~LuaProfiler();
+
+        CLbool      Start(CLsize_t samplesPerSecond = 1000); // false if already running
+        void        Stop();
+        CLbool      IsRunning() const { return m_timer.joinable(); }
+
+        void        Clear();
+
+        // one "root;...;leaf count" line per distinct stack, sorted
+        void        WriteCollapsed(Lua::String& out) const;
+        CLbool      WriteCollapsed(const CLchar* fileName) const;
+
+        Lua::ProfilerStats GetStats() const;
+
+    private:
+        static constexpr CLsize_t c_maxFrames = 64;
+        static constexpr CLsize_t c_ringSize = 64;
+#ifdef _WIN32
+        static constexpr CLint c_hookInstructions = 1000;
+#endif
+
+        struct Sample
+        {
+            CLsize_t    length;
+            CLchar      text[2048 - sizeof(CLsize_t)];
+        };
+
+        void        TimerLoop(std::chrono::nanoseconds period);
+        void        Drain();
+        void        TakeSample(lua_State* state);
+
+        // platform specific, Begin and EndTicks on the state's thread, PostTick on the timer thread
+        CLbool      BeginTicks();
+        void        EndTicks();
+        void        PostTick();
+
+        static void SampleHook(lua_State* state, lua_Debug* debug);
+#ifndef _WIN32
+        static void SignalHandler(CLint signal);
+#endif
+
+        lua_State*                          m_state;
+        LuaSpscRing<Sample, c_ringSize>     m_ring;
+
+        std::thread                         m_timer;
+        std::mutex                          m_timerMutex;
+        std::condition_variable             m_timerWakeup;
+        CLbool                              m_stopping;
+#ifdef _WIN32
+        CLbool                              m_hooked;
+        std::atomic<CLbool>                 m_tickPending;
+#else
+        pthread_t                           m_stateThread;
+#endif
+
+        mutable std::mutex                  m_stacksMutex;
+        Lua::UnorderedMap<Lua::String, CLsize_t> m_stacks;
+
+        std::atomic<CLsize_t>               m_samples;
+        std::atomic<CLsize_t>               m_dropped;
+        std::atomic<CLsize_t>               m_skipped;
+        std::atomic<CLsize_t>               m_truncated;
+        std::atomic<std::uint64_t>          m_hookNanoseconds;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_PROFILER_HEADER
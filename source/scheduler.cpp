@@ -0,0 +1,538 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "scheduler.h"
+
+#include <chrono>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // registry key of the scheduler owning the state, the preemption hook has no upvalues
+    const CLchar c_schedulerKey = 0;
+
+    CLsize_t RoundUpToPowerOfTwo(CLsize_t value)
+    {
+        CLsize_t result = 1;
+        while (result < value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+}
+
+Cloud::LuaScheduler::LuaScheduler(LuaStateEx& state, const Lua::SchedulerConfig& config)
+    : m_state(state.GetState())
+    , m_config(config)
+    , m_freeTasks(None)
+    , m_wheel(RoundUpToPowerOfTwo(config.wheelSlots > 0 ? config.wheelSlots : 1))
+    , m_now(0)
+    , m_running(None)
+    , m_preempted(false)
+{
+    lua_newtable(m_state);
+    m_threadsRef = luaL_ref(m_state, LUA_REGISTRYINDEX);
+
+    const auto existing = lua_rawgetp(m_state, LUA_REGISTRYINDEX, &c_schedulerKey);
+    LUACPP_ASSERT(existing == LUA_TNIL, "LuaScheduler: one scheduler per state");
+    LUACPP_UNUSED(existing);
+    lua_pop(m_state, 1);
+    lua_pushlightuserdata(m_state, this);
+    lua_rawsetp(m_state, LUA_REGISTRYINDEX, &c_schedulerKey);
+
+    const luaL_Reg functions[] =
+    {
+        { "sleep",  &LuaScheduler::LuaSleep },
+        { "wait",   &LuaScheduler::LuaWait },
+        { "signal", &LuaScheduler::LuaSignal },
+        { "yield",  &LuaScheduler::LuaYield },
+        { "now",    &LuaScheduler::LuaNow },
+        { "spawn",  &LuaScheduler::LuaSpawn },
+        { nullptr,  nullptr },
+    };
+
+    lua_createtable(m_state, 0, 6);
+    lua_pushlightuserdata(m_state, this);
+    luaL_setfuncs(m_state, functions, 1);
+    lua_setglobal(m_state, m_config.globalName);
+}
+
+Cloud::LuaScheduler::~LuaScheduler()
+{
+    // ready, sleeping and waiting tasks alike, their threads go with the table
+    for (CLsize_t slot = 0; slot < m_tasks.size(); ++slot)
+    {
+        if (m_tasks[slot].thread)
+        {
+            lua_sethook(m_tasks[slot].thread, nullptr, 0, 0);
+            FreeTask(slot);
+        }
+    }
+    m_events.clear();
+    luaL_unref(m_state, LUA_REGISTRYINDEX, m_threadsRef);
+
+    // functions scripts kept, e.g. local sleep = scheduler.sleep, check this key in Self()
+
+    lua_pushnil(m_state);
+    lua_rawsetp(m_state, LUA_REGISTRYINDEX, &c_schedulerKey);
+    lua_pushnil(m_state);
+    lua_setglobal(m_state, m_config.globalName);
+}
+
+CLbool Cloud::LuaScheduler::Cancel(Lua::TaskId task)
+{
+    const auto slot = FindTask(task);
+    if (slot == None || slot == m_running)
+    {
+        return false;
+    }
+
+    FreeTask(slot);
+    return true;
+}
+
+Cloud::Lua::EventId Cloud::LuaScheduler::CreateEvent()
+{
+    m_events.emplace_back();
+    return m_events.size() - 1;
+}
+
+CLsize_t Cloud::LuaScheduler::Signal(Lua::EventId event)
+{
+    LUACPP_ASSERT(event < m_events.size(), "LuaScheduler: unknown event");
+
+    CLsize_t woken = 0;
+    for (auto slot = PopFront(m_events[event]); slot != None; slot = PopFront(m_events[event]))
+    {
+        MakeReady(slot);
+        ++woken;
+    }
+    return woken;
+}
+
+CLsize_t Cloud::LuaScheduler::Run()
+{
+    const auto count = m_ready.size;
+
+    CLsize_t resumed = 0;
+    for (; resumed < count && m_ready.size > 0; ++resumed)
+    {
+        Resume(PopFront(m_ready));
+    }
+    return resumed;
+}
+
+CLsize_t Cloud::LuaScheduler::Update(std::uint64_t ticks)
+{
+    const auto mask = m_wheel.size() - 1;
+    const auto target = m_now + ticks;
+
+    const auto wake = [this](List& bucket)
+    {
+        for (auto slot = bucket.head; slot != None;)
+        {
+            const auto next = m_tasks[slot].next;
+            if (m_tasks[slot].wakeTick <= m_now)
+            {
+                Unlink(slot);
+                MakeReady(slot);
+            }
+            slot = next;
+        }
+    };
+
+    if (ticks >= m_wheel.size())
+    {
+        // a full turn or more, every bucket has to be looked at once
+        m_now = target;
+        for (auto& bucket : m_wheel)
+        {
+            wake(bucket);
+        }
+    }
+    else
+    {
+        while (m_now < target)
+        {
+            ++m_now;
+            wake(m_wheel[m_now & mask]);
+        }
+    }
+
+    return Run();
+}
+
+Cloud::Lua::TaskStats Cloud::LuaScheduler::GetTaskStats(Lua::TaskId task) const
+{
+    const auto slot = FindTask(task);
+    return slot != None ? m_tasks[slot].stats : Lua::TaskStats();
+}
+
+Cloud::Lua::SchedulerStats Cloud::LuaScheduler::GetStats() const
+{
+    auto stats = m_stats;
+    stats.ready = m_ready.size;
+    for (const auto& bucket : m_wheel)
+    {
+        stats.sleeping += bucket.size;
+    }
+    for (const auto& event : m_events)
+    {
+        stats.waiting += event.size;
+    }
+    return stats;
+}
+
+CLsize_t Cloud::LuaScheduler::NewTask(lua_State* state, CLint functionIndex)
+{
+    functionIndex = lua_absindex(state, functionIndex);
+
+    CLsize_t slot = m_freeTasks;
+    if (slot != None)
+    {
+        m_freeTasks = m_tasks[slot].next;
+    }
+    else
+    {
+        slot = m_tasks.size();
+        m_tasks.emplace_back();
+    }
+
+    auto* thread = lua_newthread(state);
+    lua_pushvalue(state, functionIndex);
+    lua_xmove(state, thread, 1);
+
+    lua_rawgeti(state, LUA_REGISTRYINDEX, m_threadsRef);
+    lua_insert(state, -2);
+    lua_rawseti(state, -2, static_cast<lua_Integer>(slot) + 1);
+    lua_pop(state, 1);
+
+    auto& task = m_tasks[slot];
+    task.thread = thread;
+    task.prev = None;
+    task.next = None;
+    task.list = nullptr;
+    task.pendingArgs = 0;
+    task.action = Action::None;
+    task.stats = Lua::TaskStats();
+
+    ++m_stats.tasks;
+    ++m_stats.spawned;
+    m_stats.peakTasks = m_stats.tasks > m_stats.peakTasks ? m_stats.tasks : m_stats.peakTasks;
+
+    MakeReady(slot);
+    return slot;
+}
+
+void Cloud::LuaScheduler::FreeTask(CLsize_t slot)
+{
+    auto& task = m_tasks[slot];
+    if (task.list)
+    {
+        Unlink(slot);
+    }
+
+    lua_rawgeti(m_state, LUA_REGISTRYINDEX, m_threadsRef);
+    lua_pushnil(m_state);
+    lua_rawseti(m_state, -2, static_cast<lua_Integer>(slot) + 1);
+    lua_pop(m_state, 1);
+
+    task.thread = nullptr;
+    task.stats.state = Lua::TaskState::Finished;
+    ++task.generation;
+    task.next = m_freeTasks;
+    m_freeTasks = slot;
+
+    --m_stats.tasks;
+}
+
+CLsize_t Cloud::LuaScheduler::FindTask(Lua::TaskId task) const
+{
+    const auto slot = static_cast<CLsize_t>(task & 0xffffffffu);
+    const auto generation = static_cast<std::uint32_t>(task >> 32);
+
+    if (slot >= m_tasks.size() || !m_tasks[slot].thread || m_tasks[slot].generation != generation)
+    {
+        return None;
+    }
+    return slot;
+}
+
+Cloud::Lua::TaskId Cloud::LuaScheduler::MakeId(CLsize_t slot) const
+{
+    return (static_cast<Lua::TaskId>(m_tasks[slot].generation) << 32) | static_cast<Lua::TaskId>(slot);
+}
+
+void Cloud::LuaScheduler::PushBack(List& list, CLsize_t slot)
+{
+    auto& task = m_tasks[slot];
+    task.list = &list;
+    task.prev = list.tail;
+    task.next = None;
+
+    if (list.tail != None)
+    {
+        m_tasks[list.tail].next = slot;
+    }
+    else
+    {
+        list.head = slot;
+    }
+    list.tail = slot;
+    ++list.size;
+}
+
+CLsize_t Cloud::LuaScheduler::PopFront(List& list)
+{
+    const auto slot = list.head;
+    if (slot != None)
+    {
+        Unlink(slot);
+    }
+    return slot;
+}
+
+void Cloud::LuaScheduler::Unlink(CLsize_t slot)
+{
+    auto& task = m_tasks[slot];
+    auto& list = *task.list;
+
+    if (task.prev != None)
+    {
+        m_tasks[task.prev].next = task.next;
+    }
+    else
+    {
+        list.head = task.next;
+    }
+
+    if (task.next != None)
+    {
+        m_tasks[task.next].prev = task.prev;
+    }
+    else
+    {
+        list.tail = task.prev;
+    }
+
+    --list.size;
+    task.list = nullptr;
+    task.prev = None;
+    task.next = None;
+}
+
+void Cloud::LuaScheduler::MakeReady(CLsize_t slot)
+{
+    m_tasks[slot].stats.state = Lua::TaskState::Ready;
+    PushBack(m_ready, slot);
+}
+
+void Cloud::LuaScheduler::Schedule(CLsize_t slot, std::uint64_t wakeTick)
+{
+    if (wakeTick <= m_now)
+    {
+        MakeReady(slot);
+        return;
+    }
+
+    auto& task = m_tasks[slot];
+    task.wakeTick = wakeTick;
+    task.stats.state = Lua::TaskState::Sleeping;
+    PushBack(m_wheel[wakeTick & (m_wheel.size() - 1)], slot);
+}
+
+void Cloud::LuaScheduler::Resume(CLsize_t slot)
+{
+    auto* thread = m_tasks[slot].thread;
+    const auto argCount = m_tasks[slot].pendingArgs;
+
+    m_tasks[slot].pendingArgs = 0;
+    m_tasks[slot].action = Action::None;
+    m_tasks[slot].stats.state = Lua::TaskState::Running;
+    m_running = slot;
+    m_preempted = false;
+
+    // also restarts the instruction count
+    if (m_config.instructionBudget > 0)
+    {
+        lua_sethook(thread, &LuaScheduler::PreemptHook, LUA_MASKCOUNT, m_config.instructionBudget);
+    }
+
+    const auto start = Clock::now();
+    const auto status = lua_resume(thread, m_state, argCount);
+    const auto elapsed = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+
+    m_running = None;
+
+    // the task may have spawned others, m_tasks can have moved
+    auto& task = m_tasks[slot];
+    ++task.stats.resumes;
+    task.stats.runNanoseconds += elapsed;
+    ++m_stats.resumes;
+    m_stats.runNanoseconds += elapsed;
+
+    if (status == LUA_YIELD)
+    {
+        lua_settop(thread, 0);
+
+        switch (task.action)
+        {
+        case Action::Sleep:
+            Schedule(slot, task.wakeTick);
+            break;
+        case Action::Wait:
+            task.stats.state = Lua::TaskState::Waiting;
+            PushBack(m_events[task.event], slot);
+            break;
+        default:
+            if (m_preempted)
+            {
+                ++task.stats.preemptions;
+                ++m_stats.preemptions;
+            }
+            MakeReady(slot);
+            break;
+        }
+        return;
+    }
+
+    if (status == LUA_OK)
+    {
+        ++m_stats.completed;
+    }
+    else
+    {
+        ++m_stats.failed;
+        LUACPP_TRACE("Lua scheduler task error:\n%s", lua_isstring(thread, -1) ? lua_tostring(thread, -1) : "<no message>");
+    }
+
+    FreeTask(slot);
+}
+
+Cloud::LuaScheduler* Cloud::LuaScheduler::Self(lua_State* state)
+{
+    auto* scheduler = lua_touserdata(state, lua_upvalueindex(1));
+
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &c_schedulerKey);
+    const auto* registered = lua_touserdata(state, -1);
+    lua_pop(state, 1);
+
+    if (registered != scheduler)
+    {
+        luaL_error(state, "the scheduler these functions belong to was destroyed");
+    }
+    return static_cast<LuaScheduler*>(scheduler);
+}
+
+CLsize_t Cloud::LuaScheduler::CurrentTask(lua_State* state, LuaScheduler* scheduler)
+{
+    if (scheduler->m_running == None || scheduler->m_tasks[scheduler->m_running].thread != state)
+    {
+        luaL_error(state, "only tasks run by the scheduler can suspend through it");
+    }
+    return scheduler->m_running;
+}
+
+int Cloud::LuaScheduler::LuaSleep(lua_State* state)
+{
+    auto* scheduler = Self(state);
+    const auto ticks = luaL_checkinteger(state, 1);
+    auto& task = scheduler->m_tasks[CurrentTask(state, scheduler)];
+
+    task.action = Action::Sleep;
+    task.wakeTick = scheduler->m_now + static_cast<std::uint64_t>(ticks > 0 ? ticks : 0);
+    return lua_yield(state, 0);
+}
+
+int Cloud::LuaScheduler::LuaWait(lua_State* state)
+{
+    auto* scheduler = Self(state);
+    const auto event = luaL_checkinteger(state, 1);
+    luaL_argcheck(state, event >= 0 && static_cast<CLsize_t>(event) < scheduler->m_events.size(), 1, "unknown event");
+    auto& task = scheduler->m_tasks[CurrentTask(state, scheduler)];
+
+    task.action = Action::Wait;
+    task.event = static_cast<Lua::EventId>(event);
+    return lua_yield(state, 0);
+}
+
+int Cloud::LuaScheduler::LuaSignal(lua_State* state)
+{
+    auto* scheduler = Self(state);
+    const auto event = luaL_checkinteger(state, 1);
+    luaL_argcheck(state, event >= 0 && static_cast<CLsize_t>(event) < scheduler->m_events.size(), 1, "unknown event");
+
+    lua_pushinteger(state, static_cast<lua_Integer>(scheduler->Signal(static_cast<Lua::EventId>(event))));
+    return 1;
+}
+
+int Cloud::LuaScheduler::LuaYield(lua_State* state)
+{
+    auto* scheduler = Self(state);
+    scheduler->m_tasks[CurrentTask(state, scheduler)].action = Action::Yield;
+    return lua_yield(state, 0);
+}
+
+int Cloud::LuaScheduler::LuaNow(lua_State* state)
+{
+    lua_pushinteger(state, static_cast<lua_Integer>(Self(state)->m_now));
+    return 1;
+}
+
+// scheduler.spawn(f, ...) -> task id
+int Cloud::LuaScheduler::LuaSpawn(lua_State* state)
+{
+    auto* scheduler = Self(state);
+    luaL_checktype(state, 1, LUA_TFUNCTION);
+    const auto argCount = lua_gettop(state) - 1;
+
+    const auto slot = scheduler->NewTask(state, 1);
+    auto* thread = scheduler->m_tasks[slot].thread;
+    lua_checkstack(thread, argCount);
+    lua_xmove(state, thread, argCount);
+    scheduler->m_tasks[slot].pendingArgs = argCount;
+
+    lua_pushinteger(state, static_cast<lua_Integer>(scheduler->MakeId(slot)));
+    return 1;
+}
+
+void Cloud::LuaScheduler::PreemptHook(lua_State* state, lua_Debug* debug)
+{
+    if (debug->event != LUA_HOOKCOUNT)
+    {
+        return;
+    }
+
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &c_schedulerKey);
+    auto* scheduler = static_cast<LuaScheduler*>(lua_touserdata(state, -1));
+    lua_pop(state, 1);
+
+    // coroutines created inside a task inherit the hook, they must only yield to their own resumer
+    if (!scheduler || scheduler->m_running == None || scheduler->m_tasks[scheduler->m_running].thread != state)
+    {
+        lua_sethook(state, nullptr, 0, 0);
+        return;
+    }
+
+    if (lua_isyieldable(state))
+    {
+        scheduler->m_preempted = true;
+        lua_yield(state, 0);
+    }
+}
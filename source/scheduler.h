@@ -0,0 +1,210 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_SCHEDULER_HEADER
+#define CLOUD_LUA_CPP_SCHEDULER_HEADER
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "state_ex.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        using TaskId = std::uint64_t;   // slot and generation, stale ids are recognised
+        using EventId = CLsize_t;
+
+        enum class TaskState : CLchar
+        {
+            Ready,      // in the run queue
+            Running,
+            Sleeping,   // in the timer wheel
+            Waiting,    // on an event
+            Finished,   // returned, failed or cancelled, the id is no longer valid
+        };
+
+        struct SchedulerConfig
+        {
+            CLint       instructionBudget   = 10000; // VM instructions before a task is preempted, 0 runs tasks until they yield
+            CLsize_t    wheelSlots          = 256;   // rounded up to a power of two, sleeps up to this many ticks are O(1)
+            const CLchar* globalName        = "scheduler";
+        };
+
+        struct SchedulerStats
+        {
+            CLsize_t    tasks           = 0;
+            CLsize_t    ready           = 0; // queue depth
+            CLsize_t    sleeping        = 0;
+            CLsize_t    waiting         = 0;
+            CLsize_t    peakTasks       = 0;
+            CLsize_t    spawned         = 0;
+            CLsize_t    resumes         = 0;
+            CLsize_t    preemptions     = 0;
+            CLsize_t    completed       = 0;
+            CLsize_t    failed          = 0;
+            double      runNanoseconds  = 0.0; // wall time spent inside resumes, all tasks
+        };
+
+        struct TaskStats
+        {
+            TaskState   state           = TaskState::Finished;
+            CLsize_t    resumes         = 0;
+            CLsize_t    preemptions     = 0;
+            double      runNanoseconds  = 0.0; // wall time, includes blocking host calls
+        };
+    }
+
+    // Runs many Lua functions as coroutines of one LuaStateEx, cooperatively and fairly.
+    //
+    //   LuaScheduler scheduler(state);
+    //   scheduler.Spawn("actor", 42);
+    //   while (running) scheduler.Update(1);  // one tick, e.g. a frame or a millisecond
+    //
+    // Lua side, in the global table named by the config:
+    //   scheduler.sleep(ticks)     scheduler.wait(event)   scheduler.signal(event)
+    //   scheduler.yield()          scheduler.now()         scheduler.spawn(f, ...)
+    //
+    // Tasks live in a slot array and move between the run queue, the buckets of a hashed timer wheel
+    // and per-event wait lists, all intrusive lists over slot indices, so resuming, sleeping and waking
+    // never allocate. Fairness comes from a count hook on every task's thread that yields after
+    // instructionBudget instructions (when the task is yieldable), the task goes to the back of the queue.
+    // A plain coroutine.yield does the same. A task costs a lua_State and its stack, about 1 KB.
+    // Must be destroyed before the state.
+    class LuaScheduler
+    {
+    public:
+        explicit LuaScheduler(LuaStateEx& state, const Lua::SchedulerConfig& config = Lua::SchedulerConfig());
+        LuaScheduler(const LuaScheduler&) = delete;
+        ~LuaScheduler();
+
+        // runs the global function with args as a new task, 0 if the global isn't a function or an
+        // argument is of a user type that isn't registered
+        template <typename... _Args>
+        Lua::TaskId Spawn(const CLchar* functionName, _Args&&... args)
+        {
+            if (!(LuaHostStack<std::decay_t<_Args>>::CanPush(m_state) && ...))
+            {
+                return 0;
+            }
+
+            if (lua_getglobal(m_state, functionName) != LUA_TFUNCTION)
+            {
+                lua_pop(m_state, 1);
+                return 0;
+            }
+
+            const auto slot = NewTask(m_state, -1);
+            lua_pop(m_state, 1);
+
+            auto* thread = m_tasks[slot].thread;
+            lua_checkstack(thread, static_cast<CLint>(sizeof...(_Args)));
+            (LuaStack<std::decay_t<_Args>>::Push(thread, args), ...);
+            m_tasks[slot].pendingArgs = static_cast<CLint>(sizeof...(_Args));
+
+            return MakeId(slot);
+        }
+
+        CLbool          Cancel(Lua::TaskId task);
+
+        Lua::EventId    CreateEvent();
+        CLsize_t        Signal(Lua::EventId event);   // wakes every waiter, returns how many
+
+        // resumes the tasks that are ready now once each (tasks requeued meanwhile wait for the next call)
+        CLsize_t        Run();
+        // moves the clock ticks forward, wakes the sleepers that are due and runs
+        CLsize_t        Update(std::uint64_t ticks);
+
+        std::uint64_t   GetNow() const { return m_now; }
+
+        Lua::TaskStats      GetTaskStats(Lua::TaskId task) const;
+        Lua::SchedulerStats GetStats() const;
+
+    private:
+        static constexpr CLsize_t None = ~CLsize_t(0);
+
+        enum class Action : CLchar
+        {
+            None,
+            Yield,
+            Sleep,
+            Wait,
+        };
+
+        struct List
+        {
+            CLsize_t    head = None;
+            CLsize_t    tail = None;
+            CLsize_t    size = 0;
+        };
+
+        struct Task
+        {
+            lua_State*      thread      = nullptr;
+            CLsize_t        prev        = None;
+            CLsize_t        next        = None;     // also the free list
+            List*           list        = nullptr;
+            std::uint64_t   wakeTick    = 0;
+            Lua::EventId    event       = 0;
+            CLint           pendingArgs = 0;
+            std::uint32_t   generation  = 1;
+            Action          action      = Action::None;
+            Lua::TaskStats  stats;      // stats.state is the task's state
+        };
+
+        CLsize_t        NewTask(lua_State* state, CLint functionIndex);
+        void            FreeTask(CLsize_t slot);
+        CLsize_t        FindTask(Lua::TaskId task) const;
+        Lua::TaskId     MakeId(CLsize_t slot) const;
+
+        void            PushBack(List& list, CLsize_t slot);
+        CLsize_t        PopFront(List& list);
+        void            Unlink(CLsize_t slot);
+
+        void            MakeReady(CLsize_t slot);
+        void            Schedule(CLsize_t slot, std::uint64_t wakeTick);
+        void            Resume(CLsize_t slot);
+
+        // Lua API, the upvalue is the scheduler, raises a Lua error once it's destroyed
+        static LuaScheduler* Self(lua_State* state);
+        static CLsize_t CurrentTask(lua_State* state, LuaScheduler* scheduler);
+        static int      LuaSleep(lua_State* state);
+        static int      LuaWait(lua_State* state);
+        static int      LuaSignal(lua_State* state);
+        static int      LuaYield(lua_State* state);
+        static int      LuaNow(lua_State* state);
+        static int      LuaSpawn(lua_State* state);
+        static void     PreemptHook(lua_State* state, lua_Debug* debug);
+
+        lua_State*              m_state;
+        Lua::SchedulerConfig    m_config;
+        CLint                   m_threadsRef;   // registry table: slot + 1 -> thread
+
+        std::vector<Task>       m_tasks;
+        CLsize_t                m_freeTasks;
+        List                    m_ready;
+        std::vector<List>       m_wheel;
+        std::deque<List>        m_events;       // a deque, tasks point at their list
+        std::uint64_t           m_now;
+        CLsize_t                m_running;
+        CLbool                  m_preempted;
+        Lua::SchedulerStats     m_stats;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_SCHEDULER_HEADER
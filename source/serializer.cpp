@@ -0,0 +1,439 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "serializer.h"
+
+#include <cstring>
+
+namespace
+{
+    enum Tag : unsigned char
+    {
+        TagNil          = 0x00,
+        TagFalse        = 0x01,
+        TagTrue         = 0x02,
+        TagInteger      = 0x03,     // zigzag varint
+        TagNumber       = 0x04,     // 8 bytes
+        TagString       = 0x05,     // varint length, bytes
+        TagTable        = 0x06,     // varint array length, varint hash count, values, pairs
+        TagReference    = 0x07,     // varint index of a table decoded before
+        TagSmallInteger = 0x20,     // | 0..31
+        TagShortString  = 0x40,     // | length 0..63, bytes
+    };
+
+    constexpr lua_Integer c_smallIntegerLimit = 32;
+    constexpr CLsize_t c_shortStringLimit = 64;
+
+    void WriteVarint(Cloud::Lua::String& out, std::uint64_t value)
+    {
+        CLchar bytes[10];
+        CLsize_t count = 0;
+        while (value >= 0x80)
+        {
+            bytes[count++] = static_cast<CLchar>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        bytes[count++] = static_cast<CLchar>(value);
+        out.append(bytes, count);
+    }
+
+    class Encoder
+    {
+    public:
+        Encoder(lua_State* state, Cloud::Lua::String& out)
+            : m_state(state)
+            , m_out(out)
+            , m_tables(0)
+        {
+            // seen tables -> index, on the stack for the duration of the encode
+            lua_newtable(state);
+            m_seenIndex = lua_gettop(state);
+        }
+
+        ~Encoder()
+        {
+            lua_remove(m_state, m_seenIndex);
+        }
+
+        CLbool Write(CLint index, CLint depth)
+        {
+            switch (lua_type(m_state, index))
+            {
+            case LUA_TNIL:
+                m_out.push_back(static_cast<CLchar>(TagNil));
+                return true;
+
+            case LUA_TBOOLEAN:
+                m_out.push_back(static_cast<CLchar>(lua_toboolean(m_state, index) ? TagTrue : TagFalse));
+                return true;
+
+            case LUA_TNUMBER:
+                if (lua_isinteger(m_state, index))
+                {
+                    const auto value = lua_tointeger(m_state, index);
+                    if (value >= 0 && value < c_smallIntegerLimit)
+                    {
+                        m_out.push_back(static_cast<CLchar>(TagSmallInteger | value));
+                    }
+                    else
+                    {
+                        const auto bits = static_cast<std::uint64_t>(value);
+                        m_out.push_back(static_cast<CLchar>(TagInteger));
+                        WriteVarint(m_out, (bits << 1) ^ (value < 0 ? ~std::uint64_t(0) : 0));
+                    }
+                }
+                else
+                {
+                    const auto value = lua_tonumber(m_state, index);
+                    CLchar bytes[sizeof(lua_Number)];
+                    std::memcpy(bytes, &value, sizeof(value));
+                    m_out.push_back(static_cast<CLchar>(TagNumber));
+                    m_out.append(bytes, sizeof(bytes));
+                }
+                return true;
+
+            case LUA_TSTRING:
+            {
+                CLsize_t length = 0;
+                const auto* string = lua_tolstring(m_state, index, &length);
+                if (length < c_shortStringLimit)
+                {
+                    m_out.push_back(static_cast<CLchar>(TagShortString | length));
+                }
+                else
+                {
+                    m_out.push_back(static_cast<CLchar>(TagString));
+                    WriteVarint(m_out, length);
+                }
+                m_out.append(string, length);
+                return true;
+            }
+
+            case LUA_TTABLE:
+                return WriteTable(index, depth);
+
+            default:
+                return false;
+            }
+        }
+
+    private:
+        CLbool WriteTable(CLint index, CLint depth)
+        {
+            index = lua_absindex(m_state, index);
+
+            lua_pushvalue(m_state, index);
+            if (lua_rawget(m_state, m_seenIndex) == LUA_TNUMBER)
+            {
+                m_out.push_back(static_cast<CLchar>(TagReference));
+                WriteVarint(m_out, static_cast<std::uint64_t>(lua_tointeger(m_state, -1)));
+                lua_pop(m_state, 1);
+                return true;
+            }
+            lua_pop(m_state, 1);
+
+            if (depth >= Cloud::Lua::c_maxSerializeDepth || !lua_checkstack(m_state, 4))
+            {
+                return false;
+            }
+
+            // the decoder numbers tables in the same order
+            lua_pushvalue(m_state, index);
+            lua_pushinteger(m_state, static_cast<lua_Integer>(m_tables++));
+            lua_rawset(m_state, m_seenIndex);
+
+            const auto arrayLength = static_cast<lua_Integer>(lua_rawlen(m_state, index));
+
+            std::uint64_t hashCount = 0;
+            lua_pushnil(m_state);
+            while (lua_next(m_state, index) != 0)
+            {
+                lua_pop(m_state, 1);
+                hashCount += IsArrayKey(-1, arrayLength) ? 0 : 1;
+            }
+
+            m_out.push_back(static_cast<CLchar>(TagTable));
+            WriteVarint(m_out, static_cast<std::uint64_t>(arrayLength));
+            WriteVarint(m_out, hashCount);
+
+            for (lua_Integer i = 1; i <= arrayLength; ++i)
+            {
+                lua_rawgeti(m_state, index, i);
+                const auto written = Write(-1, depth + 1);
+                lua_pop(m_state, 1);
+                if (!written)
+                {
+                    return false;
+                }
+            }
+
+            lua_pushnil(m_state);
+            while (lua_next(m_state, index) != 0)
+            {
+                if (!IsArrayKey(-2, arrayLength) && (!Write(-2, depth + 1) || !Write(-1, depth + 1)))
+                {
+                    lua_pop(m_state, 2);
+                    return false;
+                }
+                lua_pop(m_state, 1);
+            }
+
+            return true;
+        }
+
+        CLbool IsArrayKey(CLint index, lua_Integer arrayLength) const
+        {
+            if (!lua_isinteger(m_state, index))
+            {
+                return false;
+            }
+            const auto key = lua_tointeger(m_state, index);
+            return key >= 1 && key <= arrayLength;
+        }
+
+        lua_State*          m_state;
+        Cloud::Lua::String& m_out;
+        CLint               m_seenIndex;
+        CLsize_t            m_tables;
+    };
+
+    class Decoder
+    {
+    public:
+        Decoder(lua_State* state, const CLchar* data, CLsize_t size)
+            : m_state(state)
+            , m_data(reinterpret_cast<const unsigned char*>(data))
+            , m_size(size)
+            , m_position(0)
+            , m_tables(0)
+            , m_slotBudget(size)
+        {
+            // decoded tables in order, 1 based, for the back-references
+            lua_newtable(state);
+            m_tablesIndex = lua_gettop(state);
+        }
+
+        ~Decoder()
+        {
+            lua_remove(m_state, m_tablesIndex);
+        }
+
+        CLsize_t GetPosition() const { return m_position; }
+
+        // pushes one value, on failure the stack may hold partial results, the caller resets it
+        CLbool Read(CLint depth)
+        {
+            if (m_position >= m_size || !lua_checkstack(m_state, 3))
+            {
+                return false;
+            }
+
+            const auto tag = m_data[m_position++];
+            if (tag >= TagShortString)
+            {
+                return ReadString(tag & 0x3f);
+            }
+            if (tag >= TagSmallInteger)
+            {
+                lua_pushinteger(m_state, tag & 0x1f);
+                return true;
+            }
+
+            std::uint64_t value = 0;
+            switch (tag)
+            {
+            case TagNil:
+                lua_pushnil(m_state);
+                return true;
+
+            case TagFalse:
+            case TagTrue:
+                lua_pushboolean(m_state, tag == TagTrue);
+                return true;
+
+            case TagInteger:
+                if (!ReadVarint(value))
+                {
+                    return false;
+                }
+                lua_pushinteger(m_state, static_cast<lua_Integer>((value >> 1) ^ (~(value & 1) + 1)));
+                return true;
+
+            case TagNumber:
+            {
+                lua_Number number;
+                if (m_size - m_position < sizeof(number))
+                {
+                    return false;
+                }
+                std::memcpy(&number, m_data + m_position, sizeof(number));
+                m_position += sizeof(number);
+                lua_pushnumber(m_state, number);
+                return true;
+            }
+
+            case TagString:
+                return ReadVarint(value) && ReadString(value);
+
+            case TagTable:
+                return ReadTable(depth);
+
+            case TagReference:
+                if (!ReadVarint(value) || value >= m_tables)
+                {
+                    return false;
+                }
+                lua_rawgeti(m_state, m_tablesIndex, static_cast<lua_Integer>(value) + 1);
+                return true;
+
+            default:
+                return false;
+            }
+        }
+
+    private:
+        CLbool ReadVarint(std::uint64_t& value)
+        {
+            value = 0;
+            for (CLint shift = 0; shift < 64 && m_position < m_size; shift += 7)
+            {
+                const auto byte = m_data[m_position++];
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        CLbool ReadString(std::uint64_t length)
+        {
+            if (length > m_size - m_position)
+            {
+                return false;
+            }
+            lua_pushlstring(m_state, reinterpret_cast<const CLchar*>(m_data + m_position), static_cast<CLsize_t>(length));
+            m_position += static_cast<CLsize_t>(length);
+            return true;
+        }
+
+        CLbool ReadTable(CLint depth)
+        {
+            std::uint64_t arrayLength = 0;
+            std::uint64_t hashCount = 0;
+            if (depth >= Cloud::Lua::c_maxSerializeDepth || !ReadVarint(arrayLength) || !ReadVarint(hashCount))
+            {
+                return false;
+            }
+
+            // every value starts with its own tag byte, so all tables of the input together can't claim more
+            // slots than there are bytes, a hash slot taking two; larger counts are malformed and mustn't be allocated
+            if (arrayLength > m_slotBudget || hashCount > (m_slotBudget - arrayLength) / 2)
+            {
+                return false;
+            }
+            m_slotBudget -= arrayLength + hashCount * 2;
+
+            lua_createtable(m_state, static_cast<CLint>(arrayLength), static_cast<CLint>(hashCount));
+            const auto table = lua_gettop(m_state);
+            lua_pushvalue(m_state, table);
+            lua_rawseti(m_state, m_tablesIndex, static_cast<lua_Integer>(++m_tables));
+
+            for (std::uint64_t i = 1; i <= arrayLength; ++i)
+            {
+                if (!Read(depth + 1))
+                {
+                    return false;
+                }
+                lua_rawseti(m_state, table, static_cast<lua_Integer>(i));
+            }
+
+            for (std::uint64_t i = 0; i < hashCount; ++i)
+            {
+                if (!Read(depth + 1) || !Read(depth + 1))
+                {
+                    return false;
+                }
+
+                // nil and NaN keys can only come from corrupt data, lua_rawset would raise an error
+                if (lua_isnil(m_state, -2) || (lua_type(m_state, -2) == LUA_TNUMBER && lua_tonumber(m_state, -2) != lua_tonumber(m_state, -2)))
+                {
+                    return false;
+                }
+                lua_rawset(m_state, table);
+            }
+
+            return true;
+        }
+
+        lua_State*              m_state;
+        const unsigned char*    m_data;
+        CLsize_t                m_size;
+        CLsize_t                m_position;
+        CLint                   m_tablesIndex;
+        std::uint64_t           m_tables;
+        std::uint64_t           m_slotBudget;
+    };
+}
+
+CLbool Cloud::Lua::Serialize(lua_State* state, CLint stackIndex, String& buffer)
+{
+    stackIndex = lua_absindex(state, stackIndex);
+    const auto top = lua_gettop(state);
+    const auto start = buffer.size();
+
+    CLbool written;
+    {
+        Encoder encoder(state, buffer);
+        written = encoder.Write(stackIndex, 0);
+    }
+
+    lua_settop(state, top);
+    if (!written)
+    {
+        buffer.resize(start);
+    }
+    return written;
+}
+
+CLbool Cloud::Lua::Deserialize(lua_State* state, const CLchar* data, CLsize_t size, CLsize_t* consumed)
+{
+    const auto top = lua_gettop(state);
+
+    CLbool read;
+    CLsize_t position;
+    {
+        Decoder decoder(state, data, size);
+        read = decoder.Read(0);
+        position = decoder.GetPosition();
+    }
+
+    // the decoder removed its table from below the value
+
+    if (!read)
+    {
+        lua_settop(state, top);
+        return false;
+    }
+
+    if (consumed)
+    {
+        *consumed = position;
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_SERIALIZER_HEADER
+#define CLOUD_LUA_CPP_SERIALIZER_HEADER
+
+#include "luacpp.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        // Compact tagged binary encoding of Lua values, for moving data between states.
+        //
+        // One tag byte per value: nil, false, true, small integers (0..31) and short strings (up to 63 bytes)
+        // live in the tag itself, other integers are zigzag varints, floats 8 raw bytes, strings a varint
+        // length and the bytes. Integers and floats stay distinct. A table is its array length, its hash
+        // count, the array values and the remaining key/value pairs, so the decoder presizes it with
+        // lua_createtable. A table seen before is written as a back-reference, which keeps shared
+        // subtables shared and makes cycles work. Metatables aren't encoded.
+        // Floats are written in native byte order, like lua_dump the format is for this machine.
+        //
+        // Functions, userdata and threads can't be encoded, nor can tables nested deeper than c_maxSerializeDepth.
+
+        constexpr CLint c_maxSerializeDepth = 200;
+
+        // appends the value at stackIndex to buffer, false (buffer unchanged) if it can't be encoded
+        CLbool Serialize(lua_State* state, CLint stackIndex, String& buffer);
+
+        // pushes the value encoded at the start of data, false (nothing pushed) if the data is malformed.
+        // consumed receives the number of bytes read, several values can be stored back to back.
+        CLbool Deserialize(lua_State* state, const CLchar* data, CLsize_t size, CLsize_t* consumed = nullptr);
+    }
+}
+
+#endif // CLOUD_LUA_CPP_SERIALIZER_HEADER
@@ -0,0 +1,683 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "shared_data.h"
+
+#include <cstring>
+#include <new>
+
+namespace
+{
+    // registry keys
+    const CLchar c_metatableKey = 0;
+    const CLchar c_anchorMetatableKey = 0;
+    const CLchar c_proxiesKey = 0;
+
+    constexpr CLint c_maxDepth = 200;
+
+    std::uint64_t Mix(std::uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        value ^= value >> 33;
+        return value;
+    }
+}
+
+// a key as it is compared, strings point into the image or into a Lua string
+struct Cloud::LuaSharedData::Key
+{
+    ValueType       type    = ValueType::Nil;
+    std::uint64_t   bits    = 0;    // everything but strings
+    const CLchar*   string  = nullptr;
+    CLsize_t        length  = 0;
+
+    std::uint64_t Hash() const
+    {
+        return type == ValueType::String ? Lua::Fnv1a(string, length) : Mix(bits ^ (static_cast<std::uint64_t>(type) << 56));
+    }
+
+    CLbool operator==(const Key& other) const
+    {
+        if (type != other.type)
+        {
+            return false;
+        }
+
+        return type == ValueType::String
+            ? length == other.length && std::memcmp(string, other.string, length) == 0
+            : bits == other.bits;
+    }
+};
+
+class Cloud::LuaSharedData::Builder
+{
+public:
+    Builder(LuaSharedData& data, lua_State* state)
+        : m_data(data)
+        , m_state(state)
+    {
+    }
+
+    CLbool AddTable(CLint stackIndex, CLint depth, std::uint32_t& tableIndex)
+    {
+        const auto* pointer = lua_topointer(m_state, stackIndex);
+        const auto found = m_tables.find(pointer);
+        if (found != m_tables.end())
+        {
+            tableIndex = found->second;
+            return true;
+        }
+
+        if (depth > c_maxDepth || !lua_checkstack(m_state, 4))
+        {
+            return false;
+        }
+
+        tableIndex = static_cast<std::uint32_t>(m_data.m_tables.size());
+        m_data.m_tables.emplace_back();
+        m_tables.emplace(pointer, tableIndex);
+
+        // collected first, nested tables append to the image while these are encoded
+        const auto arrayCount = lua_rawlen(m_state, stackIndex);
+        std::vector<Value> values(arrayCount);
+        for (CLsize_t i = 0; i < arrayCount; ++i)
+        {
+            lua_rawgeti(m_state, stackIndex, static_cast<lua_Integer>(i + 1));
+            const auto encoded = Encode(-1, depth, values[i]);
+            lua_pop(m_state, 1);
+            if (!encoded)
+            {
+                return false;
+            }
+        }
+
+        std::vector<Entry> entries;
+        lua_pushnil(m_state);
+        while (lua_next(m_state, stackIndex) != 0)
+        {
+            if (lua_isinteger(m_state, -2))
+            {
+                const auto key = lua_tointeger(m_state, -2);
+                if (key >= 1 && static_cast<CLsize_t>(key) <= arrayCount)
+                {
+                    lua_pop(m_state, 1);
+                    continue;
+                }
+            }
+
+            Entry entry;
+            if (!Encode(-2, depth, entry.key) || !Encode(-1, depth, entry.value))
+            {
+                lua_pop(m_state, 2);
+                return false;
+            }
+
+            entries.push_back(entry);
+            lua_pop(m_state, 1);
+        }
+
+        auto& table = m_data.m_tables[tableIndex];
+        table.arrayBegin = static_cast<std::uint32_t>(m_data.m_values.size());
+        table.arrayCount = static_cast<std::uint32_t>(arrayCount);
+        m_data.m_values.insert(m_data.m_values.end(), values.begin(), values.end());
+
+        table.entryBegin = static_cast<std::uint32_t>(m_data.m_entries.size());
+        table.entryCount = static_cast<std::uint32_t>(entries.size());
+        m_data.m_entries.insert(m_data.m_entries.end(), entries.begin(), entries.end());
+
+        if (!entries.empty())
+        {
+            // at most half full, linear probing
+            std::uint32_t bucketCount = 2;
+            while (bucketCount < entries.size() * 2)
+            {
+                bucketCount <<= 1;
+            }
+
+            table.bucketBegin = static_cast<std::uint32_t>(m_data.m_buckets.size());
+            table.bucketMask = bucketCount - 1;
+            m_data.m_buckets.resize(m_data.m_buckets.size() + bucketCount, None);
+
+            auto* buckets = m_data.m_buckets.data() + table.bucketBegin;
+            for (std::uint32_t i = 0; i < table.entryCount; ++i)
+            {
+                auto bucket = m_data.GetKey(entries[i].key).Hash() & table.bucketMask;
+                while (buckets[bucket] != None)
+                {
+                    bucket = (bucket + 1) & table.bucketMask;
+                }
+                buckets[bucket] = i;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    CLbool Encode(CLint stackIndex, CLint depth, Value& value)
+    {
+        switch (lua_type(m_state, stackIndex))
+        {
+        case LUA_TNIL:
+            return true;
+
+        case LUA_TBOOLEAN:
+            value.type = ValueType::Boolean;
+            value.boolean = lua_toboolean(m_state, stackIndex) != 0;
+            return true;
+
+        case LUA_TNUMBER:
+            if (lua_isinteger(m_state, stackIndex))
+            {
+                value.type = ValueType::Integer;
+                value.integer = lua_tointeger(m_state, stackIndex);
+            }
+            else
+            {
+                value.type = ValueType::Number;
+                value.number = lua_tonumber(m_state, stackIndex);
+            }
+            return true;
+
+        case LUA_TSTRING:
+        {
+            CLsize_t length = 0;
+            const auto* string = lua_tolstring(m_state, stackIndex, &length);
+            if (length >= None)
+            {
+                return false;
+            }
+
+            // keys repeat in every record, stored once
+            const auto inserted = m_strings.emplace(Lua::String(string, length), m_data.m_strings.size());
+            if (inserted.second)
+            {
+                m_data.m_strings.append(string, length);
+            }
+
+            value.type = ValueType::String;
+            value.length = static_cast<std::uint32_t>(length);
+            value.offset = inserted.first->second;
+            return true;
+        }
+
+        case LUA_TTABLE:
+            value.type = ValueType::Table;
+            return AddTable(lua_absindex(m_state, stackIndex), depth + 1, value.table);
+
+        default:
+            return false;
+        }
+    }
+
+    LuaSharedData&                              m_data;
+    lua_State*                                  m_state;
+    Lua::UnorderedMap<const void*, std::uint32_t> m_tables;
+    Lua::UnorderedMap<Lua::String, CLsize_t>    m_strings;
+};
+
+Cloud::Lua::SharedPtr<const Cloud::LuaSharedData> Cloud::LuaSharedData::Create(lua_State* state, CLint stackIndex)
+{
+    if (lua_type(state, stackIndex) != LUA_TTABLE)
+    {
+        return nullptr;
+    }
+
+    const auto top = lua_gettop(state);
+    Lua::SharedPtr<LuaSharedData> data(new LuaSharedData());
+
+    std::uint32_t root = 0;
+    const auto built = Builder(*data, state).AddTable(lua_absindex(state, stackIndex), 0, root);
+    lua_settop(state, top);
+
+    if (!built || data->m_values.size() >= None || data->m_entries.size() >= None || data->m_buckets.size() >= None)
+    {
+        LUACPP_TRACE("LuaSharedData: the table holds values that can't be shared or is too large");
+        return nullptr;
+    }
+
+    data->m_tables.shrink_to_fit();
+    data->m_values.shrink_to_fit();
+    data->m_entries.shrink_to_fit();
+    data->m_buckets.shrink_to_fit();
+    data->m_strings.shrink_to_fit();
+    return data;
+}
+
+void Cloud::LuaSharedData::Push(lua_State* state, const Lua::SharedPtr<const LuaSharedData>& data)
+{
+    LUACPP_ASSERT(data, "LuaSharedData: pushing nothing");
+
+    if (lua_rawgetp(state, LUA_REGISTRYINDEX, &c_metatableKey) == LUA_TNIL)
+    {
+        lua_pop(state, 1);
+
+        lua_createtable(state, 0, 8);
+        lua_pushliteral(state, "LuaSharedTable");
+        lua_setfield(state, -2, "__name");
+        lua_pushvalue(state, -1);
+        lua_pushcclosure(state, &LuaSharedData::Index, 1);
+        lua_setfield(state, -2, "__index");
+        lua_pushcfunction(state, &LuaSharedData::NewIndex);
+        lua_setfield(state, -2, "__newindex");
+        lua_pushvalue(state, -1);
+        lua_pushcclosure(state, &LuaSharedData::Length, 1);
+        lua_setfield(state, -2, "__len");
+        lua_pushcfunction(state, &LuaSharedData::Pairs);
+        lua_setfield(state, -2, "__pairs");
+        lua_pushcfunction(state, &LuaSharedData::IPairs);
+        lua_setfield(state, -2, "__ipairs");
+        lua_pushcfunction(state, &LuaSharedData::ToString);
+        lua_setfield(state, -2, "__tostring");
+        // keeps scripts from replacing it, debug.getmetatable still hands out the metamethods, which
+        // check their first argument
+        lua_pushboolean(state, 0);
+        lua_setfield(state, -2, "__metatable");
+        lua_rawsetp(state, LUA_REGISTRYINDEX, &c_metatableKey);
+
+        lua_createtable(state, 0, 2);
+        lua_pushcfunction(state, &LuaSharedData::DestroyAnchor);
+        lua_setfield(state, -2, "__gc");
+        lua_rawsetp(state, LUA_REGISTRYINDEX, &c_anchorMetatableKey);
+
+        // image table -> proxy
+        lua_newtable(state);
+        lua_createtable(state, 0, 1);
+        lua_pushliteral(state, "v");
+        lua_setfield(state, -2, "__mode");
+        lua_setmetatable(state, -2);
+        lua_rawsetp(state, LUA_REGISTRYINDEX, &c_proxiesKey);
+    }
+    else
+    {
+        lua_pop(state, 1);
+    }
+
+    // one reference per state, the proxies point at the image directly
+    if (lua_rawgetp(state, LUA_REGISTRYINDEX, data.get()) == LUA_TNIL)
+    {
+        new (lua_newuserdata(state, sizeof(Lua::SharedPtr<const LuaSharedData>))) Lua::SharedPtr<const LuaSharedData>(data);
+        lua_rawgetp(state, LUA_REGISTRYINDEX, &c_anchorMetatableKey);
+        lua_setmetatable(state, -2);
+        lua_rawsetp(state, LUA_REGISTRYINDEX, data.get());
+    }
+    lua_pop(state, 1);
+
+    data->PushProxy(state, 0);
+}
+
+CLsize_t Cloud::LuaSharedData::GetMemoryBytes() const
+{
+    return sizeof(*this)
+        + m_tables.capacity() * sizeof(Table)
+        + m_values.capacity() * sizeof(Value)
+        + m_entries.capacity() * sizeof(Entry)
+        + m_buckets.capacity() * sizeof(std::uint32_t)
+        + m_strings.capacity();
+}
+
+Cloud::LuaSharedData::Key Cloud::LuaSharedData::GetKey(const Value& value) const
+{
+    Key key;
+    key.type = value.type;
+    switch (value.type)
+    {
+    case ValueType::Boolean:
+        key.bits = value.boolean ? 1 : 0;
+        break;
+
+    case ValueType::Integer:
+        key.bits = static_cast<std::uint64_t>(value.integer);
+        break;
+
+    case ValueType::Number:
+        std::memcpy(&key.bits, &value.number, sizeof(value.number));
+        break;
+
+    case ValueType::String:
+        key.string = m_strings.data() + value.offset;
+        key.length = value.length;
+        break;
+
+    case ValueType::Table:
+        key.bits = value.table;
+        break;
+
+    default:
+        break;
+    }
+
+    return key;
+}
+
+CLbool Cloud::LuaSharedData::GetKey(lua_State* state, CLint stackIndex, Key& key) const
+{
+    switch (lua_type(state, stackIndex))
+    {
+    case LUA_TBOOLEAN:
+        key.type = ValueType::Boolean;
+        key.bits = lua_toboolean(state, stackIndex) ? 1 : 0;
+        return true;
+
+    case LUA_TNUMBER:
+    {
+        // floats with an integral value are the same key as the integer, as in a Lua table
+        int isInteger = 0;
+        const auto integer = lua_tointegerx(state, stackIndex, &isInteger);
+        if (isInteger)
+        {
+            key.type = ValueType::Integer;
+            key.bits = static_cast<std::uint64_t>(integer);
+        }
+        else
+        {
+            const auto number = lua_tonumber(state, stackIndex);
+            key.type = ValueType::Number;
+            std::memcpy(&key.bits, &number, sizeof(number));
+        }
+        return true;
+    }
+
+    case LUA_TSTRING:
+        key.type = ValueType::String;
+        key.string = lua_tolstring(state, stackIndex, &key.length);
+        return true;
+
+    case LUA_TUSERDATA:
+    {
+        // tables used as keys are looked up with their proxies
+        const auto* proxy = TestProxy(state, stackIndex);
+        if (!proxy || proxy->data != this)
+        {
+            return false;
+        }
+
+        key.type = ValueType::Table;
+        key.bits = proxy->table;
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+std::uint32_t Cloud::LuaSharedData::FindEntry(const Table& table, const Key& key) const
+{
+    if (table.entryCount == 0)
+    {
+        return None;
+    }
+
+    const auto* buckets = m_buckets.data() + table.bucketBegin;
+    auto bucket = key.Hash() & table.bucketMask;
+    while (buckets[bucket] != None)
+    {
+        if (GetKey(m_entries[table.entryBegin + buckets[bucket]].key) == key)
+        {
+            return buckets[bucket];
+        }
+        bucket = (bucket + 1) & table.bucketMask;
+    }
+
+    return None;
+}
+
+const Cloud::LuaSharedData::Value* Cloud::LuaSharedData::Find(const Table& table, const Key& key) const
+{
+    if (key.type == ValueType::Integer)
+    {
+        const auto index = static_cast<lua_Integer>(key.bits);
+        if (index >= 1 && index <= table.arrayCount)
+        {
+            return &m_values[table.arrayBegin + index - 1];
+        }
+    }
+
+    const auto entry = FindEntry(table, key);
+    return entry != None ? &m_entries[table.entryBegin + entry].value : nullptr;
+}
+
+void Cloud::LuaSharedData::PushValue(lua_State* state, const Value& value) const
+{
+    switch (value.type)
+    {
+    case ValueType::Boolean:
+        lua_pushboolean(state, value.boolean);
+        break;
+
+    case ValueType::Integer:
+        lua_pushinteger(state, value.integer);
+        break;
+
+    case ValueType::Number:
+        lua_pushnumber(state, value.number);
+        break;
+
+    case ValueType::String:
+        lua_pushlstring(state, m_strings.data() + value.offset, value.length);
+        break;
+
+    case ValueType::Table:
+        PushProxy(state, value.table);
+        break;
+
+    default:
+        lua_pushnil(state);
+        break;
+    }
+}
+
+void Cloud::LuaSharedData::PushProxy(lua_State* state, std::uint32_t table) const
+{
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &c_proxiesKey);
+    const auto* key = &m_tables[table];
+    if (lua_rawgetp(state, -1, key) == LUA_TUSERDATA)
+    {
+        lua_remove(state, -2);
+        return;
+    }
+    lua_pop(state, 1);
+
+    auto* proxy = static_cast<Proxy*>(lua_newuserdata(state, sizeof(Proxy)));
+    proxy->data = this;
+    proxy->table = table;
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &c_metatableKey);
+    lua_setmetatable(state, -2);
+
+    lua_pushvalue(state, -1);
+    lua_rawsetp(state, -3, key);
+    lua_remove(state, -2);
+}
+
+Cloud::LuaSharedData::Proxy* Cloud::LuaSharedData::TestProxy(lua_State* state, CLint stackIndex)
+{
+    auto* proxy = lua_touserdata(state, stackIndex);
+    if (!proxy || !lua_getmetatable(state, stackIndex))
+    {
+        return nullptr;
+    }
+
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &c_metatableKey);
+    const auto matches = lua_rawequal(state, -1, -2) != 0;
+    lua_pop(state, 2);
+
+    return matches ? static_cast<Proxy*>(proxy) : nullptr;
+}
+
+// the first argument of __index and __len, which have the metatable as their upvalue, that saves
+// the registry lookup of TestProxy on every field access
+Cloud::LuaSharedData::Proxy* Cloud::LuaSharedData::CheckSelf(lua_State* state)
+{
+    auto* proxy = lua_touserdata(state, 1);
+    CLbool matches = false;
+    if (proxy && lua_getmetatable(state, 1))
+    {
+        matches = lua_rawequal(state, -1, lua_upvalueindex(1)) != 0;
+        lua_pop(state, 1);
+    }
+
+    luaL_argcheck(state, matches, 1, "shared table expected");
+    return static_cast<Proxy*>(proxy);
+}
+
+// [proxy, key]
+int Cloud::LuaSharedData::Index(lua_State* state)
+{
+    const auto* proxy = CheckSelf(state);
+    const auto* data = proxy->data;
+
+    Key key;
+    const auto* value = data->GetKey(state, 2, key) ? data->Find(data->m_tables[proxy->table], key) : nullptr;
+    if (value)
+    {
+        data->PushValue(state, *value);
+    }
+    else
+    {
+        lua_pushnil(state);
+    }
+
+    return 1;
+}
+
+int Cloud::LuaSharedData::NewIndex(lua_State* state)
+{
+    return luaL_error(state, "attempt to modify a read-only shared table");
+}
+
+int Cloud::LuaSharedData::Length(lua_State* state)
+{
+    const auto* proxy = CheckSelf(state);
+    lua_pushinteger(state, proxy->data->m_tables[proxy->table].arrayCount);
+    return 1;
+}
+
+int Cloud::LuaSharedData::Pairs(lua_State* state)
+{
+    lua_pushcfunction(state, &LuaSharedData::Next);
+    lua_pushvalue(state, 1);
+    lua_pushnil(state);
+    return 3;
+}
+
+// [proxy, key], the array part in order, then the other keys in image order
+int Cloud::LuaSharedData::Next(lua_State* state)
+{
+    const auto* proxy = TestProxy(state, 1);
+    luaL_argcheck(state, proxy, 1, "shared table expected");
+
+    const auto* data = proxy->data;
+    const auto& table = data->m_tables[proxy->table];
+
+    std::uint32_t position = 0;
+    if (!lua_isnoneornil(state, 2))
+    {
+        Key key;
+        if (!data->GetKey(state, 2, key))
+        {
+            return luaL_error(state, "invalid key to 'next'");
+        }
+
+        const auto index = static_cast<lua_Integer>(key.bits);
+        if (key.type == ValueType::Integer && index >= 1 && index <= table.arrayCount)
+        {
+            position = static_cast<std::uint32_t>(index);
+        }
+        else
+        {
+            const auto entry = data->FindEntry(table, key);
+            if (entry == None)
+            {
+                return luaL_error(state, "invalid key to 'next'");
+            }
+            position = table.arrayCount + entry + 1;
+        }
+    }
+
+    for (; position < table.arrayCount; ++position)
+    {
+        const auto& value = data->m_values[table.arrayBegin + position];
+        if (value.type != ValueType::Nil)
+        {
+            lua_pushinteger(state, position + 1);
+            data->PushValue(state, value);
+            return 2;
+        }
+    }
+
+    const auto entry = position - table.arrayCount;
+    if (entry < table.entryCount)
+    {
+        const auto& pair = data->m_entries[table.entryBegin + entry];
+        data->PushValue(state, pair.key);
+        data->PushValue(state, pair.value);
+        return 2;
+    }
+
+    lua_pushnil(state);
+    return 1;
+}
+
+int Cloud::LuaSharedData::IPairs(lua_State* state)
+{
+    lua_pushcfunction(state, &LuaSharedData::NextIndex);
+    lua_pushvalue(state, 1);
+    lua_pushinteger(state, 0);
+    return 3;
+}
+
+// [proxy, index]
+int Cloud::LuaSharedData::NextIndex(lua_State* state)
+{
+    const auto* proxy = TestProxy(state, 1);
+    luaL_argcheck(state, proxy, 1, "shared table expected");
+
+    const auto* data = proxy->data;
+    const auto& table = data->m_tables[proxy->table];
+
+    Key key;
+    key.type = ValueType::Integer;
+    key.bits = static_cast<std::uint64_t>(luaL_checkinteger(state, 2) + 1);
+
+    const auto* value = data->Find(table, key);
+    if (!value || value->type == ValueType::Nil)
+    {
+        lua_pushnil(state);
+        return 1;
+    }
+
+    lua_pushinteger(state, static_cast<lua_Integer>(key.bits));
+    data->PushValue(state, *value);
+    return 2;
+}
+
+int Cloud::LuaSharedData::ToString(lua_State* state)
+{
+    lua_pushfstring(state, "shared table: %p", lua_touserdata(state, 1));
+    return 1;
+}
+
+int Cloud::LuaSharedData::DestroyAnchor(lua_State* state)
+{
+    using Anchor = Lua::SharedPtr<const LuaSharedData>;
+    static_cast<Anchor*>(lua_touserdata(state, 1))->~Anchor();
+    return 0;
+}
@@ -0,0 +1,141 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_SHARED_DATA_HEADER
+#define CLOUD_LUA_CPP_SHARED_DATA_HEADER
+
+#include <cstdint>
+#include <vector>
+#include "luacpp.h"
+
+namespace Cloud
+{
+    // Read-only table data that lives once per process and is read by any number of states,
+    // on any threads, without copying it into them.
+    //
+    //   auto config = LuaSharedData::Create(loaderState, -1);   // frozen from a table, e.g. after DoFile
+    //   for (auto& worker : workers) worker.PushSharedData(config), worker.SetGlobal("config");
+    //   -- Lua: config.units[3].name, #config.units, ipairs(config.units), pairs(config)
+    //
+    // Create freezes a Lua table and everything reachable from it into a flat image: the tables,
+    // their values, the strings (deduplicated) and an open addressing hash index per table for the
+    // non-array keys. Shared subtables stay shared, cycles are fine. Functions, userdata and threads
+    // can't be frozen.
+    //
+    // A state sees each table as a small proxy userdata whose metatable implements __index, __len,
+    // __pairs and __ipairs (for LUA_COMPAT_IPAIRS builds) on top of the image, so indexing, #, ipairs, pairs and the table library work,
+    // assignments raise an error. type() says userdata and next() doesn't work on a proxy.
+    // Proxies are cached per state in a weak table, the same table is always the same proxy.
+    // The first push into a state anchors a shared pointer in its registry, the image lives until
+    // the last state using it is closed and the last SharedPtr is gone.
+    class LuaSharedData
+    {
+    public:
+        // nullptr unless the value at stackIndex is a table that can be frozen, metatables aren't kept
+        static Lua::SharedPtr<const LuaSharedData> Create(lua_State* state, CLint stackIndex);
+
+        // pushes the proxy of the root table
+        static void Push(lua_State* state, const Lua::SharedPtr<const LuaSharedData>& data);
+
+        CLsize_t    GetTableCount() const { return m_tables.size(); }
+        CLsize_t    GetMemoryBytes() const;
+
+    private:
+        static constexpr std::uint32_t None = ~std::uint32_t(0);
+
+        enum class ValueType : std::uint8_t
+        {
+            Nil,
+            Boolean,
+            Integer,
+            Number,
+            String,
+            Table,
+        };
+
+        struct Value
+        {
+            Value() : type(ValueType::Nil), length(0), integer(0) {}
+
+            ValueType       type;
+            std::uint32_t   length;         // strings
+            union
+            {
+                CLbool          boolean;
+                lua_Integer     integer;
+                lua_Number      number;
+                std::uint64_t   offset;     // strings, into m_strings
+                std::uint32_t   table;      // into m_tables
+            };
+        };
+
+        struct Entry
+        {
+            Value key;
+            Value value;
+        };
+
+        struct Table
+        {
+            std::uint32_t   arrayBegin  = 0;    // m_values, t[1] .. t[arrayCount]
+            std::uint32_t   arrayCount  = 0;
+            std::uint32_t   entryBegin  = 0;    // m_entries, every other key
+            std::uint32_t   entryCount  = 0;
+            std::uint32_t   bucketBegin = 0;    // m_buckets, entry indices, bucketMask + 1 of them
+            std::uint32_t   bucketMask  = 0;
+        };
+
+        // what a proxy userdata holds
+        struct Proxy
+        {
+            const LuaSharedData*    data;
+            std::uint32_t           table;
+        };
+
+        struct Key;
+        class Builder;
+
+        LuaSharedData() {}
+
+        Key             GetKey(const Value& value) const;
+        CLbool          GetKey(lua_State* state, CLint stackIndex, Key& key) const; // false if no key in the image can match
+        std::uint32_t   FindEntry(const Table& table, const Key& key) const;
+        const Value*    Find(const Table& table, const Key& key) const;
+        void            PushValue(lua_State* state, const Value& value) const;
+        void            PushProxy(lua_State* state, std::uint32_t table) const;
+
+        static Proxy*   TestProxy(lua_State* state, CLint stackIndex);
+        static Proxy*   CheckSelf(lua_State* state);
+        static int      Index(lua_State* state);
+        static int      NewIndex(lua_State* state);
+        static int      Length(lua_State* state);
+        static int      Pairs(lua_State* state);
+        static int      Next(lua_State* state);
+        static int      IPairs(lua_State* state);
+        static int      NextIndex(lua_State* state);
+        static int      ToString(lua_State* state);
+        static int      DestroyAnchor(lua_State* state);
+
+        std::vector<Table>          m_tables;
+        std::vector<Value>          m_values;
+        std::vector<Entry>          m_entries;
+        std::vector<std::uint32_t>  m_buckets;
+        Lua::String                 m_strings;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_SHARED_DATA_HEADER
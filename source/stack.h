@@ -0,0 +1,370 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_STACK_HEADER
+#define CLOUD_LUA_CPP_STACK_HEADER
+
+#include <vector>
+#include <array>
+#include <iterator>
+#include "luacpp.h"
+#include "user_data.h"
+
+namespace Cloud
+{
+    // Push/To for a single C++ type, working directly on a lua_State.
+    // LuaState forwards to these, and the generated function trampolines use them
+    // on the calling thread without going through a LuaState.
+    template <class _T>
+    class LuaUserType;
+
+    // Anything without a dedicated specialization below is treated as a user type (see user_type.h):
+    // pushing copies the value into a new full userdata, reading gives a reference to the object
+    // inside the userdata and raises a Lua error if the value isn't a _T. Outside a protected call
+    // check with LuaHostStack first.
+    template <typename _T, typename _Enable = void>
+    struct LuaStack
+    {
+        using UserTypeTag = void;
+
+        static void Push(lua_State* state, const _T& value)
+        {
+            LuaUserType<_T>::Emplace(state, value);
+        }
+
+        static _T& To(lua_State* state, CLint stackIndex)
+        {
+            return *LuaUserType<_T>::Check(state, stackIndex);
+        }
+    };
+
+    template <>
+    struct LuaStack<CLbool>
+    {
+        static void Push(lua_State* state, CLbool value)
+        {
+            lua_pushboolean(state, value ? 1 : 0);
+        }
+
+        static CLbool To(lua_State* state, CLint stackIndex)
+        {
+            return lua_toboolean(state, stackIndex) != 0 ? true : false;
+        }
+    };
+
+    template <typename _T>
+    struct LuaStack<_T, std::enable_if_t<std::is_integral<_T>::value && !std::is_same<_T, CLbool>::value>>
+    {
+        static void Push(lua_State* state, _T value)
+        {
+            lua_pushinteger(state, static_cast<lua_Integer>(value));
+        }
+
+        static _T To(lua_State* state, CLint stackIndex)
+        {
+            return static_cast<_T>(lua_tointeger(state, stackIndex));
+        }
+    };
+
+    template <typename _T>
+    struct LuaStack<_T, std::enable_if_t<std::is_floating_point<_T>::value>>
+    {
+        static void Push(lua_State* state, _T value)
+        {
+            lua_pushnumber(state, static_cast<lua_Number>(value));
+        }
+
+        static _T To(lua_State* state, CLint stackIndex)
+        {
+            return static_cast<_T>(lua_tonumber(state, stackIndex));
+        }
+    };
+
+    template <>
+    struct LuaStack<const CLchar*>
+    {
+        static void Push(lua_State* state, const CLchar* value)
+        {
+            lua_pushstring(state, value);
+        }
+
+        static const CLchar* To(lua_State* state, CLint stackIndex)
+        {
+            // TODO: might change stack value to str, so not const or thread-safe
+            return lua_tostring(state, stackIndex);
+        }
+    };
+
+    // Length-aware strings: no strlen on push, embedded zeros survive.
+    // A view points into the Lua string, so it stays valid as long as the value is on the stack
+    // (e.g. for the duration of a registered function call).
+    template <>
+    struct LuaStack<Lua::StringView>
+    {
+        static void Push(lua_State* state, Lua::StringView value)
+        {
+            lua_pushlstring(state, value.data(), value.size());
+        }
+
+        static Lua::StringView To(lua_State* state, CLint stackIndex)
+        {
+            size_t length = 0;
+            const auto* data = lua_tolstring(state, stackIndex, &length);
+            return data ? Lua::StringView(data, length) : Lua::StringView();
+        }
+    };
+
+    template <>
+    struct LuaStack<Lua::String>
+    {
+        static void Push(lua_State* state, const Lua::String& value)
+        {
+            lua_pushlstring(state, value.data(), value.size());
+        }
+
+        static Lua::String To(lua_State* state, CLint stackIndex)
+        {
+            size_t length = 0;
+            const auto* data = lua_tolstring(state, stackIndex, &length);
+            return data ? Lua::String(data, length) : Lua::String();
+        }
+    };
+
+    // Pointers push as light userdata. Reading a full userdata goes through its type tag,
+    // so a T* parameter receives user type objects and boxed pointers of T, or nullptr.
+    template <typename _T>
+    struct LuaStack<_T*>
+    {
+        static void Push(lua_State* state, _T* value)
+        {
+            lua_pushlightuserdata(state, value);
+        }
+
+        static _T* To(lua_State* state, CLint stackIndex)
+        {
+            if constexpr (std::is_class<_T>::value)
+            {
+                if (lua_type(state, stackIndex) == LUA_TUSERDATA)
+                {
+                    return LuaUserData::Test<std::remove_cv_t<_T>>(state, stackIndex);
+                }
+            }
+
+            return static_cast<_T*>(lua_touserdata(state, stackIndex));
+        }
+    };
+
+    // Sequences map to Lua arrays. Push sizes the array part up front and fills it with rawseti,
+    // To walks 1..rawlen with rawgeti, both stay in the table's array part.
+    struct LuaArray
+    {
+        template <typename _Iterator>
+        static void Push(lua_State* state, _Iterator begin, CLsize_t count)
+        {
+            using ValueType = typename std::iterator_traits<_Iterator>::value_type;
+
+            lua_createtable(state, static_cast<CLint>(count), 0);
+            for (CLsize_t i = 0; i < count; ++i, ++begin)
+            {
+                LuaStack<ValueType>::Push(state, *begin);
+                lua_rawseti(state, -2, static_cast<lua_Integer>(i + 1));
+            }
+        }
+
+        static CLsize_t Length(lua_State* state, CLint stackIndex)
+        {
+            return lua_istable(state, stackIndex) ? lua_rawlen(state, stackIndex) : 0;
+        }
+
+        // reads up to maxCount elements, returns how many were read
+        template <typename _T, typename _OutIterator>
+        static CLsize_t Read(lua_State* state, CLint stackIndex, _OutIterator out, CLsize_t maxCount)
+        {
+            const auto tableIndex = lua_absindex(state, stackIndex);
+            const auto length = Length(state, tableIndex);
+            const auto count = length < maxCount ? length : maxCount;
+
+            for (CLsize_t i = 0; i < count; ++i, ++out)
+            {
+                lua_rawgeti(state, tableIndex, static_cast<lua_Integer>(i + 1));
+                *out = LuaStack<_T>::To(state, -1);
+                lua_pop(state, 1);
+            }
+
+            return count;
+        }
+    };
+
+    template <typename _T, typename _Alloc>
+    struct LuaStack<std::vector<_T, _Alloc>>
+    {
+        static void Push(lua_State* state, const std::vector<_T, _Alloc>& values)
+        {
+            LuaArray::Push(state, values.begin(), values.size());
+        }
+
+        static std::vector<_T, _Alloc> To(lua_State* state, CLint stackIndex)
+        {
+            std::vector<_T, _Alloc> values(LuaArray::Length(state, stackIndex));
+            LuaArray::Read<_T>(state, stackIndex, values.begin(), values.size());
+            return values;
+        }
+    };
+
+    // elements missing from the table are value-initialized
+    template <typename _T, CLsize_t _N>
+    struct LuaStack<std::array<_T, _N>>
+    {
+        static void Push(lua_State* state, const std::array<_T, _N>& values)
+        {
+            LuaArray::Push(state, values.begin(), _N);
+        }
+
+        static std::array<_T, _N> To(lua_State* state, CLint stackIndex)
+        {
+            std::array<_T, _N> values = {};
+            LuaArray::Read<_T>(state, stackIndex, values.begin(), _N);
+            return values;
+        }
+    };
+
+    // spans only push, they don't own storage to read into
+    template <typename _T>
+    struct LuaStack<Lua::Span<_T>>
+    {
+        static void Push(lua_State* state, Lua::Span<_T> values)
+        {
+            LuaArray::Push(state, values.begin(), values.size());
+        }
+    };
+
+#ifdef LUACPP_HAS_STD_SPAN
+    template <typename _T, CLsize_t _Extent>
+    struct LuaStack<std::span<_T, _Extent>>
+    {
+        static void Push(lua_State* state, std::span<_T, _Extent> values)
+        {
+            LuaArray::Push(state, values.begin(), values.size());
+        }
+    };
+#endif
+
+    // true for the types the generic LuaStack handles, the bound classes
+    template <typename _T, typename _Enable = void>
+    struct LuaIsUserType : std::false_type {};
+
+    template <typename _T>
+    struct LuaIsUserType<_T, std::void_t<typename LuaStack<_T>::UserTypeTag>> : std::true_type {};
+
+    // Checks for the host side, outside any protected call, where the Lua error LuaStack raises for
+    // a user type would reach the panic handler and abort. Only user types and sequences of them can
+    // fail: pushing a type that isn't registered in the state, or reading a value that isn't a _T
+    // (nil included). Callers check first and report the failure like their other errors, the
+    // function trampolines run inside lua_pcall and let LuaStack raise.
+    template <typename _T, typename _Enable = void>
+    struct LuaHostStack
+    {
+        static constexpr CLbool c_canFail = false;
+
+        static CLbool CanPush(lua_State*) { return true; }
+        static CLbool CanRead(lua_State*, CLint) { return true; }
+    };
+
+    template <typename _T>
+    struct LuaHostStack<_T, std::enable_if_t<LuaIsUserType<_T>::value>>
+    {
+        static constexpr CLbool c_canFail = true;
+
+        static CLbool CanPush(lua_State* state)
+        {
+            return LuaUserType<_T>::IsRegistered(state);
+        }
+
+        static CLbool CanRead(lua_State* state, CLint stackIndex)
+        {
+            return LuaUserType<_T>::Test(state, stackIndex) != nullptr;
+        }
+    };
+
+    // the elements LuaArray::Read would read
+    template <typename _T>
+    struct LuaHostArray
+    {
+        static constexpr CLbool c_canFail = LuaHostStack<_T>::c_canFail;
+
+        static CLbool CanPush(lua_State* state)
+        {
+            return LuaHostStack<_T>::CanPush(state);
+        }
+
+        static CLbool CanRead(lua_State* state, CLint stackIndex, CLsize_t maxCount)
+        {
+            if constexpr (c_canFail)
+            {
+                const auto tableIndex = lua_absindex(state, stackIndex);
+                const auto length = LuaArray::Length(state, tableIndex);
+                const auto count = length < maxCount ? length : maxCount;
+
+                for (CLsize_t i = 0; i < count; ++i)
+                {
+                    lua_rawgeti(state, tableIndex, static_cast<lua_Integer>(i + 1));
+                    const auto readable = LuaHostStack<_T>::CanRead(state, -1);
+                    lua_pop(state, 1);
+                    if (!readable)
+                    {
+                        return false;
+                    }
+                }
+            }
+            else
+            {
+                LUACPP_UNUSED(state);
+                LUACPP_UNUSED(stackIndex);
+                LUACPP_UNUSED(maxCount);
+            }
+            return true;
+        }
+    };
+
+    template <typename _T, typename _Alloc>
+    struct LuaHostStack<std::vector<_T, _Alloc>> : LuaHostArray<_T>
+    {
+        static CLbool CanRead(lua_State* state, CLint stackIndex)
+        {
+            return LuaHostArray<_T>::CanRead(state, stackIndex, ~CLsize_t(0));
+        }
+    };
+
+    template <typename _T, CLsize_t _N>
+    struct LuaHostStack<std::array<_T, _N>> : LuaHostArray<_T>
+    {
+        static CLbool CanRead(lua_State* state, CLint stackIndex)
+        {
+            return LuaHostArray<_T>::CanRead(state, stackIndex, _N);
+        }
+    };
+
+    template <typename _T>
+    struct LuaHostStack<Lua::Span<_T>> : LuaHostArray<std::remove_cv_t<_T>> {};
+
+#ifdef LUACPP_HAS_STD_SPAN
+    template <typename _T, CLsize_t _Extent>
+    struct LuaHostStack<std::span<_T, _Extent>> : LuaHostArray<std::remove_cv_t<_T>> {};
+#endif
+}
+
+#endif // CLOUD_LUA_CPP_STACK_HEADER
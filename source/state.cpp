@@ -16,15 +16,62 @@
 */
 
 #include "state.h"
+#include "bytecode_cache.h"
+#include "mapped_file.h"
+
+#include <cstring>
 
 Cloud::LuaState::LuaState()
+    : m_allocator(Lua::MakeUnique<LuaAccountingAllocator>())
+    , m_bytecodeCache(nullptr)
+{
+    m_state = Lua::NewStateAndSetup(m_allocator.get());
+}
+
+Cloud::LuaState::LuaState(Lua::UniquePtr<LuaAllocator> allocator)
+    : m_allocator(Lua::MakeUnique<LuaAccountingAllocator>(std::move(allocator)))
+    , m_bytecodeCache(nullptr)
 {
-    m_state = Lua::NewStateAndSetup();
+    m_state = Lua::NewStateAndSetup(m_allocator.get());
 }
 
 Cloud::LuaState::LuaState(LuaState&& other)
 {
+    m_allocator = std::move(other.m_allocator);
     m_state = std::move(other.m_state);
+    m_gcTelemetry = std::move(other.m_gcTelemetry);
+    m_bytecodeCache = other.m_bytecodeCache;
+}
+
+void Cloud::LuaState::Close()
+{
+    m_gcTelemetry.reset();
+    m_state.reset();
+}
+
+void Cloud::LuaState::SetGcTelemetry(CLbool enabled)
+{
+    if (!enabled)
+    {
+        m_gcTelemetry.reset();
+    }
+    else if (!m_gcTelemetry)
+    {
+        m_gcTelemetry = Lua::MakeUnique<LuaGcTelemetry>(GetState());
+    }
+}
+
+Cloud::Lua::GcStats Cloud::LuaState::GetGcStats() const
+{
+    return m_gcTelemetry ? m_gcTelemetry->GetStats() : Lua::GcStats();
+}
+
+void Cloud::LuaState::ResetGcStats()
+{
+    if (m_gcTelemetry)
+    {
+        m_gcTelemetry->Reset();
+    }
 }
 
 void Cloud::LuaState::Register(const CLchar* funcName, lua_CFunction func)
@@ -59,17 +106,17 @@ const CLchar* Cloud::LuaState::Typename(CLint stackIndex) const
 
 void Cloud::LuaState::Push(CLbool value)
 {
-    lua_pushboolean(GetState(), value ? 1 : 0);
+    LuaStack<CLbool>::Push(GetState(), value);
 }
 
 void Cloud::LuaState::Push(CLint value)
 {
-    lua_pushinteger(GetState(), static_cast<lua_Integer>(value));
+    LuaStack<CLint>::Push(GetState(), value);
 }
 
 void Cloud::LuaState::Push(CLfloat value)
 {
-    lua_pushnumber(GetState(), static_cast<lua_Number>(value));
+    LuaStack<CLfloat>::Push(GetState(), value);
 }
 
 const CLchar* Cloud::LuaState::Push(const CLchar* value)
@@ -77,6 +124,16 @@ const CLchar* Cloud::LuaState::Push(const CLchar* value)
     return lua_pushstring(GetState(), value);
 }
 
+const CLchar* Cloud::LuaState::Push(Lua::StringView value)
+{
+    return lua_pushlstring(GetState(), value.data(), value.size());
+}
+
+const CLchar* Cloud::LuaState::Push(const Lua::String& value)
+{
+    return lua_pushlstring(GetState(), value.data(), value.size());
+}
+
 void Cloud::LuaState::Pop(CLint numElements)
 {
     lua_pop(GetState(), numElements);
@@ -181,7 +238,9 @@ CLbool Cloud::LuaState::Next(CLint stackIndex)
 
 Cloud::Lua::ErrorCode Cloud::LuaState::LoadFile(const CLchar* fileName)
 {
-    Lua::ErrorCode result = static_cast<Lua::ErrorCode>(luaL_loadfile(GetState(), fileName));
+    Lua::ErrorCode result = m_bytecodeCache
+        ? m_bytecodeCache->Load(GetState(), fileName)
+        : Lua::LoadMappedFile(GetState(), fileName);
 
     if (result == Lua::ErrorCode::ErrFile)
     {
@@ -217,6 +276,35 @@ Cloud::Lua::ErrorCode Cloud::LuaState::DoFile(const CLchar* fileName)
     return result;
 }
 
+Cloud::Lua::ErrorCode Cloud::LuaState::LoadChunk(const CLchar* source, const CLchar* chunkName)
+{
+    Lua::ErrorCode result = static_cast<Lua::ErrorCode>(luaL_loadbuffer(GetState(), source, std::strlen(source), chunkName ? chunkName : source));
+
+    if (result == Lua::ErrorCode::ErrSyntax)
+    {
+        if (lua_isstring(GetState(), -1))
+        {
+            const char* err = lua_tostring(GetState(), -1);
+            LUACPP_TRACE("Lua syntax error:\n%s", err);
+        }
+    }
+
+    return result;
+}
+
+Cloud::Lua::ErrorCode Cloud::LuaState::DoChunk(const CLchar* source, const CLchar* chunkName)
+{
+    Lua::ErrorCode result;
+    result = LoadChunk(source, chunkName);
+    if (result != Lua::ErrorCode::Ok)
+    {
+        return result;
+    }
+
+    result = PCall();
+    return result;
+}
+
 Cloud::Lua::ErrorCode Cloud::LuaState::PCall(CLint argCount, CLint retArgCount)
 {
     Lua::ErrorCode result = static_cast<Lua::ErrorCode>(lua_pcall(GetState(), argCount, retArgCount, 0));
@@ -230,5 +318,10 @@ Cloud::Lua::ErrorCode Cloud::LuaState::PCall(CLint argCount, CLint retArgCount)
         }
     }
 
+    if (result == Lua::ErrorCode::ErrMem)
+    {
+        LUACPP_TRACE("Lua memory error:\nlive bytes: %zu, limit: %zu", GetMemoryStats().liveBytes, GetMemoryLimit());
+    }
+
     return result;
 }
\ No newline at end of file
@@ -19,19 +19,38 @@
 #define CLOUD_LUA_CPP_STATE_HEADER
 
 #include "luacpp.h"
+#include "allocator.h"
+#include "gc_telemetry.h"
+#include "stack.h"
 
 namespace Cloud
 {
+    class LuaBytecodeCache;
+
     class LuaState
     {
     public:
         LuaState();
+        explicit LuaState(Lua::UniquePtr<LuaAllocator> allocator);
         LuaState(const LuaState&) = delete;
         LuaState(LuaState&& other);
         virtual ~LuaState() {};
 
         void Register(const CLchar* funcName, lua_CFunction func);
 
+        const Lua::MemoryStats& GetMemoryStats() const { return m_allocator->GetStats(); }
+        CLsize_t        GetMemoryLimit() const { return m_allocator->GetLimit(); }
+        void            SetMemoryLimit(CLsize_t limitBytes) { m_allocator->SetLimit(limitBytes); } // 0 removes the limit
+
+        // GC pause and phase histograms, see gc_telemetry.h. Off by default, turning it off drops the stats.
+        void            SetGcTelemetry(CLbool enabled);
+        Lua::GcStats    GetGcStats() const; // empty while off
+        void            ResetGcStats();
+
+        // LoadFile/DoFile go through cache when set, nullptr turns it off. Not owned, may be shared between states.
+        void            SetBytecodeCache(LuaBytecodeCache* cache) { m_bytecodeCache = cache; }
+        LuaBytecodeCache* GetBytecodeCache() const { return m_bytecodeCache; }
+
         CLbool          CheckStack(CLint requiredStackSlots); // TODO: test behaviour
         CLint           GetTop() const;
         void            SetTop(CLint stackIndex);
@@ -51,11 +70,9 @@ namespace Cloud
             return static_cast<_T*>(lua_touserdata(GetState(), stackIndex));
         }
 
+        // a default constructed _T if the value isn't of the user type _T (nil included)
         template <typename _T>
-        _T            To(CLint stackIndex) const
-        {
-            return ToUserData<std::remove_pointer_t<_T>>(stackIndex);
-        }
+        _T            To(CLint stackIndex) const;
 
         CLint UpValueIndex(CLint upValueIndex) const
         {
@@ -86,6 +103,8 @@ namespace Cloud
         void            Push(CLint value);
         void            Push(CLfloat value);
         const CLchar*   Push(const CLchar* value);
+        const CLchar*   Push(Lua::StringView value);
+        const CLchar*   Push(const Lua::String& value);
 
         template <typename _T>
         void Push(_T* value)
@@ -93,11 +112,52 @@ namespace Cloud
             PushLightUserData(value);
         }
 
-        template<typename _FirstArg, typename... _MoreArgs>
-        void            Push(_FirstArg&& firstArg, _MoreArgs&&... moreArgs)
+        template <typename _T, typename = std::enable_if_t<std::is_arithmetic<_T>::value>>
+        void Push(_T value)
+        {
+            LuaStack<_T>::Push(GetState(), value);
+        }
+
+        // class types without a dedicated overload are copied into a user type object, see user_type.h,
+        // a type that isn't registered in this state pushes nil
+        template <typename _T, typename = std::enable_if_t<std::is_class<_T>::value>>
+        void Push(const _T& value)
+        {
+            PushChecked(value);
+        }
+
+        // sequences become a table with a presized array part
+        template <typename _T, typename _Alloc>
+        void Push(const std::vector<_T, _Alloc>& values)
+        {
+            PushChecked(values);
+        }
+
+        template <typename _T, CLsize_t _N>
+        void Push(const std::array<_T, _N>& values)
+        {
+            PushChecked(values);
+        }
+
+        template <typename _T>
+        void Push(Lua::Span<_T> values)
+        {
+            PushChecked(values);
+        }
+
+#ifdef LUACPP_HAS_STD_SPAN
+        template <typename _T, CLsize_t _Extent>
+        void Push(std::span<_T, _Extent> values)
+        {
+            PushChecked(values);
+        }
+#endif
+
+        template<typename _FirstArg, typename _SecondArg, typename... _MoreArgs>
+        void            Push(_FirstArg&& firstArg, _SecondArg&& secondArg, _MoreArgs&&... moreArgs)
         {
             Push(std::forward<_FirstArg>(firstArg));
-            Push(std::forward<_MoreArgs>(moreArgs)...);
+            Push(std::forward<_SecondArg>(secondArg), std::forward<_MoreArgs>(moreArgs)...);
         }
 
         void            Pop(CLint numElements); // TODO: what happens with negative values?
@@ -135,15 +195,39 @@ namespace Cloud
 
         CLbool          Next(CLint stackIndex);
 
+        // regular files are memory mapped and parsed in place, anything else goes through luaL_loadfile
         Lua::ErrorCode LoadFile(const CLchar* fileName);
         Lua::ErrorCode DoFile(const CLchar* fileName);
+        // chunkName defaults to the source itself, like luaL_loadstring
+        Lua::ErrorCode LoadChunk(const CLchar* source, const CLchar* chunkName = nullptr);
+        Lua::ErrorCode DoChunk(const CLchar* source, const CLchar* chunkName = nullptr);
         Lua::ErrorCode PCall(CLint argCount = 0, CLint retArgCount = LUA_MULTRET);
 
     protected:
+        friend class LuaStatePool;
+        friend class LuaStateTemplate;
+        friend class LuaScheduler;
+        friend class LuaExecutor;
+        friend class LuaProfiler;
+
         lua_State* GetState() const { return m_state.get(); }
 
+        // closes the lua_State ahead of the destructor, for derived classes owning objects its
+        // finalizers may still use
+        void Close();
+
     private:
+        // pushes nil in place of values of a user type that isn't registered, outside a protected
+        // call LuaStack<_T>::Push would raise
+        template <typename _T>
+        void PushChecked(const _T& value);
+
+        // declared before m_state, the allocator has to outlive the lua_State
+        Lua::UniquePtr<LuaAccountingAllocator> m_allocator;
         Lua::StateUniquePtr m_state;
+        // after m_state, removes its hook before the state is closed
+        Lua::UniquePtr<LuaGcTelemetry> m_gcTelemetry;
+        LuaBytecodeCache* m_bytecodeCache;
 
     };
 }
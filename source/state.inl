@@ -18,32 +18,29 @@
 #ifndef CLOUD_LUA_CPP_STATE_INLINE
 #define CLOUD_LUA_CPP_STATE_INLINE
 
-namespace Cloud
+template <typename _T>
+inline _T Cloud::LuaState::To(CLint stackIndex) const
 {
-    template <>
-    inline CLbool Cloud::LuaState::To(CLint stackIndex) const
+    if (!LuaHostStack<_T>::CanRead(GetState(), stackIndex))
     {
-        return lua_toboolean(GetState(), stackIndex) != 0 ? true : false;
+        LUACPP_TRACE("LuaState::To: value %d is not of the requested user type", stackIndex);
+        return _T();
     }
 
-    template <>
-    inline CLint Cloud::LuaState::To(CLint stackIndex) const
-    {
-        return static_cast<CLint>(lua_tointeger(GetState(), stackIndex));
-    }
+    return LuaStack<_T>::To(GetState(), stackIndex);
+}
 
-    template <>
-    inline CLfloat Cloud::LuaState::To(CLint stackIndex) const
+template <typename _T>
+inline void Cloud::LuaState::PushChecked(const _T& value)
+{
+    if (!LuaHostStack<_T>::CanPush(GetState()))
     {
-        return static_cast<CLfloat>(lua_tonumber(GetState(), stackIndex));
+        LUACPP_TRACE("LuaState::Push: user type not registered, pushing nil");
+        lua_pushnil(GetState());
+        return;
     }
 
-    template <>
-    inline const CLchar* Cloud::LuaState::To(CLint stackIndex) const
-    {
-        // TODO: might change stack value to str, so not const or thread-safe
-        return lua_tostring(GetState(), stackIndex);
-    }
+    LuaStack<_T>::Push(GetState(), value);
 }
 
 #endif // CLOUD_LUA_CPP_STATE_INLINE
\ No newline at end of file
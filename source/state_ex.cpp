@@ -22,6 +22,11 @@ Cloud::LuaStateEx::LuaStateEx()
 {
 }
 
+Cloud::LuaStateEx::LuaStateEx(Lua::UniquePtr<LuaAllocator> allocator)
+    : LuaState(std::move(allocator))
+{
+}
+
 Cloud::LuaStateEx::LuaStateEx(LuaStateEx&& other)
     : LuaState(std::forward<LuaStateEx>(other))
 {
@@ -19,6 +19,11 @@
 #define CLOUD_LUA_CPP_STATE_EX_HEADER
 
 #include "function.h"
+#include "function_ref.h"
+#include "thread.h"
+#include "serializer.h"
+#include "shared_data.h"
+#include "user_type.h"
 #include "stack_sentry.h"
 #include "config.h"
 
@@ -28,9 +33,11 @@ namespace Cloud
     {
     public:
         LuaStateEx();
+        explicit LuaStateEx(Lua::UniquePtr<LuaAllocator> allocator);
         LuaStateEx(const LuaStateEx&) = delete;
         LuaStateEx(LuaStateEx&& other);
-        virtual ~LuaStateEx() override {};
+        // closes the state while the bindings are still alive, finalizers may call them
+        virtual ~LuaStateEx() override { Close(); }
 
         template <typename _Return, typename... _Args>
         void RegisterFunction(const CLchar* funcName, const Lua::Function<_Return(_Args...)>& func)
@@ -50,6 +57,46 @@ namespace Cloud
             m_functions[funcName] = std::move(luaFunc);
         }
 
+        // RegisterFunction<&freeFunction>("name")
+        template <auto _Function>
+        void RegisterFunction(const CLchar* funcName)
+        {
+            Register(funcName, &LuaNativeFunction<_Function>::Invoke);
+        }
+
+        // RegisterMethod<&Class::Method>("name", &instance), instance has to outlive the registration
+        template <auto _Method, class _Class>
+        void RegisterMethod(const CLchar* funcName, _Class* instance)
+        {
+            LuaStackSentry sentry(*this);
+
+            PushLightUserData(instance);
+            PushCClosure(&LuaNativeFunction<_Method>::Invoke, 1);
+            SetGlobal(funcName);
+        }
+
+        // RegisterUserType<Class>("Class").Constructor<...>().Method<&Class::Method>("method")...
+        template <class _T>
+        LuaUserType<_T> RegisterUserType(const CLchar* typeName)
+        {
+            LuaStackSentry sentry(*this);
+            return LuaUserType<_T>(GetState(), typeName);
+        }
+
+        // constructs a registered user type in place on top of the stack
+        template <class _T, typename... _Args>
+        _T* PushObject(_Args&&... args)
+        {
+            return LuaUserType<_T>::Emplace(GetState(), std::forward<_Args>(args)...);
+        }
+
+        // nullptr if the value at stackIndex isn't a _T
+        template <class _T>
+        _T* ToObject(CLint stackIndex) const
+        {
+            return LuaUserType<_T>::Test(GetState(), stackIndex);
+        }
+
         template <CLsize_t, typename... _Types>
         struct ReadbackTypeTrait
         {
@@ -123,91 +170,140 @@ namespace Cloud
 
         }
 
-        void ForEach()
+        // resolves a global function once, e.g. GetFunction<CLint(CLint, CLfloat)>("update"),
+        // the returned ref is invalid if the global isn't a function
+        template <typename _Signature>
+        LuaFunctionRef<_Signature> GetFunction(const CLchar* functionName)
         {
-            // push nil     [..., {a, b, c, ...}, nil]
-            // next -2      [..., {a, b, c, ...}, 1, a]
-            // call key, val
-            // pop 1        [..., {a, b, c, ...}, 1]
-            // next -2      [..., {a, b, c, ...}, 2, b]
-            // ...
+            LuaStackSentry sentry(*this);
 
-            // ORDER NOT GUARATEED!
+            LuaFunctionRef<_Signature> ref;
+            if (GetGlobal(functionName) == Lua::Type::Function)
+            {
+                ref = LuaFunctionRef<_Signature>(GetState(), -1);
+            }
+            Pop(1);
+
+            return ref;
         }
 
-        template <class _T>
-        static void PushLightUserDataChecked(_T* pointer)
+        // a coroutine running the global function, the returned thread is invalid if the global isn't a function
+        LuaThread NewThread(const CLchar* functionName)
         {
-            auto typeId = getUniqueTypeId<_T>();
-            // lock
-            s_pointerTypeRegister[pointer] = typeId;
-            //unlock
+            LuaStackSentry sentry(*this);
+
+            LuaThread thread;
+            if (GetGlobal(functionName) == Lua::Type::Function)
+            {
+                thread = LuaThread(GetState(), -1);
+            }
+            Pop(1);
 
-            PushLightUserData(pointer);
+            return thread;
         }
 
-        template <class _T>
-        static _T* ToUserDataChecked(CLint index)
+        // the value at stackIndex in the compact binary format of serializer.h, appended to buffer
+        CLbool Serialize(CLint stackIndex, Lua::String& buffer) const
         {
-            const auto castTypeId = getUniqueTypeId<_T>();
+            return Lua::Serialize(GetState(), stackIndex, buffer);
+        }
 
-            auto&& pointer = ToUserData<_T>(index);
+        // pushes a value written by Serialize, possibly by another state, nothing on malformed data
+        CLbool Deserialize(const CLchar* data, CLsize_t size, CLsize_t* consumed = nullptr)
+        {
+            return Lua::Deserialize(GetState(), data, size, consumed);
+        }
 
-            // lock
-            const auto registeredTypeId = s_pointerTypeRegister[pointer];
-            // unlock
+        CLbool Deserialize(Lua::StringView data, CLsize_t* consumed = nullptr)
+        {
+            return Lua::Deserialize(GetState(), data.data(), data.size(), consumed);
+        }
 
-            if (registeredTypeId == castTypeId)
+#ifdef LUACPP_INSTRUMENTATION
+        // call counts and latencies of the Lua::Function bindings, bindings shared with forks of a
+        // template count the calls of every fork
+        std::vector<Lua::BindingStats> GetBindingStats() const
+        {
+            std::vector<Lua::BindingStats> stats(m_functions.size());
+            auto binding = stats.begin();
+            for (const auto& function : m_functions)
             {
-                return pointer;
+                binding->name = function.first;
+                function.second->GetCounters().Snapshot(*binding);
+                ++binding;
             }
-            else
+            return stats;
+        }
+
+        void ResetBindingStats()
+        {
+            for (const auto& function : m_functions)
             {
-                // lock
-#ifdef LUACPP_DEBUG
-                const char* registeredTypeName = s_typenames[registeredTypeId].c_str();
-#else
-                const char* registeredTypeName = "<type not available>";
-#endif
-                LUACPP_TRACE("Lua ToUserData cast error:\n"
-                             "Trying to cast stack index %d, ptr:%p '%s (typeid:%zu)' to '%s (typeid:%zu)'\n"
-                             "ToUserData will return nullptr",
-                             index, pointer, registeredTypeName, s_pointerTypeRegister[pointer], typeid(_T).name(), castTypeId);
-                // unlock
-                return nullptr;
+                function.second->GetCounters().Reset();
             }
         }
+#endif
 
-    private:
-        static size_t NextTypeId(const char* name)
+        // freezes the table at stackIndex for any number of states, see shared_data.h
+        Lua::SharedPtr<const LuaSharedData> ToSharedData(CLint stackIndex) const
         {
-            static size_t id = 0;
-            size_t result = id;
-            // lock
-            ++id;
-            LUACPP_UNUSED(name);
-#ifdef LUACPP_DEBUG
+            return LuaSharedData::Create(GetState(), stackIndex);
+        }
 
-            s_typenames[result] = name;
+        // pushes a read-only view of data's root table
+        void PushSharedData(const Lua::SharedPtr<const LuaSharedData>& data)
+        {
+            LuaSharedData::Push(GetState(), data);
+        }
 
-#endif
-            // unlock
-            return result;
+        void ForEach()
+        {
+            // push nil     [..., {a, b, c, ...}, nil]
+            // next -2      [..., {a, b, c, ...}, 1, a]
+            // call key, val
+            // pop 1        [..., {a, b, c, ...}, 1]
+            // next -2      [..., {a, b, c, ...}, 2, b]
+            // ...
+
+            // ORDER NOT GUARATEED!
         }
 
-        template <typename _T>
-        static size_t getUniqueTypeId()
+        // Pushes pointer boxed in a small tagged userdata, it isn't owned and nothing is recorded
+        // elsewhere, the box is collected like any other value.
+        template <class _T>
+        void PushLightUserDataChecked(_T* pointer)
         {
-            static size_t id = NextTypeId(typeid(_T).name());
-            return id;
+            LuaUserData::PushPointer(GetState(), pointer);
         }
 
-        static Lua::UnorderedMap<void*, size_t> s_pointerTypeRegister;
+        // nullptr unless the value at index was pushed as a _T, either through PushLightUserDataChecked
+        // or as a user type object. The check is a compare against the tag in the userdata header.
+        template <class _T>
+        _T* ToUserDataChecked(CLint index) const
+        {
+            auto* pointer = LuaUserData::Test<_T>(GetState(), index);
+            if (!pointer)
+            {
 #ifdef LUACPP_DEBUG
-        static Lua::UnorderedMap<size_t, Lua::String> s_typenames;
+                const auto* header = LuaUserData::GetHeader(GetState(), index);
+                const auto* registered = header ? LuaTypeRegistry::Find(header->type) : nullptr;
+                const auto* cast = LuaTypeRegistry::Get<_T>();
+                LUACPP_TRACE("Lua ToUserData cast error:\n"
+                             "Trying to cast stack index %d '%s (typeid:%zu)' to '%s (typeid:%zu)'\n"
+                             "ToUserData will return nullptr",
+                             index, registered ? registered->name : luaL_typename(GetState(), index), registered ? registered->id : CLsize_t(-1),
+                             cast->name, cast->id);
 #endif
+            }
+
+            return pointer;
+        }
+
+    private:
+        friend class LuaStateTemplate;
 
-        Lua::UnorderedMap<const char*, Lua::UniquePtr<LuaFunctionBase>> m_functions;
+        // shared with the states forked from a template, see state_template.h
+        Lua::UnorderedMap<const char*, Lua::SharedPtr<LuaFunctionBase>> m_functions;
     };
 }
 
@@ -0,0 +1,234 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "state_pool.h"
+
+#include <chrono>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // registry key of a state's baseline, [1] = globals, [2] = package.loaded
+    const CLchar s_baselineKey = 0;
+
+    void PushShallowCopy(lua_State* state, CLint sourceIndex)
+    {
+        sourceIndex = lua_absindex(state, sourceIndex);
+        lua_newtable(state);
+
+        lua_pushnil(state);
+        while (lua_next(state, sourceIndex) != 0)
+        {
+            lua_pushvalue(state, -2);
+            lua_insert(state, -2);
+            lua_rawset(state, -4);
+        }
+    }
+
+    // clears the keys of target that aren't in baseline, then copies baseline over target
+    void RestoreTable(lua_State* state, CLint targetIndex, CLint baselineIndex)
+    {
+        targetIndex = lua_absindex(state, targetIndex);
+        baselineIndex = lua_absindex(state, baselineIndex);
+
+        // assigning nil to existing fields is allowed during lua_next
+        lua_pushnil(state);
+        while (lua_next(state, targetIndex) != 0)
+        {
+            lua_pop(state, 1);
+            lua_pushvalue(state, -1);
+            if (lua_rawget(state, baselineIndex) == LUA_TNIL)
+            {
+                lua_pushvalue(state, -2);
+                lua_pushnil(state);
+                lua_rawset(state, targetIndex);
+            }
+            lua_pop(state, 1);
+        }
+
+        lua_pushnil(state);
+        while (lua_next(state, baselineIndex) != 0)
+        {
+            lua_pushvalue(state, -2);
+            lua_insert(state, -2);
+            lua_rawset(state, targetIndex);
+        }
+    }
+
+    void PushLoadedTable(lua_State* state)
+    {
+        luaL_getsubtable(state, LUA_REGISTRYINDEX, "_LOADED");
+    }
+
+    void SaveBaseline(lua_State* state)
+    {
+        lua_createtable(state, 2, 0);
+
+        lua_pushglobaltable(state);
+        PushShallowCopy(state, -1);
+        lua_rawseti(state, -3, 1);
+        lua_pop(state, 1);
+
+        PushLoadedTable(state);
+        PushShallowCopy(state, -1);
+        lua_rawseti(state, -3, 2);
+        lua_pop(state, 1);
+
+        lua_rawsetp(state, LUA_REGISTRYINDEX, &s_baselineKey);
+    }
+
+    void RestoreBaseline(lua_State* state)
+    {
+        lua_settop(state, 0);
+        lua_rawgetp(state, LUA_REGISTRYINDEX, &s_baselineKey);
+
+        lua_pushglobaltable(state);
+        lua_rawgeti(state, 1, 1);
+        RestoreTable(state, -2, -1);
+        lua_pop(state, 2);
+
+        PushLoadedTable(state);
+        lua_rawgeti(state, 1, 2);
+        RestoreTable(state, -2, -1);
+        lua_settop(state, 0);
+    }
+
+    double NanosecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    }
+}
+
+Cloud::LuaStatePool::Handle::Handle(Handle&& other)
+    : m_pool(other.m_pool)
+    , m_index(other.m_index)
+{
+    other.m_pool = nullptr;
+}
+
+Cloud::LuaStatePool::Handle& Cloud::LuaStatePool::Handle::operator=(Handle&& other)
+{
+    if (this != &other)
+    {
+        Release();
+        m_pool = other.m_pool;
+        m_index = other.m_index;
+        other.m_pool = nullptr;
+    }
+    return *this;
+}
+
+void Cloud::LuaStatePool::Handle::Release()
+{
+    if (m_pool)
+    {
+        m_pool->Return(m_index);
+        m_pool = nullptr;
+    }
+}
+
+Cloud::LuaStateEx& Cloud::LuaStatePool::Handle::operator*() const
+{
+    LUACPP_ASSERT(m_pool, "Dereferencing an empty LuaStatePool handle");
+    return m_pool->m_states[m_index];
+}
+
+Cloud::LuaStatePool::LuaStatePool(CLsize_t stateCount, const Initializer& initializer)
+{
+    // states are moved into place, which is fine now that nothing points back at a LuaState
+    m_states.reserve(stateCount);
+    m_free.reserve(stateCount);
+
+    for (CLsize_t i = 0; i < stateCount; ++i)
+    {
+        LuaStateEx state;
+        if (initializer)
+        {
+            initializer(state);
+        }
+        SaveBaseline(state.GetState());
+
+        m_states.push_back(std::move(state));
+        m_free.push_back(stateCount - 1 - i);
+    }
+
+    m_stats.stateCount = stateCount;
+}
+
+Cloud::LuaStatePool::~LuaStatePool()
+{
+    LUACPP_ASSERT(m_stats.inUse == 0, "LuaStatePool destroyed while states are checked out");
+}
+
+Cloud::LuaStatePool::Handle Cloud::LuaStatePool::Checkout()
+{
+    return Acquire(true);
+}
+
+Cloud::LuaStatePool::Handle Cloud::LuaStatePool::TryCheckout()
+{
+    return Acquire(false);
+}
+
+Cloud::Lua::StatePoolStats Cloud::LuaStatePool::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+Cloud::LuaStatePool::Handle Cloud::LuaStatePool::Acquire(CLbool wait)
+{
+    const auto start = Clock::now();
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (m_free.empty())
+    {
+        if (!wait)
+        {
+            return Handle();
+        }
+
+        ++m_stats.waits;
+        m_available.wait(lock, [this]() { return !m_free.empty(); });
+    }
+
+    const auto index = m_free.back();
+    m_free.pop_back();
+
+    const auto waited = NanosecondsSince(start);
+    ++m_stats.checkouts;
+    ++m_stats.inUse;
+    m_stats.peakInUse = m_stats.inUse > m_stats.peakInUse ? m_stats.inUse : m_stats.peakInUse;
+    m_stats.totalWaitNanoseconds += waited;
+    m_stats.maxWaitNanoseconds = waited > m_stats.maxWaitNanoseconds ? waited : m_stats.maxWaitNanoseconds;
+
+    return Handle(this, index);
+}
+
+void Cloud::LuaStatePool::Return(CLsize_t index)
+{
+    // reset outside the lock, the state is still exclusively ours
+    RestoreBaseline(m_states[index].GetState());
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(index);
+        --m_stats.inUse;
+    }
+    m_available.notify_one();
+}
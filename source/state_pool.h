@@ -0,0 +1,102 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_STATE_POOL_HEADER
+#define CLOUD_LUA_CPP_STATE_POOL_HEADER
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "state_ex.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        struct StatePoolStats
+        {
+            CLsize_t    stateCount          = 0;
+            CLsize_t    inUse               = 0;
+            CLsize_t    peakInUse           = 0;
+            CLsize_t    checkouts           = 0;
+            CLsize_t    waits               = 0; // checkouts that had to wait for a state
+            double      totalWaitNanoseconds = 0.0;
+            double      maxWaitNanoseconds  = 0.0;
+        };
+    }
+
+    // A fixed set of LuaStateEx, built and initialised once up front, handed out one thread at a time.
+    //
+    //   LuaStatePool pool(8, [](LuaStateEx& state) { state.DoFile("main.lua"); });
+    //   auto state = pool.Checkout();   // blocks until a state is free
+    //   state->Call<CLint>("handle", request);
+    //   // returned and reset when the handle goes out of scope
+    //
+    // After the initialiser ran, the globals and package.loaded of every state are recorded.
+    // Returning a state clears its stack and restores both tables to that baseline: globals added
+    // by a request are removed, overwritten ones are put back. The restore is shallow, changes made
+    // inside baseline tables (e.g. string.foo = ...) stay. The garbage is left to the incremental GC.
+    class LuaStatePool
+    {
+    public:
+        using Initializer = Lua::Function<void(LuaStateEx&)>;
+
+        class Handle
+        {
+        public:
+            Handle() : m_pool(nullptr), m_index(0) {}
+            Handle(const Handle&) = delete;
+            Handle(Handle&& other);
+            Handle& operator=(Handle&& other);
+            ~Handle() { Release(); }
+
+            CLbool      IsValid() const { return m_pool != nullptr; }
+            void        Release();
+
+            LuaStateEx& operator*() const;
+            LuaStateEx* operator->() const { return &**this; }
+
+        private:
+            friend class LuaStatePool;
+            Handle(LuaStatePool* pool, CLsize_t index) : m_pool(pool), m_index(index) {}
+
+            LuaStatePool*   m_pool;
+            CLsize_t        m_index;
+        };
+
+        LuaStatePool(CLsize_t stateCount, const Initializer& initializer);
+        LuaStatePool(const LuaStatePool&) = delete;
+        ~LuaStatePool();
+
+        Handle  Checkout();     // blocks until a state is free
+        Handle  TryCheckout();  // invalid handle if every state is in use
+
+        Lua::StatePoolStats GetStats() const;
+
+    private:
+        Handle  Acquire(CLbool wait);
+        void    Return(CLsize_t index);
+
+        std::vector<LuaStateEx>     m_states;
+        std::vector<CLsize_t>       m_free;
+        mutable std::mutex          m_mutex;
+        std::condition_variable     m_available;
+        Lua::StatePoolStats         m_stats;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_STATE_POOL_HEADER
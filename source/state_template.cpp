@@ -0,0 +1,664 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "state_template.h"
+
+namespace
+{
+    // registry key of the baseline: [1] = value -> path, [2] = path -> value, [3] = path -> shallow copy
+    const CLchar s_baselineKey = 0;
+
+    // levels below the registry that count as baseline, deep enough for _LOADED.io.stdout
+    const CLsize_t c_baselineDepth = 3;
+
+    enum : CLint
+    {
+        BaselineSlot = 1,
+        IndexSlot,
+        ValuesSlot,
+        SnapshotsSlot,
+        VisitedSlot,
+        ObjectsSlot,
+    };
+
+    CLbool IsReference(CLint type)
+    {
+        return type == LUA_TTABLE || type == LUA_TFUNCTION || type == LUA_TUSERDATA || type == LUA_TTHREAD;
+    }
+
+    // integer keys of the registry are references (luaL_ref) and the fixed slots, never copied
+    CLbool IsRegistryReference(lua_State* state, CLint keyIndex)
+    {
+        return lua_isinteger(state, keyIndex) != 0;
+    }
+
+    int WriteBytecode(lua_State*, const void* data, size_t size, void* userData)
+    {
+        static_cast<Cloud::Lua::String*>(userData)->append(static_cast<const CLchar*>(data), size);
+        return 0;
+    }
+}
+
+Cloud::LuaStateTemplate::LuaStateTemplate()
+    : m_stackBase(0)
+    , m_stripDebugInfo(false)
+{
+    RecordBaseline();
+}
+
+Cloud::LuaStateTemplate::LuaStateTemplate(Lua::UniquePtr<LuaAllocator> allocator)
+    : m_state(std::move(allocator))
+    , m_stackBase(0)
+    , m_stripDebugInfo(false)
+{
+    RecordBaseline();
+}
+
+void Cloud::LuaStateTemplate::RecordBaseline()
+{
+    auto* state = m_state.GetState();
+    const auto top = lua_gettop(state);
+
+    lua_createtable(state, 3, 0);
+    lua_newtable(state);
+    lua_newtable(state);
+    lua_newtable(state);
+    const auto indexTable = top + 2;
+    const auto valuesTable = top + 3;
+    const auto snapshotsTable = top + 4;
+
+    std::vector<CLsize_t> depths;
+    m_baseline.push_back({ None, Value(), Lua::String() });
+    depths.push_back(0);
+    lua_pushvalue(state, LUA_REGISTRYINDEX);
+    lua_pushinteger(state, 1);
+    lua_rawset(state, indexTable);
+    lua_pushvalue(state, LUA_REGISTRYINDEX);
+    lua_rawseti(state, valuesTable, 1);
+
+    // breadth first, so every value gets its shortest path
+    for (CLsize_t path = 0; path < m_baseline.size(); ++path)
+    {
+        lua_rawgeti(state, valuesTable, static_cast<lua_Integer>(path + 1));
+        const auto table = lua_gettop(state);
+        if (!lua_istable(state, table))
+        {
+            lua_pop(state, 1);
+            continue;
+        }
+
+        lua_newtable(state);
+        lua_pushnil(state);
+        while (lua_next(state, table) != 0)
+        {
+            const auto keyType = lua_type(state, -2);
+            const auto valueType = lua_type(state, -1);
+            const auto isPathKey = !IsReference(keyType) && !(path == 0 && IsRegistryReference(state, -2));
+
+            if (isPathKey && IsReference(valueType) && depths[path] < c_baselineDepth)
+            {
+                lua_pushvalue(state, -1);
+                if (lua_rawget(state, indexTable) == LUA_TNIL)
+                {
+                    BaselinePath child = { path, Value(), Lua::String() };
+                    switch (keyType)
+                    {
+                    case LUA_TBOOLEAN:
+                        child.key.kind = ValueKind::Boolean;
+                        child.key.boolean = lua_toboolean(state, -3) != 0;
+                        break;
+                    case LUA_TNUMBER:
+                        child.key.kind = lua_isinteger(state, -3) ? ValueKind::Integer : ValueKind::Number;
+                        if (child.key.kind == ValueKind::Integer) { child.key.integer = lua_tointeger(state, -3); }
+                        else { child.key.number = lua_tonumber(state, -3); }
+                        break;
+                    case LUA_TSTRING:
+                    {
+                        size_t length = 0;
+                        const auto* data = lua_tolstring(state, -3, &length);
+                        child.key.kind = ValueKind::String;
+                        child.keyString.assign(data, length);
+                        break;
+                    }
+                    case LUA_TLIGHTUSERDATA:
+                        child.key.kind = ValueKind::LightUserData;
+                        child.key.pointer = lua_touserdata(state, -3);
+                        break;
+                    }
+
+                    m_baseline.push_back(child);
+                    depths.push_back(depths[path] + 1);
+
+                    const auto childNumber = static_cast<lua_Integer>(m_baseline.size());
+                    lua_pushvalue(state, -2);
+                    lua_pushinteger(state, childNumber);
+                    lua_rawset(state, indexTable);
+                    lua_pushvalue(state, -2);
+                    lua_rawseti(state, valuesTable, childNumber);
+                }
+                lua_pop(state, 1);
+            }
+
+            // shallow copy into the snapshot
+            lua_pushvalue(state, -2);
+            lua_insert(state, -2);
+            lua_rawset(state, table + 1);
+        }
+
+        lua_rawseti(state, snapshotsTable, static_cast<lua_Integer>(path + 1));
+        lua_pop(state, 1);
+    }
+
+    lua_rawseti(state, top + 1, SnapshotsSlot - 1);
+    lua_rawseti(state, top + 1, ValuesSlot - 1);
+    lua_rawseti(state, top + 1, IndexSlot - 1);
+    lua_rawsetp(state, LUA_REGISTRYINDEX, &s_baselineKey);
+}
+
+CLbool Cloud::LuaStateTemplate::Capture(CLbool stripDebugInfo)
+{
+    auto* state = m_state.GetState();
+
+    m_objects.clear();
+    m_entries.clear();
+    m_upvalues.clear();
+    m_patches.clear();
+    m_strings.clear();
+    m_stats = Lua::TemplateImageStats();
+    m_baselineObjects.assign(m_baseline.size(), None);
+    m_upvalueOwners.clear();
+    m_stringIndices.clear();
+    m_stripDebugInfo = stripDebugInfo;
+
+    lua_checkstack(state, 16);
+    m_stackBase = lua_gettop(state);
+    lua_rawgetp(state, LUA_REGISTRYINDEX, &s_baselineKey);
+    lua_rawgeti(state, m_stackBase + BaselineSlot, IndexSlot - 1);
+    lua_rawgeti(state, m_stackBase + BaselineSlot, ValuesSlot - 1);
+    lua_rawgeti(state, m_stackBase + BaselineSlot, SnapshotsSlot - 1);
+    lua_newtable(state);
+    lua_newtable(state);
+
+    for (CLsize_t path = 0; path < m_baseline.size(); ++path)
+    {
+        DiffBaselineTable(state, path);
+    }
+
+    // m_objects grows while the objects found so far are walked
+    for (CLsize_t index = 0; index < m_objects.size(); ++index)
+    {
+        ProcessObject(state, index);
+    }
+
+    lua_settop(state, m_stackBase);
+    m_upvalueOwners.clear();
+    m_stringIndices.clear();
+
+    return m_stats.skippedValues == 0;
+}
+
+void Cloud::LuaStateTemplate::DiffBaselineTable(lua_State* state, CLsize_t path)
+{
+    lua_rawgeti(state, m_stackBase + SnapshotsSlot, static_cast<lua_Integer>(path + 1));
+    lua_rawgeti(state, m_stackBase + ValuesSlot, static_cast<lua_Integer>(path + 1));
+    const auto snapshot = lua_gettop(state) - 1;
+    const auto current = snapshot + 1;
+
+    if (!lua_istable(state, snapshot) || !lua_istable(state, current))
+    {
+        lua_pop(state, 2);
+        return;
+    }
+
+    // added and changed entries
+    lua_pushnil(state);
+    while (lua_next(state, current) != 0)
+    {
+        const auto skip = path == 0 && (IsRegistryReference(state, -2) || lua_touserdata(state, -2) == &s_baselineKey);
+
+        lua_pushvalue(state, -2);
+        lua_rawget(state, snapshot);
+        const auto unchanged = lua_rawequal(state, -1, -2) != 0;
+        lua_pop(state, 1);
+
+        if (!skip && !unchanged)
+        {
+            Patch patch;
+            patch.table = BaselineObject(path);
+            patch.key = Encode(state, -2);
+            patch.value = Encode(state, -1);
+            if (patch.key.kind != ValueKind::Nil)
+            {
+                m_patches.push_back(patch);
+            }
+        }
+        lua_pop(state, 1);
+    }
+
+    // removed entries
+    lua_pushnil(state);
+    while (lua_next(state, snapshot) != 0)
+    {
+        lua_pop(state, 1);
+        if (path == 0 && IsRegistryReference(state, -1))
+        {
+            continue;
+        }
+
+        lua_pushvalue(state, -1);
+        if (lua_rawget(state, current) == LUA_TNIL)
+        {
+            Patch patch;
+            patch.table = BaselineObject(path);
+            patch.key = Encode(state, -2);
+            if (patch.key.kind != ValueKind::Nil)
+            {
+                m_patches.push_back(patch);
+            }
+        }
+        lua_pop(state, 1);
+    }
+
+    m_stats.patches = m_patches.size();
+    lua_pop(state, 2);
+}
+
+Cloud::LuaStateTemplate::Value Cloud::LuaStateTemplate::Encode(lua_State* state, CLint stackIndex)
+{
+    stackIndex = lua_absindex(state, stackIndex);
+
+    Value value;
+    switch (lua_type(state, stackIndex))
+    {
+    case LUA_TNIL:
+        return value;
+
+    case LUA_TBOOLEAN:
+        value.kind = ValueKind::Boolean;
+        value.boolean = lua_toboolean(state, stackIndex) != 0;
+        return value;
+
+    case LUA_TNUMBER:
+        if (lua_isinteger(state, stackIndex))
+        {
+            value.kind = ValueKind::Integer;
+            value.integer = lua_tointeger(state, stackIndex);
+        }
+        else
+        {
+            value.kind = ValueKind::Number;
+            value.number = lua_tonumber(state, stackIndex);
+        }
+        return value;
+
+    case LUA_TSTRING:
+    {
+        size_t length = 0;
+        const auto* data = lua_tolstring(state, stackIndex, &length);
+        return AddString(data, length);
+    }
+
+    case LUA_TLIGHTUSERDATA:
+        value.kind = ValueKind::LightUserData;
+        value.pointer = lua_touserdata(state, stackIndex);
+        return value;
+    }
+
+    value.kind = ValueKind::Object;
+
+    lua_pushvalue(state, stackIndex);
+    if (lua_rawget(state, m_stackBase + VisitedSlot) != LUA_TNIL)
+    {
+        value.index = static_cast<CLsize_t>(lua_tointeger(state, -1) - 1);
+        lua_pop(state, 1);
+        return value;
+    }
+    lua_pop(state, 1);
+
+    lua_pushvalue(state, stackIndex);
+    if (lua_rawget(state, m_stackBase + IndexSlot) != LUA_TNIL)
+    {
+        value.index = BaselineObject(static_cast<CLsize_t>(lua_tointeger(state, -1) - 1));
+        lua_pop(state, 1);
+        return value;
+    }
+    lua_pop(state, 1);
+
+    switch (lua_type(state, stackIndex))
+    {
+    case LUA_TTABLE:
+        value.index = AddObject(state, stackIndex, ObjectKind::Table);
+        return value;
+
+    case LUA_TFUNCTION:
+        value.index = AddObject(state, stackIndex, lua_iscfunction(state, stackIndex) ? ObjectKind::CFunction : ObjectKind::LuaFunction);
+        return value;
+    }
+
+    ++m_stats.skippedValues;
+    return Value();
+}
+
+Cloud::LuaStateTemplate::Value Cloud::LuaStateTemplate::AddString(const CLchar* data, CLsize_t length)
+{
+    Value value;
+    value.kind = ValueKind::String;
+
+    Lua::String string(data, length);
+    auto existing = m_stringIndices.find(string);
+    if (existing != m_stringIndices.end())
+    {
+        value.index = existing->second;
+        return value;
+    }
+
+    value.index = m_strings.size();
+    m_stringIndices.emplace(string, value.index);
+    m_strings.push_back(std::move(string));
+    return value;
+}
+
+CLsize_t Cloud::LuaStateTemplate::AddObject(lua_State* state, CLint stackIndex, ObjectKind kind)
+{
+    const auto index = m_objects.size();
+    Object object;
+    object.kind = kind;
+    m_objects.push_back(object);
+
+    lua_pushvalue(state, stackIndex);
+    lua_pushinteger(state, static_cast<lua_Integer>(index + 1));
+    lua_rawset(state, m_stackBase + VisitedSlot);
+    lua_pushvalue(state, stackIndex);
+    lua_rawseti(state, m_stackBase + ObjectsSlot, static_cast<lua_Integer>(index + 1));
+
+    switch (kind)
+    {
+    case ObjectKind::Table:         ++m_stats.tables; break;
+    case ObjectKind::LuaFunction:   ++m_stats.luaFunctions; break;
+    case ObjectKind::CFunction:     ++m_stats.cFunctions; break;
+    case ObjectKind::Baseline:      break;
+    }
+
+    return index;
+}
+
+CLsize_t Cloud::LuaStateTemplate::BaselineObject(CLsize_t path)
+{
+    if (m_baselineObjects[path] != None)
+    {
+        return m_baselineObjects[path];
+    }
+
+    const auto& baseline = m_baseline[path];
+
+    Object object;
+    object.kind = ObjectKind::Baseline;
+    object.parent = baseline.parent == None ? None : BaselineObject(baseline.parent);
+    object.key = baseline.key;
+    if (object.key.kind == ValueKind::String)
+    {
+        object.key = AddString(baseline.keyString.data(), baseline.keyString.size());
+    }
+
+    m_baselineObjects[path] = m_objects.size();
+    m_objects.push_back(object);
+    ++m_stats.baselineObjects;
+
+    return m_baselineObjects[path];
+}
+
+void Cloud::LuaStateTemplate::ProcessObject(lua_State* state, CLsize_t index)
+{
+    const auto kind = m_objects[index].kind;
+    if (kind == ObjectKind::Baseline)
+    {
+        return;
+    }
+
+    lua_rawgeti(state, m_stackBase + ObjectsSlot, static_cast<lua_Integer>(index + 1));
+    const auto objectIndex = lua_gettop(state);
+
+    if (kind == ObjectKind::Table)
+    {
+        const auto first = m_entries.size();
+
+        lua_pushnil(state);
+        while (lua_next(state, objectIndex) != 0)
+        {
+            Entry entry;
+            entry.key = Encode(state, -2);
+            entry.value = Encode(state, -1);
+            if (entry.key.kind != ValueKind::Nil)
+            {
+                m_entries.push_back(entry);
+            }
+            lua_pop(state, 1);
+        }
+
+        Value metatable;
+        if (lua_getmetatable(state, objectIndex))
+        {
+            metatable = Encode(state, -1);
+            lua_pop(state, 1);
+        }
+
+        auto& object = m_objects[index];
+        object.first = first;
+        object.count = m_entries.size() - first;
+        object.arraySize = static_cast<CLint>(lua_rawlen(state, objectIndex));
+        object.metatable = metatable;
+    }
+    else
+    {
+        if (kind == ObjectKind::LuaFunction)
+        {
+            Lua::String code;
+            lua_pushvalue(state, objectIndex);
+            lua_dump(state, &WriteBytecode, &code, m_stripDebugInfo ? 1 : 0);
+            lua_pop(state, 1);
+
+            m_stats.bytecodeBytes += code.size();
+            m_objects[index].code = m_strings.size();
+            m_strings.push_back(std::move(code));
+        }
+        else
+        {
+            m_objects[index].function = lua_tocfunction(state, objectIndex);
+        }
+
+        const auto first = m_upvalues.size();
+        for (CLint n = 1; lua_getupvalue(state, objectIndex, n) != nullptr; ++n)
+        {
+            Upvalue upvalue;
+            auto* id = lua_upvalueid(state, objectIndex, n);
+            auto owner = m_upvalueOwners.find(id);
+            if (owner != m_upvalueOwners.end())
+            {
+                upvalue.sharedObject = owner->second.first;
+                upvalue.sharedIndex = owner->second.second;
+            }
+            else
+            {
+                m_upvalueOwners[id] = std::make_pair(index, n);
+                upvalue.value = Encode(state, -1);
+            }
+            lua_pop(state, 1);
+            m_upvalues.push_back(upvalue);
+        }
+
+        m_objects[index].first = first;
+        m_objects[index].count = m_upvalues.size() - first;
+    }
+
+    lua_pop(state, 1);
+}
+
+void Cloud::LuaStateTemplate::PushValue(lua_State* state, const Value& value, const std::vector<Lua::String>& strings, CLint objectsIndex)
+{
+    switch (value.kind)
+    {
+    case ValueKind::Nil:            lua_pushnil(state); break;
+    case ValueKind::Boolean:        lua_pushboolean(state, value.boolean ? 1 : 0); break;
+    case ValueKind::Integer:        lua_pushinteger(state, value.integer); break;
+    case ValueKind::Number:         lua_pushnumber(state, value.number); break;
+    case ValueKind::String:         lua_pushlstring(state, strings[value.index].data(), strings[value.index].size()); break;
+    case ValueKind::LightUserData:  lua_pushlightuserdata(state, value.pointer); break;
+    case ValueKind::Object:         lua_rawgeti(state, objectsIndex, static_cast<lua_Integer>(value.index + 1)); break;
+    }
+}
+
+Cloud::LuaStateEx Cloud::LuaStateTemplate::Fork(Lua::UniquePtr<LuaAllocator> allocator) const
+{
+    LuaStateEx fork(std::move(allocator));
+    auto* state = fork.GetState();
+
+    // everything created below stays reachable, collecting while building it is wasted work
+    lua_gc(state, LUA_GCSTOP, 0);
+    lua_checkstack(state, 8);
+    lua_createtable(state, static_cast<CLint>(m_objects.size()), 0);
+    const auto objects = lua_gettop(state);
+
+    // create every object, the references between them are filled in below
+    for (CLsize_t index = 0; index < m_objects.size(); ++index)
+    {
+        const auto& object = m_objects[index];
+        switch (object.kind)
+        {
+        case ObjectKind::Baseline:
+            if (object.parent == None)
+            {
+                lua_pushvalue(state, LUA_REGISTRYINDEX);
+                break;
+            }
+
+            lua_rawgeti(state, objects, static_cast<lua_Integer>(object.parent + 1));
+            if (lua_istable(state, -1))
+            {
+                PushValue(state, object.key, m_strings, objects);
+                lua_rawget(state, -2);
+            }
+            else
+            {
+                lua_pushnil(state);
+            }
+            lua_remove(state, -2);
+            break;
+
+        case ObjectKind::Table:
+        {
+            const auto hashSize = static_cast<CLint>(object.count) - object.arraySize;
+            lua_createtable(state, object.arraySize, hashSize > 0 ? hashSize : 0);
+            break;
+        }
+
+        case ObjectKind::LuaFunction:
+        {
+            const auto& code = m_strings[object.code];
+            if (luaL_loadbufferx(state, code.data(), code.size(), "=template", "b") != LUA_OK)
+            {
+                LUACPP_TRACE("Lua template fork error:\n%s", lua_tostring(state, -1));
+                lua_pop(state, 1);
+                lua_pushnil(state);
+            }
+            break;
+        }
+
+        case ObjectKind::CFunction:
+            for (CLsize_t n = 0; n < object.count; ++n)
+            {
+                lua_pushnil(state);
+            }
+            lua_pushcclosure(state, object.function, static_cast<CLint>(object.count));
+            break;
+        }
+
+        lua_rawseti(state, objects, static_cast<lua_Integer>(index + 1));
+    }
+
+    for (CLsize_t index = 0; index < m_objects.size(); ++index)
+    {
+        const auto& object = m_objects[index];
+        if (object.kind == ObjectKind::Baseline)
+        {
+            continue;
+        }
+
+        lua_rawgeti(state, objects, static_cast<lua_Integer>(index + 1));
+
+        if (object.kind == ObjectKind::Table)
+        {
+            for (CLsize_t i = object.first; i < object.first + object.count; ++i)
+            {
+                PushValue(state, m_entries[i].key, m_strings, objects);
+                PushValue(state, m_entries[i].value, m_strings, objects);
+                lua_rawset(state, -3);
+            }
+
+            if (object.metatable.kind != ValueKind::Nil)
+            {
+                PushValue(state, object.metatable, m_strings, objects);
+                lua_setmetatable(state, -2);
+            }
+        }
+        else if (lua_isfunction(state, -1))
+        {
+            for (CLsize_t i = 0; i < object.count; ++i)
+            {
+                const auto& upvalue = m_upvalues[object.first + i];
+                const auto n = static_cast<CLint>(i + 1);
+
+                if (upvalue.sharedObject != None)
+                {
+                    lua_rawgeti(state, objects, static_cast<lua_Integer>(upvalue.sharedObject + 1));
+                    if (lua_isfunction(state, -1) && !lua_iscfunction(state, -1))
+                    {
+                        lua_upvaluejoin(state, -2, n, -1, upvalue.sharedIndex);
+                    }
+                    lua_pop(state, 1);
+                }
+                else
+                {
+                    PushValue(state, upvalue.value, m_strings, objects);
+                    if (!lua_setupvalue(state, -2, n))
+                    {
+                        lua_pop(state, 1);
+                    }
+                }
+            }
+        }
+
+        lua_pop(state, 1);
+    }
+
+    for (const auto& patch : m_patches)
+    {
+        lua_rawgeti(state, objects, static_cast<lua_Integer>(patch.table + 1));
+        if (lua_istable(state, -1))
+        {
+            PushValue(state, patch.key, m_strings, objects);
+            PushValue(state, patch.value, m_strings, objects);
+            lua_rawset(state, -3);
+        }
+        lua_pop(state, 1);
+    }
+
+    lua_pop(state, 1);
+    lua_gc(state, LUA_GCRESTART, 0);
+    fork.m_functions = m_state.m_functions;
+
+    return fork;
+}
@@ -0,0 +1,183 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_STATE_TEMPLATE_HEADER
+#define CLOUD_LUA_CPP_STATE_TEMPLATE_HEADER
+
+#include <vector>
+#include "state_ex.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        struct TemplateImageStats
+        {
+            CLsize_t    tables          = 0;
+            CLsize_t    luaFunctions    = 0;
+            CLsize_t    cFunctions      = 0;
+            CLsize_t    baselineObjects = 0; // references to values every fresh state already has
+            CLsize_t    patches         = 0; // entries added to or changed in the baseline tables
+            CLsize_t    bytecodeBytes   = 0;
+            CLsize_t    skippedValues   = 0; // full userdata and coroutines, forks see nil instead
+        };
+    }
+
+    // Builds new states from a fully initialised template without running its scripts again.
+    //
+    //   LuaStateTemplate stateTemplate;
+    //   stateTemplate.GetState().RegisterFunction<&Log>("log");
+    //   stateTemplate.GetState().DoFile("init.lua");
+    //   stateTemplate.Capture();
+    //   LuaStateEx state = stateTemplate.Fork();
+    //
+    // On construction the template records what a fresh state contains: every table and function
+    // reachable from the registry within a few levels (globals, package.loaded, the libraries).
+    // Capture() diffs the template against that baseline and stores what was added or changed as a
+    // flat image: tables, Lua functions as bytecode with their upvalues (shared upvalues stay shared),
+    // C functions and closures, and the edits to the baseline tables, which covers globals, loaded
+    // modules and registered functions and user types. Fork() opens a fresh state and replays the
+    // image, nothing is parsed or run.
+    //
+    // Values that can't be copied (full userdata, coroutines) become nil and are counted in the stats,
+    // light userdata are copied as plain pointers. Lua::Function bindings are shared with the template,
+    // so forks may outlive it.
+    // Fork() only reads the image and may run on several threads at once, Capture() may not.
+    class LuaStateTemplate
+    {
+    public:
+        LuaStateTemplate();
+        explicit LuaStateTemplate(Lua::UniquePtr<LuaAllocator> allocator);
+        LuaStateTemplate(const LuaStateTemplate&) = delete;
+
+        LuaStateEx&         GetState() { return m_state; }
+
+        // (re)builds the image from the current template state, false if values had to be skipped.
+        // Stripping drops line info from the bytecode: smaller image, faster forks, no line numbers
+        // in errors. It matters most for chunks loaded from strings, their source text is the chunk name.
+        CLbool              Capture(CLbool stripDebugInfo = false);
+        LuaStateEx          Fork(Lua::UniquePtr<LuaAllocator> allocator = nullptr) const;
+
+        const Lua::TemplateImageStats& GetImageStats() const { return m_stats; }
+
+    private:
+        static constexpr CLsize_t None = ~CLsize_t(0);
+
+        enum class ValueKind : CLchar
+        {
+            Nil,
+            Boolean,
+            Integer,
+            Number,
+            String,
+            LightUserData,
+            Object,
+        };
+
+        struct Value
+        {
+            Value() : kind(ValueKind::Nil), integer(0) {}
+
+            ValueKind kind;
+            union
+            {
+                CLbool      boolean;
+                lua_Integer integer;
+                lua_Number  number;
+                void*       pointer;
+                CLsize_t    index;      // into m_strings or m_objects
+            };
+        };
+
+        enum class ObjectKind : CLchar
+        {
+            Baseline,       // parent[key] in the fresh state, the registry if parent is None
+            Table,
+            LuaFunction,
+            CFunction,
+        };
+
+        struct Object
+        {
+            ObjectKind      kind        = ObjectKind::Table;
+            CLsize_t        parent      = None;
+            Value           key;
+            Value           metatable;
+            CLsize_t        first       = 0;    // entries for tables, upvalues for functions
+            CLsize_t        count       = 0;
+            CLint           arraySize   = 0;
+            lua_CFunction   function    = nullptr;
+            CLsize_t        code        = 0;    // bytecode in m_strings
+        };
+
+        struct Entry
+        {
+            Value key;
+            Value value;
+        };
+
+        struct Upvalue
+        {
+            Value       value;
+            CLsize_t    sharedObject = None;    // joined with an upvalue of an earlier function
+            CLint       sharedIndex = 0;
+        };
+
+        struct Patch
+        {
+            CLsize_t    table;
+            Value       key;
+            Value       value;
+        };
+
+        struct BaselinePath
+        {
+            CLsize_t    parent;
+            Value       key;
+            Lua::String keyString;
+        };
+
+        void        RecordBaseline();
+        Value       Encode(lua_State* state, CLint stackIndex);
+        CLsize_t    AddObject(lua_State* state, CLint stackIndex, ObjectKind kind);
+        CLsize_t    BaselineObject(CLsize_t path);
+        void        ProcessObject(lua_State* state, CLsize_t index);
+        void        DiffBaselineTable(lua_State* state, CLsize_t path);
+        Value       AddString(const CLchar* data, CLsize_t length);
+
+        static void PushValue(lua_State* state, const Value& value, const std::vector<Lua::String>& strings, CLint objectsIndex);
+
+        LuaStateEx                  m_state;
+        std::vector<BaselinePath>   m_baseline;
+
+        std::vector<Object>         m_objects;
+        std::vector<Entry>          m_entries;
+        std::vector<Upvalue>        m_upvalues;
+        std::vector<Patch>          m_patches;
+        std::vector<Lua::String>    m_strings;
+        Lua::TemplateImageStats     m_stats;
+
+        // only used while capturing
+        std::vector<CLsize_t>       m_baselineObjects;
+        Lua::UnorderedMap<void*, std::pair<CLsize_t, CLint>> m_upvalueOwners;
+        Lua::UnorderedMap<Lua::String, CLsize_t> m_stringIndices;
+        CLint                       m_stackBase;
+        CLbool                      m_stripDebugInfo;
+    };
+}
+
+#endif // CLOUD_LUA_CPP_STATE_TEMPLATE_HEADER
@@ -0,0 +1,312 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_THREAD_HEADER
+#define CLOUD_LUA_CPP_THREAD_HEADER
+
+#include "function_ref.h"
+#include "coroutine.h"
+
+namespace Cloud
+{
+    namespace Lua
+    {
+        enum class ThreadStatus
+        {
+            Suspended,  // not started yet or yielded, Resume continues it
+            Running,    // inside a resume, either running or resuming another coroutine
+            Dead,       // returned or failed, see LuaThread::GetLastError
+        };
+    }
+
+    // Resume<>() returns nothing, Resume<_T>() a _T and Resume<_T0, _T1, ...>() a tuple
+    template <typename... _Types>
+    struct LuaResumeResult
+    {
+        using Type = std::tuple<_Types...>;
+    };
+
+    template <typename _T>
+    struct LuaResumeResult<_T>
+    {
+        using Type = _T;
+    };
+
+    template <>
+    struct LuaResumeResult<>
+    {
+        using Type = void;
+    };
+
+#ifdef LUACPP_HAS_COROUTINES
+    template <typename _Result>
+    class LuaResumeAwaiter;
+#endif
+
+    // A coroutine running a Lua function on its own lua_State (lua_newthread), pinned in the
+    // registry of the state it was created from. Creating one costs a small allocation and a
+    // registry slot, so thousands of them per state are fine.
+    //
+    //   LuaThread behaviour = state.NewThread("patrol");
+    //   while (behaviour.GetStatus() == Lua::ThreadStatus::Suspended)
+    //   {
+    //       CLint wait = behaviour.Resume<CLint>(dt);
+    //   }
+    //
+    // The function yields with coroutine.yield or by calling a bound function returning LuaYield.
+    // Resume results are the yielded or returned values, adjusted to the requested count.
+    // Must be destroyed before the state it was created from.
+    class LuaThread
+    {
+    public:
+        LuaThread()
+            : m_owner(nullptr)
+            , m_thread(nullptr)
+            , m_ref(LUA_NOREF)
+            , m_lastError(Lua::ErrorCode::Ok)
+        {}
+
+        // starts a coroutine for the function at stackIndex, the stack itself is left untouched
+        LuaThread(lua_State* state, CLint stackIndex)
+            : m_owner(state)
+            , m_lastError(Lua::ErrorCode::Ok)
+        {
+            stackIndex = lua_absindex(state, stackIndex);
+            m_thread = lua_newthread(state);
+            lua_pushvalue(state, stackIndex);
+            lua_xmove(state, m_thread, 1);
+            m_ref = luaL_ref(state, LUA_REGISTRYINDEX);
+        }
+
+        LuaThread(const LuaThread&) = delete;
+
+        LuaThread(LuaThread&& other)
+            : m_owner(other.m_owner)
+            , m_thread(other.m_thread)
+            , m_ref(other.m_ref)
+            , m_lastError(other.m_lastError)
+        {
+            other.m_thread = nullptr;
+            other.m_ref = LUA_NOREF;
+        }
+
+        LuaThread& operator=(LuaThread&& other)
+        {
+            if (this != &other)
+            {
+                Reset();
+                m_owner = other.m_owner;
+                m_thread = other.m_thread;
+                m_ref = other.m_ref;
+                m_lastError = other.m_lastError;
+                other.m_thread = nullptr;
+                other.m_ref = LUA_NOREF;
+            }
+            return *this;
+        }
+
+        ~LuaThread()
+        {
+            Reset();
+        }
+
+        void Reset()
+        {
+            if (m_owner && m_ref != LUA_NOREF)
+            {
+                luaL_unref(m_owner, LUA_REGISTRYINDEX, m_ref);
+            }
+            m_thread = nullptr;
+            m_ref = LUA_NOREF;
+        }
+
+        CLbool          IsValid() const { return m_thread != nullptr; }
+        Lua::ErrorCode  GetLastError() const { return m_lastError; } // Yield while suspended, Ok once returned
+
+        // same rules as coroutine.status
+        Lua::ThreadStatus GetStatus() const
+        {
+            LUACPP_ASSERT(IsValid(), "LuaThread: querying an empty thread");
+
+            switch (lua_status(m_thread))
+            {
+            case LUA_YIELD:
+                return Lua::ThreadStatus::Suspended;
+            case LUA_OK:
+            {
+                lua_Debug frame;
+                if (lua_getstack(m_thread, 0, &frame) > 0)
+                {
+                    return Lua::ThreadStatus::Running;
+                }
+                return lua_gettop(m_thread) > 0 ? Lua::ThreadStatus::Suspended : Lua::ThreadStatus::Dead;
+            }
+            default:
+                return Lua::ThreadStatus::Dead;
+            }
+        }
+
+        CLbool IsSuspended() const { return GetStatus() == Lua::ThreadStatus::Suspended; }
+        CLbool IsDead() const { return GetStatus() == Lua::ThreadStatus::Dead; }
+
+        // Starts or continues the coroutine with args, which are the function's arguments on the first
+        // resume and the results of the pending yield afterwards. On error (including resuming a dead
+        // coroutine) the message is traced and popped, GetLastError() has the code and a default
+        // constructed result is returned. An argument of an unregistered user type and results that
+        // aren't of the user type asked for fail with ErrRun, the latter after the coroutine ran.
+        template <typename... _Returns, typename... _Args>
+        typename LuaResumeResult<_Returns...>::Type Resume(_Args&&... args)
+        {
+            constexpr auto argCount = static_cast<CLint>(sizeof...(_Args));
+
+            LUACPP_ASSERT(IsValid(), "LuaThread: resuming an empty thread");
+            if (!CheckResumable() || !CheckArgs<_Args...>())
+            {
+                return Finish<typename LuaResumeResult<_Returns...>::Type>(LUA_ERRRUN);
+            }
+
+            lua_checkstack(m_thread, argCount + LuaReturn<typename LuaResumeResult<_Returns...>::Type>::Count);
+            (LuaStack<std::decay_t<_Args>>::Push(m_thread, args), ...);
+
+            return Finish<typename LuaResumeResult<_Returns...>::Type>(lua_resume(m_thread, m_owner, argCount));
+        }
+
+#ifdef LUACPP_HAS_COROUTINES
+        // co_await thread.ResumeAsync<CLint>(args...) is Resume for C++ coroutines. Bound functions returning
+        // a LuaTask suspend the Lua coroutine until the task finishes, the awaiting coroutine continues
+        // once Lua yields, returns or fails. One thread can keep any number of LuaThreads in flight this way.
+        template <typename... _Returns, typename... _Args>
+        LuaResumeAwaiter<typename LuaResumeResult<_Returns...>::Type> ResumeAsync(_Args&&... args)
+        {
+            using Awaiter = LuaResumeAwaiter<typename LuaResumeResult<_Returns...>::Type>;
+            constexpr auto argCount = static_cast<CLint>(sizeof...(_Args));
+
+            LUACPP_ASSERT(IsValid(), "LuaThread: resuming an empty thread");
+            if (!CheckResumable() || !CheckArgs<_Args...>())
+            {
+                return Awaiter(*this, Awaiter::NotResumable);
+            }
+
+            lua_checkstack(m_thread, argCount + LuaReturn<typename LuaResumeResult<_Returns...>::Type>::Count);
+            (LuaStack<std::decay_t<_Args>>::Push(m_thread, args), ...);
+
+            return Awaiter(*this, argCount);
+        }
+#endif
+
+    private:
+#ifdef LUACPP_HAS_COROUTINES
+        template <typename _Result>
+        friend class LuaResumeAwaiter;
+#endif
+
+        // lua_resume would take the first argument for the function to run on a coroutine that
+        // returned, so this is checked up front. Like coroutine.resume, anything but a suspended
+        // coroutine is refused with the message pushed on the thread for Finish.
+        CLbool CheckResumable()
+        {
+            const auto status = GetStatus();
+            if (status == Lua::ThreadStatus::Suspended)
+            {
+                return true;
+            }
+
+            lua_pushstring(m_thread, status == Lua::ThreadStatus::Dead ? "cannot resume dead coroutine" : "cannot resume non-suspended coroutine");
+            return false;
+        }
+
+        // pushing a user type that isn't registered would raise outside a protected call, refused the
+        // same way with the message on the thread
+        template <typename... _Args>
+        CLbool CheckArgs()
+        {
+            if ((LuaHostStack<std::decay_t<_Args>>::CanPush(m_thread) && ...))
+            {
+                return true;
+            }
+
+            lua_pushliteral(m_thread, "argument of an unregistered user type");
+            return false;
+        }
+
+        // reads the results of a resume that returned status
+        template <typename _Result>
+        _Result Finish(CLint status)
+        {
+            using Result = LuaReturn<_Result>;
+
+            m_lastError = static_cast<Lua::ErrorCode>(status);
+            if (m_lastError != Lua::ErrorCode::Ok && m_lastError != Lua::ErrorCode::Yield)
+            {
+                LUACPP_TRACE("Lua thread error:\n%s", lua_isstring(m_thread, -1) ? lua_tostring(m_thread, -1) : "<no message>");
+                lua_pop(m_thread, 1);
+                return Result::Default();
+            }
+
+            // only the results are on the stack now, they have to be gone before the next resume
+            lua_settop(m_thread, Result::Count);
+            if (!Result::CanRead(m_thread))
+            {
+                LUACPP_TRACE("Lua thread error:\nresult of the wrong type");
+                m_lastError = Lua::ErrorCode::ErrRun;
+                lua_settop(m_thread, 0);
+                return Result::Default();
+            }
+            return Result::Pop(m_thread);
+        }
+
+        lua_State*      m_owner;
+        lua_State*      m_thread;
+        CLint           m_ref;
+        Lua::ErrorCode  m_lastError;
+    };
+
+#ifdef LUACPP_HAS_COROUTINES
+    // what LuaThread::ResumeAsync returns, lives in the awaiting coroutine's frame while Lua runs
+    template <typename _Result>
+    class LuaResumeAwaiter : public LuaAsyncDriver
+    {
+    public:
+        static constexpr CLint NotResumable = -1; // the thread refused the resume, its message is on the stack
+
+        LuaResumeAwaiter(LuaThread& thread, CLint argCount)
+            : LuaAsyncDriver(thread.m_thread, thread.m_owner)
+            , m_luaThread(thread)
+            , m_argCount(argCount)
+        {}
+
+        CLbool await_ready() const { return m_argCount == NotResumable; }
+
+        CLbool await_suspend(std::coroutine_handle<> awaiting)
+        {
+            m_continuation = awaiting;
+            return !Step(m_argCount);
+        }
+
+        _Result await_resume()
+        {
+            return m_luaThread.template Finish<_Result>(m_argCount == NotResumable ? LUA_ERRRUN : GetStatus());
+        }
+
+    private:
+        LuaThread&  m_luaThread;
+        CLint       m_argCount;
+    };
+#endif
+}
+
+#endif // CLOUD_LUA_CPP_THREAD_HEADER
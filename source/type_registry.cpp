@@ -0,0 +1,80 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "type_registry.h"
+
+#include <atomic>
+
+namespace
+{
+    std::atomic<CLsize_t> s_nextId(0);
+    std::atomic<const Cloud::LuaTypeInfo*> s_head(nullptr);
+}
+
+Cloud::LuaTypeInfo::LuaTypeInfo(const CLchar* typeName)
+    : id(LuaTypeRegistry::NextId())
+    , name(typeName)
+    , next(nullptr)
+{
+    LuaTypeRegistry::Link(this);
+}
+
+const Cloud::LuaTypeInfo* Cloud::LuaTypeRegistry::Find(const void* tag)
+{
+    for (auto* info = s_head.load(std::memory_order_acquire); info; info = info->next)
+    {
+        if (info == tag)
+        {
+            return info;
+        }
+    }
+
+    return nullptr;
+}
+
+const Cloud::LuaTypeInfo* Cloud::LuaTypeRegistry::Find(CLsize_t id)
+{
+    for (auto* info = s_head.load(std::memory_order_acquire); info; info = info->next)
+    {
+        if (info->id == id)
+        {
+            return info;
+        }
+    }
+
+    return nullptr;
+}
+
+CLsize_t Cloud::LuaTypeRegistry::GetCount()
+{
+    return s_nextId.load(std::memory_order_relaxed);
+}
+
+CLsize_t Cloud::LuaTypeRegistry::NextId()
+{
+    return s_nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Cloud::LuaTypeRegistry::Link(LuaTypeInfo* info)
+{
+    auto* head = s_head.load(std::memory_order_relaxed);
+    do
+    {
+        info->next = head;
+    }
+    while (!s_head.compare_exchange_weak(head, info, std::memory_order_release, std::memory_order_relaxed));
+}
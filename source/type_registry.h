@@ -0,0 +1,64 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_TYPE_REGISTRY_HEADER
+#define CLOUD_LUA_CPP_TYPE_REGISTRY_HEADER
+
+#include "config.h"
+
+namespace Cloud
+{
+    // One per C++ type and process, shared by every state and thread.
+    // Its address is the type tag stored in userdata headers.
+    struct LuaTypeInfo
+    {
+        explicit LuaTypeInfo(const CLchar* typeName);
+        LuaTypeInfo(const LuaTypeInfo&) = delete;
+
+        const CLsize_t      id;
+        const CLchar* const name;
+        const LuaTypeInfo*  next;
+    };
+
+    // Lock-free type registry. Ids come from an atomic counter on first use of a type,
+    // every info is pushed onto an intrusive list with a compare-exchange and never removed,
+    // so lookups walk the list without taking a lock.
+    class LuaTypeRegistry
+    {
+    public:
+        template <typename _T>
+        static const LuaTypeInfo* Get()
+        {
+            static const LuaTypeInfo info(typeid(_T).name());
+            return &info;
+        }
+
+        // nullptr if tag doesn't belong to a registered type, tag is never dereferenced
+        static const LuaTypeInfo* Find(const void* tag);
+        static const LuaTypeInfo* Find(CLsize_t id);
+
+        static CLsize_t GetCount();
+
+    private:
+        friend struct LuaTypeInfo;
+
+        static CLsize_t NextId();
+        static void     Link(LuaTypeInfo* info);
+    };
+}
+
+#endif // CLOUD_LUA_CPP_TYPE_REGISTRY_HEADER
@@ -0,0 +1,77 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_USER_DATA_HEADER
+#define CLOUD_LUA_CPP_USER_DATA_HEADER
+
+#include "luacpp.h"
+#include "type_registry.h"
+
+namespace Cloud
+{
+    // Every full userdata created by LuaCpp starts with this header. The type info travels with
+    // the value, so a checked cast is a size check and a pointer compare, no global lookup.
+    // object points right behind the header for owned objects, or anywhere for boxed pointers.
+    struct LuaUserDataHeader
+    {
+        const LuaTypeInfo*  type;
+        void*               object;
+    };
+
+    struct LuaUserData
+    {
+        // header of the full userdata at stackIndex, nullptr for anything else
+        static LuaUserDataHeader* GetHeader(lua_State* state, CLint stackIndex)
+        {
+            if (lua_type(state, stackIndex) != LUA_TUSERDATA || lua_rawlen(state, stackIndex) < sizeof(LuaUserDataHeader))
+            {
+                return nullptr;
+            }
+
+            return static_cast<LuaUserDataHeader*>(lua_touserdata(state, stackIndex));
+        }
+
+        // the _T at stackIndex, nullptr if it isn't one
+        template <typename _T>
+        static _T* Test(lua_State* state, CLint stackIndex)
+        {
+            auto* header = GetHeader(state, stackIndex);
+            return header && header->type == LuaTypeRegistry::Get<_T>() ? static_cast<_T*>(header->object) : nullptr;
+        }
+
+        // pushes a new userdata with room for a _T behind the header, returns the object storage
+        template <typename _T>
+        static void* NewObject(lua_State* state)
+        {
+            auto* header = static_cast<LuaUserDataHeader*>(lua_newuserdata(state, sizeof(LuaUserDataHeader) + sizeof(_T)));
+            header->type = LuaTypeRegistry::Get<_T>();
+            header->object = header + 1;
+            return header->object;
+        }
+
+        // pushes a tagged, non-owning box around pointer
+        template <typename _T>
+        static void PushPointer(lua_State* state, _T* pointer)
+        {
+            auto* header = static_cast<LuaUserDataHeader*>(lua_newuserdata(state, sizeof(LuaUserDataHeader)));
+            header->type = LuaTypeRegistry::Get<_T>();
+            header->object = pointer;
+        }
+    };
+}
+
+#endif // CLOUD_LUA_CPP_USER_DATA_HEADER
@@ -0,0 +1,334 @@
+/*
+* LuaCpp
+* 
+* Copyright (c) 2016 Robin Doeleman
+* 
+* Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+* 
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+* 
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, 
+* DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE 
+* OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef CLOUD_LUA_CPP_USER_TYPE_HEADER
+#define CLOUD_LUA_CPP_USER_TYPE_HEADER
+
+#include <new>
+#include "function.h"
+
+namespace Cloud
+{
+    template <typename _Signature, _Signature _Method>
+    struct LuaUserTypeMethodImpl;
+
+    template <typename _Signature, _Signature _Member>
+    struct LuaUserTypePropertyImpl;
+
+    // Binds a C++ class to Lua. Objects live inside full userdata (placement new, behind a
+    // LuaUserDataHeader) and share one metatable per type and state, __gc runs the destructor.
+    //
+    //   state.RegisterUserType<Vec2>("Vec2")
+    //       .Constructor<CLfloat, CLfloat>()   // Vec2.new(x, y)
+    //       .Method<&Vec2::Length>("length")   // v:length()
+    //       .Property<&Vec2::x>("x");          // v.x, v.x = 1
+    //
+    // The metatable holds three precomputed tables: methods, property getters and property setters.
+    // Without properties __index is the methods table itself, so method lookup stays inside the VM.
+    // With properties __index/__newindex are C closures doing a raw lookup in those tables and
+    // calling the accessor directly.
+    // The methods table is also published as the global typeName. getmetatable(object) returns false,
+    // an object whose destructor already ran fails every Check with a Lua error.
+    template <class _T>
+    class LuaUserType
+    {
+    public:
+        LuaUserType(lua_State* state, const CLchar* typeName)
+            : m_state(state)
+        {
+            lua_createtable(state, 0, 6);
+
+            lua_pushstring(state, typeName);
+            lua_setfield(state, -2, "__name");
+
+            lua_createtable(state, 0, 8);
+            lua_pushvalue(state, -1);
+            lua_rawseti(state, -3, MethodsSlot);
+            lua_pushvalue(state, -1);
+            lua_setglobal(state, typeName);
+            lua_setfield(state, -2, "__index");
+
+            lua_newtable(state);
+            lua_rawseti(state, -2, GettersSlot);
+            lua_newtable(state);
+            lua_rawseti(state, -2, SettersSlot);
+
+            lua_pushcfunction(state, &LuaUserType::Destroy);
+            lua_setfield(state, -2, "__gc");
+
+            // scripts could otherwise call __gc themselves or swap the metamethods
+            lua_pushboolean(state, 0);
+            lua_setfield(state, -2, "__metatable");
+
+            lua_rawsetp(state, LUA_REGISTRYINDEX, Key());
+        }
+
+        // TypeName.new(args...)
+        template <typename... _Args>
+        LuaUserType& Constructor()
+        {
+            SetFunction(MethodsSlot, "new", &LuaUserType::Construct<_Args...>);
+            return *this;
+        }
+
+        // obj:name(args...)
+        template <auto _Method>
+        LuaUserType& Method(const CLchar* name)
+        {
+            SetFunction(MethodsSlot, name, &LuaUserTypeMethodImpl<decltype(_Method), _Method>::Invoke);
+            return *this;
+        }
+
+        // obj.name and obj.name = value
+        template <auto _Member>
+        LuaUserType& Property(const CLchar* name)
+        {
+            SetFunction(GettersSlot, name, &LuaUserTypePropertyImpl<decltype(_Member), _Member>::Get);
+            SetFunction(SettersSlot, name, &LuaUserTypePropertyImpl<decltype(_Member), _Member>::Set);
+            EnablePropertyDispatch();
+            return *this;
+        }
+
+        template <auto _Member>
+        LuaUserType& ReadOnlyProperty(const CLchar* name)
+        {
+            SetFunction(GettersSlot, name, &LuaUserTypePropertyImpl<decltype(_Member), _Member>::Get);
+            EnablePropertyDispatch();
+            return *this;
+        }
+
+        // registry key of the metatable, unique per type
+        static const void* Key()
+        {
+            return LuaTypeRegistry::Get<_T>();
+        }
+
+        // whether RegisterUserType<_T> ran in this state, Emplace needs it
+        static CLbool IsRegistered(lua_State* state)
+        {
+            const auto registered = lua_rawgetp(state, LUA_REGISTRYINDEX, Key()) == LUA_TTABLE;
+            lua_pop(state, 1);
+            return registered;
+        }
+
+        // constructs a _T inside a new full userdata and pushes it, raises a Lua error if _T isn't
+        // registered in this state since the destructor would never run
+        template <typename... _Args>
+        static _T* Emplace(lua_State* state, _Args&&... args)
+        {
+            if (lua_rawgetp(state, LUA_REGISTRYINDEX, Key()) != LUA_TTABLE)
+            {
+                lua_pop(state, 1);
+                luaL_error(state, "LuaUserType: pushing an object of unregistered type '%s'", LuaTypeRegistry::Get<_T>()->name);
+                return nullptr;
+            }
+
+            auto* object = new (LuaUserData::NewObject<_T>(state)) _T(std::forward<_Args>(args)...);
+            lua_insert(state, -2);
+            lua_setmetatable(state, -2);
+
+            return object;
+        }
+
+        // the object at stackIndex, nullptr if it isn't a _T; never raises, for the host side
+        static _T* Test(lua_State* state, CLint stackIndex)
+        {
+            return LuaUserData::Test<_T>(state, stackIndex);
+        }
+
+        // the object at stackIndex, raises a Lua argument error if it isn't a _T, only inside a
+        // protected call (the trampolines)
+        static _T* Check(lua_State* state, CLint stackIndex)
+        {
+            auto* object = Test(state, stackIndex);
+            if (!object)
+            {
+                const CLchar* typeName = "<unregistered type>";
+                if (lua_rawgetp(state, LUA_REGISTRYINDEX, Key()) == LUA_TTABLE)
+                {
+                    lua_getfield(state, -1, "__name");
+                    typeName = lua_tostring(state, -1);
+                }
+
+                const auto* header = LuaUserData::GetHeader(state, stackIndex);
+                if (header && header->type == Key())
+                {
+                    luaL_argerror(state, stackIndex, lua_pushfstring(state, "%s was already destroyed", typeName));
+                }
+                luaL_argerror(state, stackIndex, lua_pushfstring(state, "%s expected, got %s", typeName, luaL_typename(state, stackIndex)));
+            }
+
+            return object;
+        }
+
+    private:
+        enum : CLint
+        {
+            MethodsSlot = 1,
+            GettersSlot = 2,
+            SettersSlot = 3,
+        };
+
+        void PushMetatable()
+        {
+            lua_rawgetp(m_state, LUA_REGISTRYINDEX, Key());
+        }
+
+        void SetFunction(CLint slot, const CLchar* name, lua_CFunction function)
+        {
+            PushMetatable();
+            lua_rawgeti(m_state, -1, slot);
+            lua_pushcfunction(m_state, function);
+            lua_setfield(m_state, -2, name);
+            lua_pop(m_state, 2);
+        }
+
+        void EnablePropertyDispatch()
+        {
+            PushMetatable();
+
+            lua_rawgeti(m_state, -1, MethodsSlot);
+            lua_rawgeti(m_state, -2, GettersSlot);
+            lua_pushcclosure(m_state, &LuaUserType::Index, 2);
+            lua_setfield(m_state, -2, "__index");
+
+            lua_rawgeti(m_state, -1, SettersSlot);
+            lua_pushcclosure(m_state, &LuaUserType::NewIndex, 1);
+            lua_setfield(m_state, -2, "__newindex");
+
+            lua_pop(m_state, 1);
+        }
+
+        // [object, key], upvalues: methods, getters
+        static int Index(lua_State* state)
+        {
+            lua_pushvalue(state, 2);
+            if (lua_rawget(state, lua_upvalueindex(1)) != LUA_TNIL)
+            {
+                return 1;
+            }
+            lua_pop(state, 1);
+
+            lua_pushvalue(state, 2);
+            lua_rawget(state, lua_upvalueindex(2));
+            auto getter = lua_tocfunction(state, -1);
+            lua_pop(state, 1);
+
+            if (!getter)
+            {
+                lua_pushnil(state);
+                return 1;
+            }
+
+            return getter(state);
+        }
+
+        // [object, key, value], upvalues: setters
+        static int NewIndex(lua_State* state)
+        {
+            lua_pushvalue(state, 2);
+            lua_rawget(state, lua_upvalueindex(1));
+            auto setter = lua_tocfunction(state, -1);
+            lua_pop(state, 1);
+
+            if (!setter)
+            {
+                const auto* typeName = luaL_getmetafield(state, 1, "__name") == LUA_TSTRING ? lua_tostring(state, -1) : luaL_typename(state, 1);
+                return luaL_error(state, "'%s' has no writable property '%s'", typeName, lua_tostring(state, 2));
+            }
+
+            return setter(state);
+        }
+
+        // only owned objects are destroyed, and only once: the object pointer is cleared afterwards
+        static int Destroy(lua_State* state)
+        {
+            auto* header = LuaUserData::GetHeader(state, 1);
+            if (header && header->type == Key() && header->object == header + 1)
+            {
+                static_cast<_T*>(header->object)->~_T();
+                header->object = nullptr;
+            }
+            return 0;
+        }
+
+        template <typename... _Args, CLsize_t... _N>
+        static int Construct(lua_State* state, Indices<_N...>)
+        {
+            LUACPP_UNUSED(state);
+            Emplace(state, LuaStack<std::decay_t<_Args>>::To(state, static_cast<CLint>(_N) + 1)...);
+            return 1;
+        }
+
+        template <typename... _Args>
+        static int Construct(lua_State* state)
+        {
+            return Construct<_Args...>(state, IndicesBuilderType<sizeof...(_Args)>());
+        }
+
+        lua_State* m_state;
+    };
+
+    // self is stack index 1 (colon call), arguments follow
+    template <typename _Class, typename _Return, typename... _Args, _Return(_Class::*_Method)(_Args...)>
+    struct LuaUserTypeMethodImpl<_Return(_Class::*)(_Args...), _Method>
+    {
+        static CLint Invoke(lua_State* state)
+        {
+            auto* self = LuaUserType<_Class>::Check(state, 1);
+            return LuaNativeInvoker<_Return, _Args...>::Apply(state, [self](auto&&... args) -> _Return
+            {
+                return (self->*_Method)(std::forward<decltype(args)>(args)...);
+            }, 2);
+        }
+    };
+
+    template <typename _Class, typename _Return, typename... _Args, _Return(_Class::*_Method)(_Args...) const>
+    struct LuaUserTypeMethodImpl<_Return(_Class::*)(_Args...) const, _Method>
+    {
+        static CLint Invoke(lua_State* state)
+        {
+            const auto* self = LuaUserType<_Class>::Check(state, 1);
+            return LuaNativeInvoker<_Return, _Args...>::Apply(state, [self](auto&&... args) -> _Return
+            {
+                return (self->*_Method)(std::forward<decltype(args)>(args)...);
+            }, 2);
+        }
+    };
+
+    template <typename _Class, typename _Value, _Value _Class::*_Member>
+    struct LuaUserTypePropertyImpl<_Value _Class::*, _Member>
+    {
+        // [object, key]
+        static CLint Get(lua_State* state)
+        {
+            const auto* self = LuaUserType<_Class>::Check(state, 1);
+            LuaStack<_Value>::Push(state, self->*_Member);
+            return 1;
+        }
+
+        // [object, key, value]
+        static CLint Set(lua_State* state)
+        {
+            auto* self = LuaUserType<_Class>::Check(state, 1);
+            self->*_Member = LuaStack<_Value>::To(state, 3);
+            return 0;
+        }
+    };
+}
+
+#endif // CLOUD_LUA_CPP_USER_TYPE_HEADER
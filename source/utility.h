@@ -19,6 +19,7 @@
 #define CLOUD_LUA_CPP_UTILITY_HEADER
 
 #include <utility>
+#include <cstdint>
 #include "config.h"
 
 namespace Cloud
@@ -37,6 +38,49 @@ namespace Cloud
 
     template<CLsize_t _IndexCount>
     using IndicesBuilderType = typename IndicesBuilder<_IndexCount>::Type;
+
+    namespace Lua
+    {
+        // 64-bit FNV-1a, cheap content hash for cache keys, not for anything adversarial
+        inline std::uint64_t Fnv1a(const void* data, CLsize_t size, std::uint64_t hash = 14695981039346656037ull)
+        {
+            const auto* bytes = static_cast<const unsigned char*>(data);
+            for (CLsize_t i = 0; i < size; ++i)
+            {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        // Non-owning view over contiguous elements, converts from anything with data() and size()
+        template <typename _T>
+        class Span
+        {
+        public:
+            Span() : m_data(nullptr), m_size(0) {}
+            Span(_T* data, CLsize_t size) : m_data(data), m_size(size) {}
+
+            template <CLsize_t _N>
+            Span(_T (&data)[_N]) : m_data(data), m_size(_N) {}
+
+            template <typename _Container, typename = decltype(std::declval<_Container&>().data())>
+            Span(_Container& container) : m_data(container.data()), m_size(container.size()) {}
+
+            _T*         data() const { return m_data; }
+            CLsize_t    size() const { return m_size; }
+            CLbool      empty() const { return m_size == 0; }
+
+            _T*         begin() const { return m_data; }
+            _T*         end() const { return m_data + m_size; }
+
+            _T&         operator[](CLsize_t index) const { return m_data[index]; }
+
+        private:
+            _T*         m_data;
+            CLsize_t    m_size;
+        };
+    }
 }
 
 #endif // CLOUD_LUA_CPP_UTILITY_HEADER
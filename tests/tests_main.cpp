@@ -1,10 +1,747 @@
 
 
 #include "../source/state_ex.h"
+#include "../source/state_pool.h"
+#include "../source/state_template.h"
+#include "../source/bytecode_cache.h"
+#include "../source/mapped_file.h"
+#include "../source/scheduler.h"
+#include "../source/executor.h"
+#include "../source/profiler.h"
+#include "../source/instrumentation.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <filesystem>
 
+namespace
+{
+    CLint Add(CLint a, CLint b)
+    {
+        return a + b;
+    }
+
+    CLfloat Sum(const std::vector<CLfloat>& values)
+    {
+        CLfloat sum = 0.0f;
+        for (auto value : values)
+        {
+            sum += value;
+        }
+        return sum;
+    }
+
+    CLsize_t Length(Cloud::Lua::StringView text)
+    {
+        return text.size();
+    }
+
+    Cloud::LuaYield<CLint> Wait(CLint frames)
+    {
+        return Cloud::LuaYield<CLint>(frames * 2);
+    }
+
+#ifdef LUACPP_HAS_COROUTINES
+    // stands in for the host's event loop
+    std::vector<std::coroutine_handle<>> s_hostQueue;
+
+    struct HostOperation
+    {
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { s_hostQueue.push_back(handle); }
+        void await_resume() const {}
+    };
+
+    void RunHostQueue()
+    {
+        auto ready = std::move(s_hostQueue);
+        for (auto handle : ready)
+        {
+            handle.resume();
+        }
+    }
+
+    Cloud::LuaTask<CLint> Fetch(CLint id)
+    {
+        co_await HostOperation();
+        if (id < 0)
+        {
+            throw std::runtime_error("bad id");
+        }
+        co_return id * 10;
+    }
+
+    Cloud::LuaTask<CLint> FetchCached(CLint id)
+    {
+        co_return id + 1;
+    }
+
+    Cloud::LuaTask<CLint> RunFetches(Cloud::LuaThread& thread, CLint id)
+    {
+        co_return co_await thread.ResumeAsync<CLint>(id);
+    }
+#endif
+
+    struct Vec2
+    {
+        Vec2() : x(0.0f), y(0.0f) { ++s_alive; }
+        Vec2(CLfloat x_, CLfloat y_) : x(x_), y(y_) { ++s_alive; }
+        Vec2(const Vec2& other) : x(other.x), y(other.y) { ++s_alive; }
+        ~Vec2() { --s_alive; }
+
+        CLfloat Dot(const Vec2& other) const { return x * other.x + y * other.y; }
+        void Scale(CLfloat factor) { x *= factor; y *= factor; }
+
+        CLfloat x;
+        CLfloat y;
+        static CLint s_alive;
+    };
+
+    CLint Vec2::s_alive = 0;
+
+    // never registered as a user type
+    struct Opaque
+    {
+        CLint value = 0;
+    };
+
+    Opaque MakeOpaque()
+    {
+        return Opaque();
+    }
+
+    struct Counter
+    {
+        CLint Increment(CLint amount) { m_count += amount; return m_count; }
+        CLint m_count = 0;
+    };
+}
 
 int main()
 {
     Cloud::LuaStateEx m_luaState;
+    Cloud::LuaStateEx pooledState(Cloud::Lua::MakeUnique<Cloud::LuaPoolAllocator>());
+
+    const auto& memory = pooledState.GetMemoryStats();
+    assert(memory.liveBytes > 0 && memory.peakBytes >= memory.liveBytes);
+
+    {
+        Cloud::LuaState limitedState;
+        limitedState.SetMemoryLimit(limitedState.GetMemoryStats().liveBytes + 64 * 1024);
+        assert(limitedState.DoChunk("local t = {} for i = 1, 1e6 do t[i] = tostring(i) end") == Cloud::Lua::ErrorCode::ErrMem);
+        assert(limitedState.GetMemoryStats().failedAllocations > 0);
+        limitedState.Pop(1);
+
+        limitedState.SetMemoryLimit(0);
+        assert(limitedState.DoChunk("local t = {} for i = 1, 1e5 do t[i] = tostring(i) end return #t") == Cloud::Lua::ErrorCode::Ok);
+        assert(limitedState.To<CLint>(-1) == 100000);
+        limitedState.Pop(1);
+    }
+
+    {
+        using Pool = Cloud::LuaPoolAllocator;
+        Pool pool;
+        auto* small = static_cast<CLchar*>(Pool::Allocate(&pool, nullptr, LUA_TSTRING, 20));
+        assert(small && pool.GetSlabBytes() == Pool::SlabSize);
+        assert(Pool::Allocate(&pool, small, 20, 32) == small);
+        Pool::Allocate(&pool, small, 32, 0);
+        assert(Pool::Allocate(&pool, nullptr, 0, 25) == small);
+        std::memcpy(small, "0123456789abcdefghi", 20);
+
+        auto* grown = static_cast<CLchar*>(Pool::Allocate(&pool, small, 25, 100));
+        assert(grown != small && std::memcmp(grown, "0123456789abcdefghi", 20) == 0);
+        auto* shrunk = static_cast<CLchar*>(Pool::Allocate(&pool, grown, 100, 16));
+        assert(shrunk != grown && std::memcmp(shrunk, "0123456789abcdef", 16) == 0);
+        auto* large = static_cast<CLchar*>(Pool::Allocate(&pool, shrunk, 16, 2 * Pool::MaxBlockSize));
+        assert(large && std::memcmp(large, "0123456789abcdef", 16) == 0);
+        auto* pooledAgain = static_cast<CLchar*>(Pool::Allocate(&pool, large, 2 * Pool::MaxBlockSize, 48));
+        assert(pooledAgain && std::memcmp(pooledAgain, "0123456789abcdef", 16) == 0);
+        Pool::Allocate(&pool, pooledAgain, 48, 0);
+        assert(pool.GetSlabBytes() == Pool::SlabSize && pool.GetAdoptedBlocks() == 0);
+    }
+
+    {
+        // a shrink from malloc into a pool that can't grow keeps the block, the destructor frees it
+        using Pool = Cloud::LuaPoolAllocator;
+        Pool pool(Pool::SlabSize);
+        std::vector<void*> blocks;
+        while (auto* block = Pool::Allocate(&pool, nullptr, 0, Pool::Granularity))
+        {
+            blocks.push_back(block);
+        }
+        assert(!blocks.empty() && pool.GetSlabBytes() == Pool::SlabSize);
+
+        auto* large = Pool::Allocate(&pool, nullptr, 0, 2 * Pool::MaxBlockSize);
+        assert(large && Pool::Allocate(&pool, large, 2 * Pool::MaxBlockSize, 64) == large);
+        assert(pool.GetAdoptedBlocks() == 1);
+        Pool::Allocate(&pool, large, 64, 0);
+        assert(Pool::Allocate(&pool, nullptr, 0, 64) == large);
+        assert(!Pool::Allocate(&pool, blocks.back(), Pool::Granularity, 2 * Pool::Granularity));
+        Pool::Allocate(&pool, large, 64, 0);
+
+        Cloud::LuaState pooledLimitedState(Cloud::Lua::MakeUnique<Pool>(2 * Pool::SlabSize));
+        assert(pooledLimitedState.DoChunk("local t = {} for i = 1, 1e5 do t[i] = { i } end") == Cloud::Lua::ErrorCode::ErrMem);
+        pooledLimitedState.Pop(1);
+        assert(pooledLimitedState.DoChunk("collectgarbage() return 1 + 2") == Cloud::Lua::ErrorCode::Ok);
+        pooledLimitedState.Pop(1);
+    }
+
+    Counter counter;
+    m_luaState.RegisterFunction<&Add>("add");
+    m_luaState.RegisterMethod<&Counter::Increment>("increment", &counter);
+    assert(m_luaState.Call<CLint>("add", 2, 3) == 5);
+    assert(m_luaState.Call<CLint>("increment", 4) == 4 && counter.m_count == 4);
+
+    auto addRef = m_luaState.GetFunction<CLint(CLint, CLint)>("add");
+    assert(addRef.IsValid() && addRef(20, 22) == 42);
+    assert(!m_luaState.GetFunction<void()>("undefinedFunction").IsValid());
+    Cloud::LuaFunctionRef<CLint(CLint, CLint)> emptyRef;
+    assert(emptyRef(1, 2) == 0 && emptyRef.GetLastError() == Cloud::Lua::ErrorCode::ErrRun);
+    addRef.Reset();
+    assert(addRef(1, 2) == 0 && addRef.GetLastError() == Cloud::Lua::ErrorCode::ErrRun);
+    const std::vector<std::tuple<CLint, CLint>> resetArgs = { { 1, 2 } };
+    assert(addRef.CallBatch(resetArgs).error == Cloud::Lua::ErrorCode::ErrRun);
+
+    m_luaState.DoChunk("function scale(x, y) if x < 0 then error('negative') end return x * y end");
+    auto scaleRef = m_luaState.GetFunction<CLint(CLint, CLint)>("scale");
+    std::vector<std::tuple<CLint, CLint>> batchArgs = { { 1, 2 }, { 3, 4 }, { -1, 0 }, { 5, 6 } };
+    std::vector<CLint> batchResults(batchArgs.size());
+    auto batch = scaleRef.CallBatch(batchArgs, batchResults);
+    assert(batch.error == Cloud::Lua::ErrorCode::ErrRun && batch.failedIndex == 2 && batch.completed == 2);
+    assert(batchResults[0] == 2 && batchResults[1] == 12);
+
+    m_luaState.RegisterFunction<&Wait>("wait");
+    m_luaState.DoChunk("function patrol(steps) local total = 0 for i = 1, steps do total = total + wait(i) end"
+                       " local a, b = coroutine.yield('done') return total + a + b end");
+    auto patrol = m_luaState.NewThread("patrol");
+    assert(patrol.IsValid() && patrol.GetStatus() == Cloud::Lua::ThreadStatus::Suspended);
+    assert(patrol.Resume<CLint>(2) == 2 && patrol.Resume<CLint>(10) == 4);
+    assert(patrol.Resume<Cloud::Lua::String>(20) == "done" && patrol.GetLastError() == Cloud::Lua::ErrorCode::Yield);
+    assert((patrol.Resume<CLint, CLint>(1, 2) == std::make_tuple(33, 0)) && patrol.IsDead());
+    patrol.Resume<>();
+    assert(patrol.GetLastError() == Cloud::Lua::ErrorCode::ErrRun);
+    assert(patrol.Resume<CLint>(5) == 0 && patrol.GetLastError() == Cloud::Lua::ErrorCode::ErrRun && patrol.IsDead());
+    assert(!m_luaState.NewThread("undefinedFunction").IsValid());
+    assert(m_luaState.Call<CLint>("add", 1, 1) == 2 && m_luaState.GetTop() == 0);
+
+#ifdef LUACPP_HAS_COROUTINES
+    m_luaState.RegisterFunction<&Fetch>("fetch");
+    m_luaState.RegisterFunction<&FetchCached>("fetchCached");
+    m_luaState.DoChunk("function fetchAll(id) return fetch(id) + fetch(id + 1) + fetchCached(1) end");
+    auto fetchThread = m_luaState.NewThread("fetchAll");
+    auto otherThread = m_luaState.NewThread("fetchAll");
+    auto fetches = RunFetches(fetchThread, 2);
+    auto otherFetches = RunFetches(otherThread, -1);
+    fetches.Start();
+    otherFetches.Start();
+    assert(!fetches.IsDone() && fetchThread.IsSuspended() && s_hostQueue.size() == 2);
+    RunHostQueue();
+    assert(!fetches.IsDone() && otherFetches.IsDone() && otherFetches.GetResult() == 0);
+    assert(otherThread.GetLastError() == Cloud::Lua::ErrorCode::ErrRun);
+    RunHostQueue();
+    assert(fetches.IsDone() && fetches.GetResult() == 52 && fetchThread.IsDead());
+    auto deadFetches = RunFetches(fetchThread, 1);
+    deadFetches.Start();
+    assert(deadFetches.IsDone() && deadFetches.GetResult() == 0 && fetchThread.GetLastError() == Cloud::Lua::ErrorCode::ErrRun);
+    auto syncThread = m_luaState.NewThread("fetchAll");
+    syncThread.Resume<CLint>(1);
+    assert(syncThread.GetLastError() == Cloud::Lua::ErrorCode::ErrRun && s_hostQueue.empty());
+#endif
+
+    {
+        Cloud::LuaStateEx actorState;
+        Cloud::Lua::SchedulerConfig schedulerConfig;
+        schedulerConfig.instructionBudget = 1000;
+        schedulerConfig.wheelSlots = 8;
+        auto schedulerOwner = Cloud::Lua::MakeUnique<Cloud::LuaScheduler>(actorState, schedulerConfig);
+        auto& scheduler = *schedulerOwner;
+
+        actorState.Push(static_cast<CLint>(scheduler.CreateEvent()));
+        actorState.SetGlobal("doorOpened");
+        actorState.DoChunk("log = {}\n"
+                           "function sleeper(name, ticks) scheduler.sleep(ticks) log[#log + 1] = name end\n"
+                           "function waiter() scheduler.wait(doorOpened) log[#log + 1] = 'door' end\n"
+                           "function spinner() local gen = coroutine.wrap(function() for i = 1, 1e9 do coroutine.yield(i) end end)\n"
+                           "    while true do assert(gen() ~= nil) end end\n");
+
+        scheduler.Spawn("sleeper", "late", 20);
+        scheduler.Spawn("sleeper", "soon", 2);
+        scheduler.Spawn("waiter");
+        const auto spinner = scheduler.Spawn("spinner");
+        assert(scheduler.Spawn("undefinedFunction") == 0);
+        assert(scheduler.Run() == 4);
+
+        auto schedulerStats = scheduler.GetStats();
+        assert(schedulerStats.tasks == 4 && schedulerStats.ready == 1 && schedulerStats.sleeping == 2 && schedulerStats.waiting == 1);
+        assert(schedulerStats.preemptions == 1 && scheduler.GetTaskStats(spinner).state == Cloud::Lua::TaskState::Ready);
+
+        scheduler.Update(2);
+        assert(scheduler.Signal(0) == 1 && scheduler.Run() == 2);
+        actorState.DoChunk("scheduler.spawn(function(name) log[#log + 1] = name end, 'spawned')");
+        scheduler.Update(18);
+        assert(actorState.DoChunk("assert(table.concat(log, ',') == 'soon,door,spawned,late')") == Cloud::Lua::ErrorCode::Ok);
+        assert(actorState.DoChunk("scheduler.sleep(1)") == Cloud::Lua::ErrorCode::ErrRun);
+        actorState.Pop(1);
+
+        assert(scheduler.GetTaskStats(spinner).preemptions == 4 && scheduler.GetTaskStats(spinner).runNanoseconds > 0.0);
+        assert(scheduler.Cancel(spinner) && !scheduler.Cancel(spinner));
+        schedulerStats = scheduler.GetStats();
+        assert(schedulerStats.tasks == 0 && schedulerStats.completed == 4 && schedulerStats.peakTasks == 4);
+
+        // pending tasks are released with the scheduler, functions scripts kept raise an error
+        actorState.DoChunk("cachedNow = scheduler.now\n"
+                           "function holder() local guard = setmetatable({}, { __gc = function() released = true end }) scheduler.wait(doorOpened) end");
+        scheduler.Spawn("holder");
+        assert(scheduler.Run() == 1 && scheduler.GetStats().waiting == 1);
+        schedulerOwner.reset();
+        assert(actorState.DoChunk("collectgarbage() assert(released and scheduler == nil)") == Cloud::Lua::ErrorCode::Ok);
+        assert(actorState.DoChunk("cachedNow()") == Cloud::Lua::ErrorCode::ErrRun);
+        assert(std::strstr(actorState.To<const CLchar*>(-1), "was destroyed") != nullptr);
+        actorState.Pop(1);
+    }
+
+    {
+        Cloud::LuaExecutor executor(3, [](Cloud::LuaStateEx& state)
+        {
+            state.RegisterFunction<&Add>("add");
+            state.DoChunk("function square(x) return add(x * x, 0) end\n"
+                          "function greet(name) return 'hi ' .. name, #name end\n"
+                          "function fail() error('boom') end\n");
+        });
+
+        std::vector<std::future<CLint>> squares;
+        for (CLint i = 0; i < 1000; ++i)
+        {
+            squares.push_back(executor.Submit<CLint>("square", i));
+        }
+
+        CLchar name[] = "lua";
+        auto greeting = executor.Submit<std::tuple<Cloud::Lua::String, CLint>>("greet", name);
+        name[0] = 'X';
+        auto failure = executor.Submit<void>("fail");
+
+        CLint squareSum = 0;
+        for (auto& square : squares)
+        {
+            squareSum += square.get();
+        }
+        assert(squareSum == 332833500 && greeting.get() == std::make_tuple(Cloud::Lua::String("hi lua"), 3));
+
+        CLbool threw = false;
+        try
+        {
+            failure.get();
+        }
+        catch (const Cloud::LuaCallError& error)
+        {
+            threw = error.GetError() == Cloud::Lua::ErrorCode::ErrRun && std::strstr(error.what(), "boom") != nullptr;
+        }
+        assert(threw);
+
+        const auto executorStats = executor.GetStats();
+        assert(executorStats.workers == 3 && executorStats.submitted == 1002 && executorStats.executed <= 1002);
+    }
+
+    {
+        // one failing initializer fails the construction, the other workers are stopped
+        std::atomic<CLint> initializing { 0 };
+        CLbool threw = false;
+        try
+        {
+            Cloud::LuaExecutor executor(3, [&initializing](Cloud::LuaStateEx&)
+            {
+                if (initializing.fetch_add(1) == 1)
+                {
+                    throw std::runtime_error("no scripts");
+                }
+            });
+        }
+        catch (const std::runtime_error& error)
+        {
+            threw = std::strcmp(error.what(), "no scripts") == 0;
+        }
+        assert(threw && initializing == 3);
+    }
+
+    {
+        Cloud::LuaStateEx source;
+        Cloud::LuaStateEx target;
+        source.DoChunk("local shared = { 'x', 'y' }\n"
+                       "payload = { 1, 2.5, -7, 1 << 40, 'short', string.rep('long', 40), true, false,\n"
+                       "    nested = { deep = { deeper = {} } }, a = shared, b = shared, [3.5] = 'float key', [-1] = 'negative' }\n"
+                       "payload.self = payload\n");
+        source.GetGlobal("payload");
+
+        Cloud::Lua::String encoded;
+        assert(source.Serialize(-1, encoded) && source.GetTop() == 1);
+        source.Push(42);
+        assert(source.Serialize(-1, encoded));
+        source.Pop(2);
+
+        CLsize_t consumed = 0;
+        assert(target.Deserialize(encoded, &consumed) && consumed < encoded.size());
+        target.SetGlobal("payload");
+        assert(target.Deserialize(Cloud::Lua::StringView(encoded).substr(consumed)) && target.To<CLint>(-1) == 42);
+        target.Pop(1);
+        assert(target.DoChunk("assert(#payload == 8 and payload[2] == 2.5 and math.type(payload[4]) == 'integer' and payload[4] == 1 << 40)\n"
+                              "assert(payload[6] == string.rep('long', 40) and payload[7] == true and payload[8] == false)\n"
+                              "assert(payload.a == payload.b and payload.a[2] == 'y' and payload.self == payload)\n"
+                              "assert(payload[3.5] == 'float key' and payload[-1] == 'negative' and next(payload.nested.deep.deeper) == nil)\n") == Cloud::Lua::ErrorCode::Ok);
+
+        assert(!target.Deserialize(encoded.data(), encoded.size() / 2) && target.GetTop() == 0);
+        assert(!target.Deserialize("\x06\xff\xff\xff\xff\x0f\x00", 7) && target.GetTop() == 0);
+
+        // every level claims the rest of the input, only the first may presize
+        Cloud::Lua::String nested;
+        for (CLint level = 0; level < 150; ++level)
+        {
+            nested += "\x06\x80\x80\x06";
+            nested.push_back('\0');
+        }
+        nested.append(100 * 1024, '\0');
+        const auto peakBytes = target.GetMemoryStats().peakBytes;
+        assert(!target.Deserialize(nested) && target.GetTop() == 0);
+        assert(target.GetMemoryStats().peakBytes < peakBytes + 4 * 1024 * 1024);
+
+        const auto size = encoded.size();
+        source.DoChunk("return { print }");
+        assert(!source.Serialize(-1, encoded) && encoded.size() == size);
+        source.Pop(1);
+    }
+
+    {
+        Cloud::Lua::SharedPtr<const Cloud::LuaSharedData> shared;
+        {
+            Cloud::LuaStateEx loader;
+            loader.DoChunk("local unit = { name = 'archer', cost = 3 }\n"
+                           "config = { units = { unit, { name = 'knight', cost = 5 }, unit }, scale = 1.5, [2.0] = 'two', [true] = 'yes' }\n"
+                           "config.self = config\n"
+                           "config[config.units] = 'table key'\n");
+            loader.GetGlobal("config");
+            shared = loader.ToSharedData(-1);
+            assert(shared && shared->GetTableCount() == 4 && loader.GetTop() == 1);
+            loader.Pop(1);
+
+            loader.DoChunk("return { print }");
+            assert(!loader.ToSharedData(-1) && loader.GetTop() == 1);
+        }
+
+        Cloud::LuaStateEx first;
+        Cloud::LuaStateEx second;
+        for (auto* state : { &first, &second })
+        {
+            state->PushSharedData(shared);
+            state->SetGlobal("config");
+            assert(state->DoChunk("assert(config.units[2].name == 'knight' and #config.units == 3 and config.scale == 1.5)\n"
+                                  "assert(config[2] == 'two' and config[2.0] == 'two' and config[true] == 'yes' and config.missing == nil)\n"
+                                  "assert(config.units[1] == config.units[3] and config.self == config and config[config.units] == 'table key')\n"
+                                  "local cost = 0 for i, unit in ipairs(config.units) do cost = cost + unit.cost end\n"
+                                  "assert(cost == 11)\n"
+                                  "local keys = 0 for k, v in pairs(config) do assert(config[k] == v) keys = keys + 1 end\n"
+                                  "assert(keys == 6 and type(config) == 'userdata' and getmetatable(config) == false)\n"
+                                  "assert(not pcall(function() config.scale = 2 end))\n") == Cloud::Lua::ErrorCode::Ok);
+        }
+        assert(shared.use_count() == 3);
+
+        // the metamethods are reachable through the debug library with any argument
+        assert(first.DoChunk("local meta = debug.getmetatable(config)\n"
+                             "local ok, message = pcall(meta.__len, io.stdout)\n"
+                             "assert(not ok and message:find('shared table expected'))\n"
+                             "assert(not pcall(meta.__index, io.stdout, 'units') and not pcall(meta.__index, {}, 1))\n"
+                             "assert(meta.__len(config.units) == 3)\n") == Cloud::Lua::ErrorCode::Ok);
+    }
+
+    {
+        Cloud::LuaStateEx state;
+        Cloud::LuaProfiler profiler(state);
+        state.DoChunk("local function inner(n) local x = 0 for i = 1, n do x = x + i end return { x } end\n"
+                      "function busy(seconds)\n"
+                      "    local start = os.clock()\n"
+                      "    while os.clock() - start < seconds do inner(1000) end\n"
+                      "end\n", "@profiled.lua");
+
+        assert(profiler.Start(1000) && !profiler.Start(1000));
+        state.Call<>("busy", 0.2);
+        profiler.Stop();
+        assert(!profiler.IsRunning());
+
+        Cloud::Lua::String collapsed;
+        profiler.WriteCollapsed(collapsed);
+        const auto stats = profiler.GetStats();
+        assert(stats.samples > 0 && stats.stacks > 0 && stats.truncated == 0);
+        assert(collapsed.find("? profiled.lua:2;inner profiled.lua:1 ") != Cloud::Lua::String::npos);
+        assert(collapsed.back() == '\n');
+
+        profiler.Clear();
+        collapsed.clear();
+        profiler.WriteCollapsed(collapsed);
+        assert(collapsed.empty() && profiler.GetStats().samples == 0);
+
+        // a hook installed before is kept, its ticks are skipped
+        state.DoChunk("userHook = function() end debug.sethook(userHook, '', 100000)");
+        assert(profiler.Start(1000));
+        state.Call<>("busy", 0.05);
+        profiler.Stop();
+        assert(profiler.GetStats().samples == 0 && profiler.GetStats().skipped > 0);
+        assert(state.DoChunk("assert(debug.gethook() == userHook) debug.sethook()") == Cloud::Lua::ErrorCode::Ok);
+    }
+
+    {
+        using Histogram = Cloud::Lua::LatencyHistogram;
+        assert(Histogram::GetBucket(0) == 0 && Histogram::GetBucket(15) == 15 && Histogram::GetBucket(16) == 16 && Histogram::GetBucket(17) == 17);
+        assert(Histogram::GetBucket(32) == 32 && Histogram::GetBucket(33) == 32 && Histogram::GetBucket(~std::uint64_t(0)) == Histogram::c_bucketCount - 1);
+        for (std::uint64_t value : { 1ull, 100ull, 12345ull, 1000000007ull })
+        {
+            const auto bucket = Histogram::GetBucket(value);
+            assert(Histogram::GetBucketLowerBound(bucket) <= value && value < Histogram::GetBucketUpperBound(bucket));
+        }
+
+        Histogram histogram;
+        for (std::uint64_t i = 1; i <= 1000; ++i)
+        {
+            histogram.Record(i * 1000);
+        }
+        assert(histogram.GetCount() == 1000 && histogram.GetMean() == 500500.0);
+        const auto median = histogram.GetPercentile(50.0);
+        const auto p99 = histogram.GetPercentile(99.0);
+        assert(median >= 500000 && median <= 500000 * 1.0625 + 1 && p99 >= 990000 && p99 <= 990000 * 1.0625 + 1);
+        assert(histogram.GetMax() >= 1000000 && histogram.GetPercentile(0.0) >= 1000);
+
+        Histogram merged;
+        merged.Merge(histogram);
+        merged.Merge(histogram);
+        assert(merged.GetCount() == 2000 && merged.GetPercentile(50.0) == median);
+
+#ifdef LUACPP_INSTRUMENTATION
+        Cloud::LuaStateEx state;
+        state.RegisterFunction("twice", Cloud::Lua::Function<CLint(CLint)>([](CLint value) { return value * 2; }));
+        state.RegisterFunction("unused", Cloud::Lua::Function<void()>([]() {}));
+        state.RegisterFunction("pause", Cloud::Lua::Function<Cloud::LuaYield<CLint>(CLint)>(&Wait));
+        assert(state.DoChunk("for i = 1, 100 do twice(i) end") == Cloud::Lua::ErrorCode::Ok);
+        assert(state.DoChunk("coroutine.wrap(function() pause(1) end)()") == Cloud::Lua::ErrorCode::Ok);
+
+        auto stats = state.GetBindingStats();
+        assert(stats.size() == 3);
+        for (const auto& binding : stats)
+        {
+            // the yield skips recording the latency
+            const auto paused = std::strcmp(binding.name, "pause") == 0;
+            const auto expected = std::strcmp(binding.name, "twice") == 0 ? 100u : 0u;
+            assert(binding.calls == (paused ? 1u : expected) && binding.latency.GetCount() == expected);
+        }
+
+        state.ResetBindingStats();
+        assert(state.GetBindingStats()[0].calls == 0);
+#endif
+    }
+
+    {
+        using Cloud::Lua::GcPhase;
+
+        Cloud::LuaState state;
+        state.SetGcTelemetry(true);
+        assert(state.DoChunk("local keep = {} for i = 1, 20000 do keep[i % 100] = { i, tostring(i) } end") == Cloud::Lua::ErrorCode::Ok);
+        assert(state.DoChunk("collectgarbage()") == Cloud::Lua::ErrorCode::Ok);
+
+        auto stats = state.GetGcStats();
+        assert(stats.steps.GetCount() > 0 && stats.fullCollections.GetCount() == 1);
+        assert(stats.GetPhase(GcPhase::Propagate).GetCount() > 0 && stats.GetPhase(GcPhase::Atomic).GetCount() > 0);
+        assert(stats.GetPhase(GcPhase::Sweep).GetCount() > 0 && stats.bytesFreed > 0);
+
+        // a collection from a finalizer is recorded on its own, the one running the finalizer still ends
+        state.ResetGcStats();
+        assert(state.DoChunk("setmetatable({}, { __gc = function() collectgarbage() end }) collectgarbage()") == Cloud::Lua::ErrorCode::Ok);
+        stats = state.GetGcStats();
+        assert(stats.fullCollections.GetCount() == 2 && stats.GetPhase(GcPhase::Finalize).GetCount() >= 1);
+
+        state.SetGcTelemetry(false);
+        assert(state.DoChunk("collectgarbage()") == Cloud::Lua::ErrorCode::Ok);
+        assert(state.GetGcStats().fullCollections.GetCount() == 0);
+    }
+
+    m_luaState.RegisterFunction<&Sum>("sum");
+    const std::vector<CLfloat> values = { 1.0f, 2.0f, 3.5f };
+    assert(m_luaState.Call<CLfloat>("sum", values) == 6.5f);
+    m_luaState.Push(std::array<CLint, 3>{ { 4, 5, 6 } });
+    assert((m_luaState.To<std::vector<double>>(-1) == std::vector<double>{ 4.0, 5.0, 6.0 }));
+    m_luaState.Pop(1);
+
+    m_luaState.RegisterFunction<&Length>("length");
+    const Cloud::Lua::String withZero("a\0b", 3);
+    assert(m_luaState.Call<CLint>("length", withZero) == 3);
+    m_luaState.Push(withZero);
+    assert(m_luaState.To<Cloud::Lua::String>(-1) == withZero);
+    m_luaState.Pop(1);
+
+    m_luaState.RegisterUserType<Vec2>("Vec2")
+        .Constructor<CLfloat, CLfloat>()
+        .Method<&Vec2::Dot>("dot")
+        .Method<&Vec2::Scale>("scale")
+        .Property<&Vec2::x>("x")
+        .ReadOnlyProperty<&Vec2::y>("y");
+    m_luaState.DoChunk("local v = Vec2.new(1, 2) v:scale(2) v.x = v.x + 1 vecResult = v:dot(Vec2.new(1, 2))");
+    assert(m_luaState.GetGlobal("vecResult") == Cloud::Lua::Type::Number && m_luaState.To<CLint>(-1) == 11);
+    m_luaState.Pop(1);
+    assert(m_luaState.DoChunk("Vec2.new(1, 2).y = 3") == Cloud::Lua::ErrorCode::ErrRun);
+    assert(std::strstr(m_luaState.To<const CLchar*>(-1), "'Vec2' has no writable property 'y'") != nullptr);
+    m_luaState.Pop(1);
+
+    // the metatable is hidden, a __gc reached through the debug library destroys once and only owned objects
+    m_luaState.DoChunk("collectgarbage() collectgarbage('stop')");
+    const auto aliveBefore = Vec2::s_alive;
+    assert(m_luaState.DoChunk("local v = Vec2.new(1, 2) assert(getmetatable(v) == false)\n"
+                              "local gc = debug.getmetatable(v).__gc gc(v) gc(v) gc(5) gc(nil) destroyedVec = v") == Cloud::Lua::ErrorCode::Ok);
+    assert(Vec2::s_alive == aliveBefore);
+    assert(m_luaState.DoChunk("return destroyedVec:dot(Vec2.new(1, 2))") == Cloud::Lua::ErrorCode::ErrRun);
+    assert(std::strstr(m_luaState.To<const CLchar*>(-1), "Vec2 was already destroyed") != nullptr);
+    m_luaState.Pop(1);
+    assert(m_luaState.DoChunk("return destroyedVec.x") == Cloud::Lua::ErrorCode::ErrRun);
+    m_luaState.Pop(1);
+    m_luaState.DoChunk("collectgarbage('restart') destroyedVec = nil collectgarbage()");
+    assert(Vec2::s_alive == aliveBefore);
+
+    // bindings outlive the finalizers run by lua_close
+    CLint finalized = 0;
+    {
+        Cloud::LuaStateEx closingState;
+        closingState.RegisterFunction("finalized", Cloud::Lua::Function<void(CLint)>([&finalized](CLint value) { finalized += value; }));
+        assert(closingState.DoChunk("keepAlive = setmetatable({}, { __gc = function() finalized(1) end })") == Cloud::Lua::ErrorCode::Ok);
+    }
+    assert(finalized == 1);
+
+    m_luaState.RegisterFunction<&MakeOpaque>("makeOpaque");
+    assert(m_luaState.DoChunk("makeOpaque()") == Cloud::Lua::ErrorCode::ErrRun);
+    assert(std::strstr(m_luaState.To<const CLchar*>(-1), "unregistered type") != nullptr);
+    m_luaState.Pop(1);
+
+    auto* pushed = m_luaState.PushObject<Vec2>(3.0f, 4.0f);
+    assert(m_luaState.ToObject<Vec2>(-1) == pushed && m_luaState.ToUserDataChecked<Vec2>(-1) == pushed);
+    assert(!m_luaState.ToObject<Counter>(-1));
+    m_luaState.Pop(1);
+
+    // the host side reports values of the wrong type instead of raising outside a protected call
+    m_luaState.Push(1);
+    assert(m_luaState.To<Vec2>(-1).x == 0.0f);
+    m_luaState.Pop(1);
+    m_luaState.DoChunk("function vecNil() return nil end function vecNumber() return 1 end"
+                       " function vecForeign() return io.stdout end function vecOk() return Vec2.new(5, 6) end");
+    for (const auto* name : { "vecNil", "vecNumber", "vecForeign" })
+    {
+        auto vecRef = m_luaState.GetFunction<Vec2()>(name);
+        assert(vecRef().x == 0.0f && vecRef.GetLastError() == Cloud::Lua::ErrorCode::ErrRun);
+    }
+    auto vecOkRef = m_luaState.GetFunction<Vec2()>("vecOk");
+    assert(vecOkRef().x == 5.0f && vecOkRef.GetLastError() == Cloud::Lua::ErrorCode::Ok);
+    auto vecThread = m_luaState.NewThread("vecNumber");
+    assert(vecThread.Resume<Vec2>().x == 0.0f && vecThread.GetLastError() == Cloud::Lua::ErrorCode::ErrRun);
+    const auto topBefore = m_luaState.GetTop();
+    m_luaState.Push(Opaque());
+    assert(m_luaState.GetTop() == topBefore + 1 && m_luaState.IsType<Cloud::Lua::Type::Nil>(-1));
+    m_luaState.Pop(1);
+    auto opaqueRef = m_luaState.GetFunction<void(Opaque)>("vecOk");
+    opaqueRef(Opaque());
+    assert(opaqueRef.GetLastError() == Cloud::Lua::ErrorCode::ErrRun);
+
+    m_luaState.PushLightUserDataChecked(&counter);
+    assert(m_luaState.ToUserDataChecked<Counter>(-1) == &counter && !m_luaState.ToUserDataChecked<Vec2>(-1));
+    m_luaState.Pop(1);
+
+    m_luaState.DoChunk("collectgarbage()");
+    assert(Vec2::s_alive == 0);
+
+    const Cloud::LuaTypeInfo* workerTypes[2] = {};
+    std::thread worker([&workerTypes]()
+    {
+        Cloud::LuaStateEx workerState;
+        workerTypes[0] = Cloud::LuaTypeRegistry::Get<Vec2>();
+        workerTypes[1] = Cloud::LuaTypeRegistry::Get<Counter>();
+    });
+    const auto* counterType = Cloud::LuaTypeRegistry::Get<Counter>();
+    worker.join();
+    assert(workerTypes[0] == Cloud::LuaTypeRegistry::Get<Vec2>() && workerTypes[1] == counterType);
+    assert(Cloud::LuaTypeRegistry::Find(counterType->id) == counterType && !Cloud::LuaTypeRegistry::Find(&counter));
+
+    Cloud::LuaStatePool pool(2, [](Cloud::LuaStateEx& state)
+    {
+        state.RegisterFunction("double", Cloud::Lua::Function<CLint(CLint)>([](CLint value) { return value * 2; }));
+        state.DoChunk("base = 1");
+    });
+    {
+        auto first = pool.Checkout();
+        auto second = pool.Checkout();
+        assert(!pool.TryCheckout().IsValid() && pool.GetStats().inUse == 2);
+        assert(first->Call<CLint>("double", 21) == 42);
+        first->DoChunk("base = 2 scratch = true");
+    }
+    {
+        auto state = pool.Checkout();
+        assert(state->GetGlobal("scratch") == Cloud::Lua::Type::Nil && state->GetGlobal("base") == Cloud::Lua::Type::Number);
+        assert(state->To<CLint>(-1) == 1 && state->Call<CLint>("double", 4) == 8);
+        state->Pop(2);
+    }
+    const auto poolStats = pool.GetStats();
+    assert(poolStats.inUse == 0 && poolStats.peakInUse == 2 && poolStats.checkouts == 3);
+
+    auto fork = []()
+    {
+        Cloud::LuaStateTemplate stateTemplate;
+        auto& templateState = stateTemplate.GetState();
+        templateState.RegisterFunction<&Add>("add");
+        templateState.RegisterFunction("triple", Cloud::Lua::Function<CLint(CLint)>([](CLint value) { return value * 3; }));
+        templateState.RegisterUserType<Vec2>("Vec2").Constructor<CLfloat, CLfloat>().Method<&Vec2::Dot>("dot");
+        templateState.DoChunk(
+            "package.preload.counter = function() local n = 0 return { inc = function() n = n + 1 return n end, get = function() return n end } end\n"
+            "local counter = require('counter')\n"
+            "counter.inc()\n"
+            "node = { name = 'root' } node.self = node\n"
+            "setmetatable(node, { __index = function(_, key) return key .. '!' end })\n"
+            "function string.shout(s) return s:upper() end\n"
+            "print = nil\n");
+        assert(stateTemplate.Capture());
+        return stateTemplate.Fork();
+    }();
+    const auto forkResult = fork.DoChunk(
+        "local counter = require('counter')\n"
+        "assert(counter.inc() == 2 and counter.get() == 2)\n"
+        "assert(node.self == node and node.missing == 'missing!')\n"
+        "assert(string.shout('a') == 'A' and print == nil)\n"
+        "assert(add(1, 2) == 3 and triple(3) == 9)\n"
+        "assert(Vec2.new(1, 2):dot(Vec2.new(3, 4)) == 11)\n");
+    assert(forkResult == Cloud::Lua::ErrorCode::Ok);
+
+    const auto cacheRoot = std::filesystem::temp_directory_path() / "luacpp_tests";
+    const auto scriptPath = (cacheRoot / "cached.lua").string();
+    std::filesystem::remove_all(cacheRoot);
+    {
+        Cloud::LuaBytecodeCache cache((cacheRoot / "cache").string().c_str());
+        Cloud::LuaState cachedState;
+        cachedState.SetBytecodeCache(&cache);
+
+        std::ofstream(scriptPath) << "#!/usr/bin/lua\nreturn 40 + 2\n";
+        assert(cachedState.DoFile(scriptPath.c_str()) == Cloud::Lua::ErrorCode::Ok && cachedState.To<CLint>(-1) == 42);
+        assert(cachedState.DoFile(scriptPath.c_str()) == Cloud::Lua::ErrorCode::Ok && cachedState.To<CLint>(-1) == 42);
+        std::ofstream(scriptPath) << "return 7\n";
+        assert(cachedState.DoFile(scriptPath.c_str()) == Cloud::Lua::ErrorCode::Ok && cachedState.To<CLint>(-1) == 7);
+        cachedState.Pop(3);
+
+        const auto cacheStats = cache.GetStats();
+        assert(cacheStats.hits == 1 && cacheStats.misses == 2 && cacheStats.stale == 1 && cacheStats.writeFailures == 0);
+        assert(cachedState.DoFile((cacheRoot / "missing.lua").string().c_str()) == Cloud::Lua::ErrorCode::ErrFile);
+        cachedState.Pop(1);
+
+        Cloud::LuaState mappedState;
+        std::ofstream(scriptPath) << "\xEF\xBB\xBF# comment\nlocal x = 1\nerror('line 3')\n";
+        assert(mappedState.DoFile(scriptPath.c_str()) == Cloud::Lua::ErrorCode::ErrRun);
+        assert(std::strstr(mappedState.To<const CLchar*>(-1), "cached.lua:3: line 3") != nullptr);
+        std::ofstream(scriptPath).flush();
+        assert(mappedState.DoFile(scriptPath.c_str()) == Cloud::Lua::ErrorCode::Ok);
+        assert(mappedState.DoFile((cacheRoot / "missing.lua").string().c_str()) == Cloud::Lua::ErrorCode::ErrFile);
 
-}
\ No newline at end of file
+        Cloud::LuaMappedFile emptyFile(scriptPath.c_str());
+        assert(emptyFile.IsOpen() && emptyFile.GetSize() == 0);
+        assert(!Cloud::LuaMappedFile(cacheRoot.string().c_str()).IsOpen());
+    }
+    std::filesystem::remove_all(cacheRoot);
+}